@@ -0,0 +1,429 @@
+/*
+ * stPinchAlignments.c
+ *
+ *  Streaming ingestion of alignments into pinch graphs.
+ *
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "sonLib.h"
+#include "stPinchGraphs.h"
+#include "stPinchAlignments.h"
+
+/*
+ * A fixed size buffer of pinches, applied to the thread set each time it fills.
+ */
+typedef struct _stPinchChunk {
+    stPinchThreadSet *threadSet;
+    stPinch *pinches;
+    int64_t pinchNumber;
+    int64_t chunkSize;
+    bool parallel;
+    stPinchAlignmentCounters *counters;
+} stPinchChunk;
+
+static void stPinchChunk_init(stPinchChunk *chunk, stPinchThreadSet *threadSet, int64_t chunkSize, bool parallel,
+        stPinchAlignmentCounters *counters) {
+    if (chunkSize <= 0) {
+        st_errAbort("The chunk size must be positive, got %" PRIi64 "\n", chunkSize);
+    }
+    chunk->threadSet = threadSet;
+    chunk->pinches = st_malloc(sizeof(stPinch) * chunkSize);
+    chunk->pinchNumber = 0;
+    chunk->chunkSize = chunkSize;
+    chunk->parallel = parallel;
+    chunk->counters = counters;
+}
+
+static void stPinchChunk_flush(stPinchChunk *chunk) {
+    if (chunk->pinchNumber > 0) {
+        if (chunk->parallel) {
+            stPinchThreadSet_pinchBatchParallel(chunk->threadSet, chunk->pinches, chunk->pinchNumber);
+        } else {
+            stPinchThreadSet_pinchBatch(chunk->threadSet, chunk->pinches, chunk->pinchNumber);
+        }
+        chunk->counters->chunkNumber++;
+        chunk->pinchNumber = 0;
+    }
+}
+
+static void stPinchChunk_destruct(stPinchChunk *chunk) {
+    stPinchChunk_flush(chunk);
+    free(chunk->pinches);
+}
+
+static void stPinchChunk_add(stPinchChunk *chunk, stPinch pinch) {
+    if (pinch.length == 0) {
+        return;
+    }
+    chunk->pinches[chunk->pinchNumber++] = pinch;
+    chunk->counters->pinchNumber++;
+    chunk->counters->alignedBases += pinch.length;
+    if (chunk->pinchNumber == chunk->chunkSize) {
+        stPinchChunk_flush(chunk);
+    }
+}
+
+static stPinchThread *getThread(stPinchThreadSet *threadSet, int64_t name) {
+    stPinchThread *thread = stPinchThreadSet_getThread(threadSet, name);
+    if (thread == NULL) {
+        st_errAbort("There is no thread named %" PRIi64 " in the thread set\n", name);
+    }
+    return thread;
+}
+
+static void checkInterval(stPinchThread *thread, int64_t start, int64_t length) {
+    if (length < 0 || start < stPinchThread_getStart(thread)
+            || start + length > stPinchThread_getStart(thread) + stPinchThread_getLength(thread)) {
+        st_errAbort("The interval %" PRIi64 " of length %" PRIi64 " is not contained in thread %" PRIi64 "\n", start,
+                length, stPinchThread_getName(thread));
+    }
+}
+
+//PAF
+
+/*
+ * A PAF alignment being walked, with the offsets of the aligned columns consumed so far
+ * and the length of the gapless run of columns not yet added as a pinch.
+ */
+typedef struct _stPinchPAFAlignment {
+    stPinchThread *query;
+    stPinchThread *target;
+    int64_t queryStart, queryEnd;
+    int64_t targetStart, targetEnd;
+    bool strand;
+    int64_t queryOffset;
+    int64_t targetOffset;
+    int64_t runLength;
+} stPinchPAFAlignment;
+
+static void stPinchPAFAlignment_addRun(stPinchPAFAlignment *alignment, stPinchChunk *chunk) {
+    int64_t length = alignment->runLength;
+    if (alignment->queryOffset + length > alignment->queryEnd - alignment->queryStart
+            || alignment->targetOffset + length > alignment->targetEnd - alignment->targetStart) {
+        st_errAbort("The alignment string of a PAF record is longer than its intervals\n");
+    }
+    //On the negative strand the reverse complement of the query is aligned, so the query offsets count back from its end
+    int64_t start1 = stPinchThread_getStart(alignment->query)
+            + (alignment->strand ? alignment->queryStart + alignment->queryOffset : alignment->queryEnd - alignment->queryOffset - length);
+    int64_t start2 = stPinchThread_getStart(alignment->target) + alignment->targetStart + alignment->targetOffset;
+    stPinchChunk_add(chunk, stPinch_constructStatic(stPinchThread_getName(alignment->query),
+            stPinchThread_getName(alignment->target), start1, start2, length, alignment->strand));
+    alignment->queryOffset += length;
+    alignment->targetOffset += length;
+    alignment->runLength = 0;
+}
+
+static void stPinchPAFAlignment_match(stPinchPAFAlignment *alignment, int64_t length) {
+    alignment->runLength += length;
+}
+
+static void stPinchPAFAlignment_gap(stPinchPAFAlignment *alignment, stPinchChunk *chunk, int64_t queryLength,
+        int64_t targetLength) {
+    stPinchPAFAlignment_addRun(alignment, chunk);
+    alignment->queryOffset += queryLength;
+    alignment->targetOffset += targetLength;
+}
+
+static void stPinchPAFAlignment_finish(stPinchPAFAlignment *alignment, stPinchChunk *chunk) {
+    stPinchPAFAlignment_addRun(alignment, chunk);
+    if (alignment->queryOffset != alignment->queryEnd - alignment->queryStart
+            || alignment->targetOffset != alignment->targetEnd - alignment->targetStart) {
+        st_errAbort("The alignment string of a PAF record does not cover its intervals\n");
+    }
+}
+
+static int64_t parseLength(const char **string) {
+    if (!isdigit((unsigned char) **string)) {
+        st_errAbort("Expected a length in the PAF alignment string: %s\n", *string);
+    }
+    char *end;
+    int64_t length = strtoll(*string, &end, 10);
+    *string = end;
+    return length;
+}
+
+static int64_t parseBases(const char **string) {
+    int64_t length = 0;
+    while (isalpha((unsigned char) **string)) {
+        length++;
+        (*string)++;
+    }
+    return length;
+}
+
+static void parseCigar(stPinchPAFAlignment *alignment, stPinchChunk *chunk, const char *cigar) {
+    while (*cigar != '\0') {
+        int64_t length = parseLength(&cigar);
+        switch (*cigar++) {
+        case 'M':
+        case '=':
+        case 'X':
+            stPinchPAFAlignment_match(alignment, length);
+            break;
+        case 'I':
+            stPinchPAFAlignment_gap(alignment, chunk, length, 0);
+            break;
+        case 'D':
+        case 'N':
+            stPinchPAFAlignment_gap(alignment, chunk, 0, length);
+            break;
+        default:
+            st_errAbort("Unsupported operation in PAF cg tag: %c\n", cigar[-1]);
+        }
+    }
+}
+
+static void parseDifferenceString(stPinchPAFAlignment *alignment, stPinchChunk *chunk, const char *cs) {
+    while (*cs != '\0') {
+        switch (*cs++) {
+        case ':': //Run of identical bases
+            stPinchPAFAlignment_match(alignment, parseLength(&cs));
+            break;
+        case '=': //Run of identical bases, in the long form
+            stPinchPAFAlignment_match(alignment, parseBases(&cs));
+            break;
+        case '*': //Substitution, giving the target then the query base
+            if (parseBases(&cs) != 2) {
+                st_errAbort("Malformed substitution in PAF cs tag\n");
+            }
+            stPinchPAFAlignment_match(alignment, 1);
+            break;
+        case '+': //Bases only in the query
+            stPinchPAFAlignment_gap(alignment, chunk, parseBases(&cs), 0);
+            break;
+        case '-': //Bases only in the target
+            stPinchPAFAlignment_gap(alignment, chunk, 0, parseBases(&cs));
+            break;
+        default:
+            st_errAbort("Unsupported operation in PAF cs tag: %c\n", cs[-1]);
+        }
+    }
+}
+
+/*
+ * Returns the next tab separated field of the line, terminating it in place, or NULL if there are no more.
+ */
+static char *getNextField(char **line) {
+    char *field = *line;
+    if (field == NULL) {
+        return NULL;
+    }
+    char *tab = strchr(field, '\t');
+    if (tab != NULL) {
+        *tab = '\0';
+        *line = tab + 1;
+    } else {
+        *line = NULL;
+    }
+    return field;
+}
+
+static int64_t parseInt(char *field, const char *recordType) {
+    char *end;
+    int64_t i = field == NULL ? 0 : strtoll(field, &end, 10);
+    if (field == NULL || *field == '\0' || *end != '\0') {
+        st_errAbort("Expected an integer field in %s record, got: %s\n", recordType, field == NULL ? "(missing)" : field);
+    }
+    return i;
+}
+
+static void pinchPAFLine(stPinchThreadSet *threadSet, stPinchChunk *chunk, char *line) {
+    stPinchPAFAlignment alignment;
+    alignment.query = getThread(threadSet, parseInt(getNextField(&line), "PAF"));
+    getNextField(&line); //Query length
+    alignment.queryStart = parseInt(getNextField(&line), "PAF");
+    alignment.queryEnd = parseInt(getNextField(&line), "PAF");
+    char *strand = getNextField(&line);
+    if (strand == NULL || (strcmp(strand, "+") != 0 && strcmp(strand, "-") != 0)) {
+        st_errAbort("Expected a strand field in PAF record, got: %s\n", strand == NULL ? "(missing)" : strand);
+    }
+    alignment.strand = strand[0] == '+';
+    alignment.target = getThread(threadSet, parseInt(getNextField(&line), "PAF"));
+    getNextField(&line); //Target length
+    alignment.targetStart = parseInt(getNextField(&line), "PAF");
+    alignment.targetEnd = parseInt(getNextField(&line), "PAF");
+    for (int64_t i = 0; i < 3; i++) { //Matches, alignment block length and mapping quality
+        if (getNextField(&line) == NULL) {
+            st_errAbort("PAF record has too few fields\n");
+        }
+    }
+    checkInterval(alignment.query, stPinchThread_getStart(alignment.query) + alignment.queryStart,
+            alignment.queryEnd - alignment.queryStart);
+    checkInterval(alignment.target, stPinchThread_getStart(alignment.target) + alignment.targetStart,
+            alignment.targetEnd - alignment.targetStart);
+    alignment.queryOffset = 0;
+    alignment.targetOffset = 0;
+    alignment.runLength = 0;
+
+    char *cigar = NULL, *cs = NULL, *tag;
+    while ((tag = getNextField(&line)) != NULL) {
+        if (strncmp(tag, "cg:Z:", 5) == 0) {
+            cigar = tag + 5;
+        } else if (strncmp(tag, "cs:Z:", 5) == 0) {
+            cs = tag + 5;
+        }
+    }
+    if (cigar != NULL) {
+        parseCigar(&alignment, chunk, cigar);
+    } else if (cs != NULL) {
+        parseDifferenceString(&alignment, chunk, cs);
+    } else {
+        st_errAbort("PAF record has neither a cg nor a cs tag\n");
+    }
+    stPinchPAFAlignment_finish(&alignment, chunk);
+}
+
+void stPinchThreadSet_pinchPAF(stPinchThreadSet *threadSet, FILE *fileHandle, int64_t chunkSize, bool parallel,
+        stPinchAlignmentCounters *counters) {
+    stPinchAlignmentCounters localCounters;
+    memset(&localCounters, 0, sizeof(stPinchAlignmentCounters));
+    stPinchChunk chunk;
+    stPinchChunk_init(&chunk, threadSet, chunkSize, parallel, counters != NULL ? counters : &localCounters);
+    char *line;
+    while ((line = stFile_getLineFromFile(fileHandle)) != NULL) {
+        chunk.counters->bytesRead += strlen(line) + 1;
+        if (line[0] != '\0') {
+            pinchPAFLine(threadSet, &chunk, line);
+            chunk.counters->alignmentNumber++;
+        }
+        free(line);
+    }
+    stPinchChunk_destruct(&chunk);
+}
+
+//Binary pinches
+
+static const char stPinchBinaryMagic[8] = { 's', 't', 'P', 'i', 'n', 'c', 'h', '1' };
+
+#define ST_PINCH_BINARY_RECORD_SIZE 41
+
+static void writeInt(uint8_t *bytes, int64_t i) {
+    uint64_t j = i;
+    for (int64_t k = 0; k < 8; k++) {
+        bytes[k] = (uint8_t) (j >> (8 * k));
+    }
+}
+
+static int64_t readInt(const uint8_t *bytes) {
+    uint64_t j = 0;
+    for (int64_t k = 0; k < 8; k++) {
+        j |= ((uint64_t) bytes[k]) << (8 * k);
+    }
+    return (int64_t) j;
+}
+
+void stPinch_writeBinaryHeader(FILE *fileHandle) {
+    if (fwrite(stPinchBinaryMagic, 1, sizeof(stPinchBinaryMagic), fileHandle) != sizeof(stPinchBinaryMagic)) {
+        st_errAbort("Failed to write binary pinch header\n");
+    }
+}
+
+void stPinch_writeBinary(FILE *fileHandle, stPinch *pinches, int64_t pinchNumber) {
+    uint8_t record[ST_PINCH_BINARY_RECORD_SIZE];
+    for (int64_t i = 0; i < pinchNumber; i++) {
+        stPinch *pinch = &pinches[i];
+        writeInt(record, pinch->name1);
+        writeInt(record + 8, pinch->name2);
+        writeInt(record + 16, pinch->start1);
+        writeInt(record + 24, pinch->start2);
+        writeInt(record + 32, pinch->length);
+        record[40] = pinch->strand;
+        if (fwrite(record, 1, ST_PINCH_BINARY_RECORD_SIZE, fileHandle) != ST_PINCH_BINARY_RECORD_SIZE) {
+            st_errAbort("Failed to write binary pinch record\n");
+        }
+    }
+}
+
+void stPinchThreadSet_pinchBinary(stPinchThreadSet *threadSet, FILE *fileHandle, int64_t chunkSize, bool parallel,
+        stPinchAlignmentCounters *counters) {
+    stPinchAlignmentCounters localCounters;
+    memset(&localCounters, 0, sizeof(stPinchAlignmentCounters));
+    stPinchChunk chunk;
+    stPinchChunk_init(&chunk, threadSet, chunkSize, parallel, counters != NULL ? counters : &localCounters);
+    char magic[sizeof(stPinchBinaryMagic)];
+    if (fread(magic, 1, sizeof(magic), fileHandle) != sizeof(magic) || memcmp(magic, stPinchBinaryMagic, sizeof(magic)) != 0) {
+        st_errAbort("File is not in the binary pinch format\n");
+    }
+    chunk.counters->bytesRead += sizeof(magic);
+    uint8_t *records = st_malloc(ST_PINCH_BINARY_RECORD_SIZE * chunkSize);
+    size_t bytesRead;
+    while ((bytesRead = fread(records, 1, ST_PINCH_BINARY_RECORD_SIZE * chunkSize, fileHandle)) > 0) {
+        if (bytesRead % ST_PINCH_BINARY_RECORD_SIZE != 0) {
+            st_errAbort("Binary pinch file is truncated\n");
+        }
+        chunk.counters->bytesRead += bytesRead;
+        for (uint8_t *record = records; record < records + bytesRead; record += ST_PINCH_BINARY_RECORD_SIZE) {
+            stPinch pinch = stPinch_constructStatic(readInt(record), readInt(record + 8), readInt(record + 16),
+                    readInt(record + 24), readInt(record + 32), record[40]);
+            checkInterval(getThread(threadSet, pinch.name1), pinch.start1, pinch.length);
+            checkInterval(getThread(threadSet, pinch.name2), pinch.start2, pinch.length);
+            chunk.counters->alignmentNumber++;
+            stPinchChunk_add(&chunk, pinch);
+        }
+    }
+    free(records);
+    stPinchChunk_destruct(&chunk);
+}
+
+//Thread lengths
+
+/*
+ * Returns a copy of the first length entries of the array in a new array of the given capacity, freeing the old array.
+ */
+static int64_t *growArray(int64_t *array, int64_t length, int64_t capacity) {
+    int64_t *newArray = st_malloc(sizeof(int64_t) * capacity);
+    memcpy(newArray, array, sizeof(int64_t) * length);
+    free(array);
+    return newArray;
+}
+
+static int compareNames(const void *name1, const void *name2) {
+    int64_t i = *(const int64_t *) name1, j = *(const int64_t *) name2;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+void stPinchThreadSet_addThreadsFromFile(stPinchThreadSet *threadSet, FILE *fileHandle) {
+    int64_t threadNumber = 0, maxThreadNumber = 64;
+    int64_t *names = st_malloc(sizeof(int64_t) * maxThreadNumber);
+    int64_t *lengths = st_malloc(sizeof(int64_t) * maxThreadNumber);
+    char *line;
+    while ((line = stFile_getLineFromFile(fileHandle)) != NULL) {
+        if (line[0] != '\0') {
+            if (threadNumber == maxThreadNumber) {
+                maxThreadNumber *= 2;
+                names = growArray(names, threadNumber, maxThreadNumber);
+                lengths = growArray(lengths, threadNumber, maxThreadNumber);
+            }
+            char *fields = line;
+            names[threadNumber] = parseInt(getNextField(&fields), "sequence length");
+            lengths[threadNumber] = parseInt(getNextField(&fields), "sequence length"); //Any further fields, as of a .fai file, are ignored
+            if (lengths[threadNumber] < 0) {
+                st_errAbort("Negative length in sequence length record: %" PRIi64 "\n", lengths[threadNumber]);
+            }
+            if (stPinchThreadSet_getThread(threadSet, names[threadNumber]) != NULL) {
+                st_errAbort("There is already a thread named %" PRIi64 " in the thread set\n", names[threadNumber]);
+            }
+            threadNumber++;
+        }
+        free(line);
+    }
+    int64_t *starts = st_calloc(threadNumber + 1, sizeof(int64_t)); //Also used to find names repeated in the file
+    memcpy(starts, names, sizeof(int64_t) * threadNumber);
+    qsort(starts, threadNumber, sizeof(int64_t), compareNames);
+    for (int64_t i = 1; i < threadNumber; i++) {
+        if (starts[i - 1] == starts[i]) {
+            st_errAbort("The sequence %" PRIi64 " has more than one length record\n", starts[i]);
+        }
+    }
+    memset(starts, 0, sizeof(int64_t) * threadNumber);
+    stPinchThreadSet_addThreads(threadSet, names, starts, lengths, threadNumber);
+    free(starts);
+    free(lengths);
+    free(names);
+}
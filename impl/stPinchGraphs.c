@@ -7,628 +7,2771 @@
 
 //Basic data structures
 
+#define _POSIX_C_SOURCE 200809L //For posix_memalign
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "sonLib.h"
 #include "stPinchGraphs.h"
 
+/*
+ * Fixed size object pool. Objects are carved out of slabs of geometrically increasing size,
+ * freed objects are recycled via a free list and all the slabs are released together when the pool is destroyed.
+ */
+typedef struct _stPinchPool {
+    size_t objectSize;
+    bool indexed; //If true the objects are segments, carved out of chunks so that they can be linked by index
+    int64_t slabCapacity; //Number of objects in the next slab to be allocated
+    void *slabs; //Linked list of slabs, the first word of each slab points to the previously allocated slab
+    char *nextObject;
+    char *slabEnd;
+    void *freeObjects; //Linked list of freed objects, the first word of each points to the next free object
+} stPinchPool;
+
+typedef enum _stPinchUndoType {
+    ST_PINCH_UNDO_WRITE, //A field of a segment or block was overwritten, the entry holds its old value
+    ST_PINCH_UNDO_WRITE_LINK, //As ST_PINCH_UNDO_WRITE, for a link between segments
+    ST_PINCH_UNDO_ALLOCATE, //An object was allocated from the pool
+    ST_PINCH_UNDO_FREE, //An object was freed, its return to the pool is deferred until commit
+    ST_PINCH_UNDO_INDEX_INSERT, //A segment was inserted into the index, the entry holds its start
+    ST_PINCH_UNDO_INDEX_REMOVE, //A segment was removed from the index
+    ST_PINCH_UNDO_INDEX_UPDATE_START, //The start of a segment was changed in the index, the entry holds the new start
+    ST_PINCH_UNDO_ADD_THREAD
+} stPinchUndoType;
+
+/*
+ * An entry of the undo log, recording how to reverse one change to the graph.
+ */
+typedef struct _stPinchUndoEntry {
+    stPinchUndoType type;
+    void *address; //The field, object, segment index or thread changed
+    union {
+        int64_t value;
+        void *pointer; //The pool of an allocated or freed object, or the segment removed from an index
+    } argument;
+} stPinchUndoEntry;
+
+typedef struct _stPinchUndoLog {
+    stPinchUndoEntry *entries;
+    int64_t length;
+    int64_t maxLength;
+} stPinchUndoLog;
+
+/*
+ * The positions at which the segments or their blocks changed, so that state derived from the graph can be repaired
+ * around them rather than recomputed over the whole graph.
+ */
+typedef struct _stPinchDirtyPositions {
+    int64_t *positions; //Pairs of thread name and coordinate
+    int64_t length;
+    int64_t maxLength;
+    bool all; //If true everything must be recomputed, and positions are not recorded
+} stPinchDirtyPositions;
+
+/*
+ * The blocks allocated and freed by a parallel worker. Each entry has a key, which orders it among the entries of all
+ * the workers as it would have been ordered had the work been done serially, see stPinchPools_replayBlockLog.
+ */
+typedef struct _stPinchBlockLogEntry {
+    int64_t key;
+    int64_t order; //The position of the entry in its log, as the entries of a key are all made by one worker
+    stPinchBlock *block;
+    bool allocated; //Else the block was freed
+} stPinchBlockLogEntry;
+
+typedef struct _stPinchBlockLog {
+    stPinchBlockLogEntry *entries;
+    int64_t length;
+    int64_t maxLength;
+    int64_t key; //The key of the entries made next
+} stPinchBlockLog;
+
+/*
+ * The pools segments and blocks are allocated from, and the logs of changes to them. Each thread points at the pools
+ * it allocates from, which are those of its thread set, except during parallel pinching, when they are those of the
+ * worker pinching the thread.
+ */
+typedef struct _stPinchPools {
+    stPinchPool segmentPool;
+    stPinchPool blockPool;
+    stPinchUndoLog *undoLog; //The log of the open transaction, if any
+    stPinchDirtyPositions *adjacencyComponentChanges; //Present if adjacency components are being tracked
+    stPinchDirtyPositions *trivialBoundaryChanges; //Present if the changes that may make trivial boundaries are tracked
+    int64_t *blockIdBound; //Shared by all the pools of a thread set
+    int64_t *threadComponentNumber; //Shared by all the pools of a thread set
+    int64_t *blockSegmentsVersion; //Shared by all the pools of a thread set, the last version given to a block's segments
+    pthread_mutex_t *queryMutex; //Shared by all the pools of a thread set, held by queries bringing derived state up to date
+    bool indexBlockSegments; //True if block segment indices are kept
+    stPinchBlock *firstBlock; //The registry of the blocks allocated from the pools, in order of allocation
+    stPinchBlock *lastBlock;
+    int64_t blockNumber;
+    stPinchBlockLog *blockLog; //Present in the pools of parallel workers, which neither register nor free blocks
+} stPinchPools;
+
 struct _stPinchThreadSet {
     stList *threads;
-    stHash *threadsHash;
+    stPinchPool threadPool; //The threads, allocated in slabs as the segments and blocks are
+    stPinchThread **threadTable; //Open addressing table of the threads by name, NULL while their names are dense
+    int64_t threadTableSize; //A power of two, at least twice the number of threads
+    int64_t firstThreadName; //While the names are dense the ith thread is named firstThreadName + i
+    stPinchPools pools;
+    int64_t blockIdBound; //One more than the largest block id given out
+    int64_t threadComponentNumber; //The number of thread components, or -1 if they must be rebuilt
+    int64_t blockSegmentsVersion;
+    int64_t nextAdjacencyComponentLabel; //Labels are never reused, so those of components untouched by a repair stay unique
+    pthread_mutex_t queryMutex;
 };
 
+/*
+ * Ordered index of the segments in a thread, keyed by segment start. It is a two level blocked sorted array:
+ * a sorted array of leaves, each leaf holding a sorted run of segment starts and, in parallel, the segments.
+ * Searches are two binary searches over contiguous arrays of starts, rather than a walk down a tree of pointers.
+ */
+typedef struct _stPinchSegmentIndexLeaf {
+    int64_t size;
+    int64_t capacity;
+    int64_t starts[]; //Followed by the array of segments, see stPinchSegmentIndexLeaf_getSegments
+} stPinchSegmentIndexLeaf;
+
+typedef struct _stPinchSegmentIndex {
+    int64_t leafNumber;
+    int64_t maxLeafNumber;
+    int64_t *leafStarts; //The first start in each leaf
+    stPinchSegmentIndexLeaf **leaves;
+    int64_t inlineLeafStart; //While there is at most one leaf the arrays are these, saving two allocations per thread
+    stPinchSegmentIndexLeaf *inlineLeaf;
+} stPinchSegmentIndex;
+
 struct _stPinchThread {
     int64_t name;
     int64_t start;
     int64_t length;
-    stSortedSet *segments;
+    stPinchSegmentIndex segments;
+    int64_t index; //Position of the thread in the thread set
+    stPinchPools *pools;
+    stPinchThread *componentParent; //The union-find of the threads joined by blocks, see stPinchThread_getComponent
+    int64_t componentSize;
 };
 
+/*
+ * The index of a segment, see stPinchSegment_fromLink, or 0 for no segment. Linking the segments by index rather than
+ * by pointer shrinks a segment from 56 to 40 bytes.
+ */
+typedef uint32_t stPinchSegmentLink;
+
 struct _stPinchSegment {
     stPinchThread *thread;
     int64_t start;
-    stPinchSegment *pSegment;
-    stPinchSegment *nSegment;
-    stPinchBlock *block;
-    bool blockOrientation;
-    stPinchSegment *nBlockSegment;
+    uintptr_t block; //The block, with the orientation of the segment in the block in the low bit
+    stPinchSegmentLink pSegment;
+    stPinchSegmentLink nSegment;
+    stPinchSegmentLink pBlockSegment;
+    stPinchSegmentLink nBlockSegment;
 };
 
 struct _stPinchBlock {
     uint64_t degree;
     stPinchSegment *headSegment;
     stPinchSegment *tailSegment;
+    int64_t adjacencyComponentLabels[2]; //Labels of the adjacency components of the two ends, when tracked
+    int64_t id; //Kept by the block's memory when it is freed, so that it is reused by the next block allocated there
+    stPinchBlock *pBlock; //The previous and next blocks in the registry
+    stPinchBlock *nBlock;
+    int64_t registryOrder; //Increases along the registry, so that the positions of two blocks in it can be compared
+    int64_t segmentsVersion; //Changed when the block's segments change, while block segment indices are kept
+    stPinchSegment **sortedSegments; //The block segment index, built on demand, see stPinchBlock_getSortedSegments
+    int64_t sortedSegmentsVersion; //The segmentsVersion the index was built at
 };
 
-//Blocks
-
-static void connectBlockToSegment(stPinchSegment *segment, bool orientation, stPinchBlock *block, stPinchSegment *nBlockSegment) {
-    segment->block = block;
-    segment->blockOrientation = orientation;
-    segment->nBlockSegment = nBlockSegment;
+/*
+ * As realloc, but aborts if the memory cannot be allocated, as st_malloc does.
+ */
+static void *reallocOrAbort(void *memory, size_t size) {
+    void *newMemory = realloc(memory, size);
+    if (newMemory == NULL && size > 0) {
+        st_errAbort("Failed to reallocate %zu bytes\n", size);
+    }
+    return newMemory;
 }
 
-stPinchBlock *stPinchBlock_construct3(stPinchSegment *segment, bool orientation) {
-    stPinchBlock *block = st_malloc(sizeof(stPinchBlock));
-    block->headSegment = segment;
-    block->tailSegment = segment;
-    connectBlockToSegment(segment, orientation, block, NULL);
-    block->degree = 1;
-    return block;
+//Pools
+
+#define ST_PINCH_POOL_MIN_SLAB_CAPACITY 64
+#define ST_PINCH_POOL_MAX_SLAB_CAPACITY 65536
+
+/*
+ * The slabs of indexed pools are small chunks of a fixed size, aligned to it. The first object of a chunk is its
+ * header, holding the link to the previous slab and the chunk's number, and the index of a segment is the number of
+ * its chunk followed by its position in the chunk, so position 0 is never a segment and index 0 can mean none. The
+ * chunks of all the indexed pools of the process are numbered in one directory, so a segment can be found from its
+ * index alone. The directory's pages are allocated as chunk numbers reach them, and the numbers of released chunks
+ * are reused, so the directory limits the segments the process holds at once, to about 3.4 billion, rather than the
+ * segments ever made.
+ */
+#define ST_PINCH_CHUNK_BYTES 4096
+#define ST_PINCH_CHUNK_POSITION_BITS 7
+#define ST_PINCH_CHUNK_PAGE_BITS 12
+#define ST_PINCH_CHUNK_PAGE_NUMBER (1 << (32 - ST_PINCH_CHUNK_POSITION_BITS - ST_PINCH_CHUNK_PAGE_BITS))
+
+static uintptr_t *stPinchChunks[ST_PINCH_CHUNK_PAGE_NUMBER]; //Pages of the chunk of each number, or if the number is free, the next free number shifted up one with the low bit set
+static int64_t stPinchChunks_free = -1; //The first free number, or -1 if none
+static int64_t stPinchChunks_bound = 0; //One more than the largest number ever given out
+static pthread_mutex_t stPinchChunks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uintptr_t *stPinchChunks_get(int64_t number) {
+    return &stPinchChunks[number >> ST_PINCH_CHUNK_PAGE_BITS][number & ((1 << ST_PINCH_CHUNK_PAGE_BITS) - 1)];
 }
 
-stPinchBlock *stPinchBlock_construct2(stPinchSegment *segment) {
-    return stPinchBlock_construct3(segment, 1);
+static uintptr_t stPinchChunks_add(char *chunk) {
+    pthread_mutex_lock(&stPinchChunks_mutex);
+    int64_t number = stPinchChunks_free;
+    if (number >= 0) {
+        uintptr_t nextFree = *stPinchChunks_get(number);
+        stPinchChunks_free = nextFree == 1 ? -1 : (int64_t) (nextFree >> 1);
+    } else {
+        number = stPinchChunks_bound++;
+        if (number >> ST_PINCH_CHUNK_PAGE_BITS >= ST_PINCH_CHUNK_PAGE_NUMBER) {
+            st_errAbort("Too many pinch graph segments: a process can hold at most %" PRIi64 " at once\n",
+                    ((int64_t) ST_PINCH_CHUNK_PAGE_NUMBER << ST_PINCH_CHUNK_PAGE_BITS)
+                            * (ST_PINCH_CHUNK_BYTES / (int64_t) sizeof(stPinchSegment) - 1));
+        }
+        if (stPinchChunks[number >> ST_PINCH_CHUNK_PAGE_BITS] == NULL) {
+            stPinchChunks[number >> ST_PINCH_CHUNK_PAGE_BITS] = st_malloc(sizeof(uintptr_t) << ST_PINCH_CHUNK_PAGE_BITS);
+        }
+    }
+    *stPinchChunks_get(number) = (uintptr_t) chunk;
+    pthread_mutex_unlock(&stPinchChunks_mutex);
+    return number;
 }
 
-stPinchBlock *stPinchBlock_construct(stPinchSegment *segment1, bool orientation1, stPinchSegment *segment2, bool orientation2) {
-    assert(stPinchSegment_getLength(segment1) == stPinchSegment_getLength(segment2));
-    stPinchBlock *block = st_malloc(sizeof(stPinchBlock));
-    block->headSegment = segment1;
-    block->tailSegment = segment2;
-    connectBlockToSegment(segment1, orientation1, block, segment2);
-    connectBlockToSegment(segment2, orientation2, block, NULL);
-    block->degree = 2;
-    return block;
+static void stPinchChunks_remove(uintptr_t number) {
+    pthread_mutex_lock(&stPinchChunks_mutex);
+    *stPinchChunks_get(number) = stPinchChunks_free >= 0 ? (uintptr_t) stPinchChunks_free << 1 | 1 : 1;
+    stPinchChunks_free = number;
+    pthread_mutex_unlock(&stPinchChunks_mutex);
 }
 
-void stPinchBlock_destruct(stPinchBlock *block) {
-    stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(block);
-    stPinchSegment *segment = stPinchBlockIt_getNext(&blockIt);
-    while (segment != NULL) {
-        stPinchSegment *nSegment = stPinchBlockIt_getNext(&blockIt);
-        connectBlockToSegment(segment, 0, NULL, NULL);
-        segment = nSegment;
+static inline stPinchSegment *stPinchSegment_fromLink(stPinchSegmentLink link) {
+    if (link == 0) {
+        return NULL;
     }
-    free(block);
+    return (stPinchSegment *) (*stPinchChunks_get(link >> ST_PINCH_CHUNK_POSITION_BITS)
+            + (link & ((1 << ST_PINCH_CHUNK_POSITION_BITS) - 1)) * sizeof(stPinchSegment));
 }
 
-stPinchBlock *stPinchBlock_pinch(stPinchBlock *block1, stPinchBlock *block2, bool orientation) {
-    if (block1 == block2) {
-        return block1; //Already joined
-    }
-    if (stPinchBlock_getDegree(block1) < stPinchBlock_getDegree(block2)) { //Avoid merging large blocks into small blocks
-        return stPinchBlock_pinch(block2, block1, orientation);
-    }
-    assert(stPinchBlock_getLength(block1) == stPinchBlock_getLength(block2));
-    stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(block2);
-    stPinchSegment *segment = stPinchBlockIt_getNext(&blockIt);
-    while (segment != NULL) {
-        stPinchSegment *nSegment = stPinchBlockIt_getNext(&blockIt);
-        bool segmentOrientation = stPinchSegment_getBlockOrientation(segment);
-        stPinchBlock_pinch2(block1, segment, (segmentOrientation && orientation) || (!segmentOrientation && !orientation));
-        segment = nSegment;
+static inline stPinchSegmentLink stPinchSegment_toLink(stPinchSegment *segment) {
+    if (segment == NULL) {
+        return 0;
     }
-    free(block2);
-    return block1;
+    uintptr_t chunk = (uintptr_t) segment & ~(uintptr_t) (ST_PINCH_CHUNK_BYTES - 1);
+    return (stPinchSegmentLink) (((uintptr_t *) chunk)[1] << ST_PINCH_CHUNK_POSITION_BITS
+            | ((uintptr_t) segment - chunk) / sizeof(stPinchSegment));
 }
 
-stPinchBlock *stPinchBlock_pinch2(stPinchBlock *block, stPinchSegment *segment, bool orientation) {
-    assert(block->tailSegment != NULL);
-    assert(block->tailSegment->nBlockSegment == NULL);
-    block->tailSegment->nBlockSegment = segment;
-    connectBlockToSegment(segment, orientation, block, NULL);
-    block->tailSegment = segment;
-    block->degree++;
-    return block;
+static void stPinchPool_init(stPinchPool *pool, size_t objectSize, bool indexed) {
+    //Round up so that every object is pointer aligned and can hold the free list link
+    pool->objectSize = (objectSize + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+    pool->indexed = indexed;
+    assert(!indexed || (pool->objectSize == sizeof(stPinchSegment)
+            && ST_PINCH_CHUNK_BYTES / sizeof(stPinchSegment) <= 1 << ST_PINCH_CHUNK_POSITION_BITS));
+    pool->slabCapacity = ST_PINCH_POOL_MIN_SLAB_CAPACITY;
+    pool->slabs = NULL;
+    pool->nextObject = NULL;
+    pool->slabEnd = NULL;
+    pool->freeObjects = NULL;
 }
 
-stPinchBlockIt stPinchBlock_getSegmentIterator(stPinchBlock *block) {
-    stPinchBlockIt blockIt;
-    blockIt.segment = block->headSegment;
-    return blockIt;
+static void stPinchPool_destruct(stPinchPool *pool) {
+    while (pool->slabs != NULL) {
+        void *pSlab = *(void **) pool->slabs;
+        if (pool->indexed) {
+            stPinchChunks_remove(((uintptr_t *) pool->slabs)[1]);
+        }
+        free(pool->slabs);
+        pool->slabs = pSlab;
+    }
+    stPinchPool_init(pool, pool->objectSize, pool->indexed);
 }
 
-stPinchSegment *stPinchBlockIt_getNext(stPinchBlockIt *blockIt) {
-    stPinchSegment *segment = blockIt->segment;
-    if (segment != NULL) {
-        blockIt->segment = segment->nBlockSegment;
+static void stPinchPool_addSlab(stPinchPool *pool, int64_t capacity) {
+    char *slab;
+    if (pool->indexed) {
+        void *chunk = NULL;
+        if (posix_memalign(&chunk, ST_PINCH_CHUNK_BYTES, ST_PINCH_CHUNK_BYTES) != 0) {
+            st_errAbort("Failed to allocate %d bytes\n", ST_PINCH_CHUNK_BYTES);
+        }
+        slab = chunk;
+        ((uintptr_t *) slab)[1] = stPinchChunks_add(slab);
+        pool->nextObject = slab + pool->objectSize;
+        pool->slabEnd = slab + ST_PINCH_CHUNK_BYTES / pool->objectSize * pool->objectSize;
+    } else {
+        slab = st_malloc(sizeof(void *) + capacity * pool->objectSize);
+        pool->nextObject = slab + sizeof(void *);
+        pool->slabEnd = pool->nextObject + capacity * pool->objectSize;
     }
-    return segment;
+    *(void **) slab = pool->slabs;
+    pool->slabs = slab;
 }
 
-uint64_t stPinchBlock_getDegree(stPinchBlock *block) {
-    return block->degree;
+/*
+ * Makes room for the given number of objects at the end of the current slab, so that, unless freed objects are
+ * reused, they are allocated contiguously, or in an indexed pool, as many of them as fit in a chunk. Any unused space
+ * at the end of the previous slab is abandoned.
+ */
+static void stPinchPool_reserve(stPinchPool *pool, int64_t objectNumber) {
+    if (pool->indexed && objectNumber > ST_PINCH_CHUNK_BYTES / (int64_t) pool->objectSize - 1) {
+        objectNumber = ST_PINCH_CHUNK_BYTES / (int64_t) pool->objectSize - 1;
+    }
+    if ((pool->slabEnd - pool->nextObject) / (int64_t) pool->objectSize < objectNumber) {
+        stPinchPool_addSlab(pool, objectNumber);
+    }
 }
 
-stPinchSegment *stPinchBlock_getFirst(stPinchBlock *block) {
-    assert(block->headSegment != NULL);
-    return block->headSegment;
+static void *stPinchPool_calloc(stPinchPool *pool) {
+    void *object;
+    if (pool->freeObjects != NULL) {
+        object = pool->freeObjects;
+        pool->freeObjects = *(void **) object;
+    } else {
+        if (pool->nextObject == pool->slabEnd) {
+            stPinchPool_addSlab(pool, pool->slabCapacity);
+            if (pool->slabCapacity < ST_PINCH_POOL_MAX_SLAB_CAPACITY) {
+                pool->slabCapacity *= 2;
+            }
+        }
+        object = pool->nextObject;
+        pool->nextObject += pool->objectSize;
+    }
+    memset(object, 0, pool->objectSize);
+    return object;
 }
 
-int64_t stPinchBlock_getLength(stPinchBlock *block) {
-    return stPinchSegment_getLength(stPinchBlock_getFirst(block));
+static void stPinchPool_free(stPinchPool *pool, void *object) {
+    *(void **) object = pool->freeObjects;
+    pool->freeObjects = object;
 }
 
-void stPinchBlock_trim(stPinchBlock *block, int64_t blockEndTrim) {
-    if (blockEndTrim <= 0) {
-        return;
-    }
-    if (stPinchBlock_getLength(block) > 2 * blockEndTrim) {
-        stPinchSegment *segment = stPinchBlock_getFirst(block);
-        stPinchSegment_split(segment, stPinchSegment_getStart(segment) + blockEndTrim - 1);
-        block = stPinchSegment_getBlock(segment);
-        assert(block != NULL);
-        stPinchBlock_destruct(block);
-        segment = stPinchSegment_get3Prime(segment);
-        assert(segment != NULL);
-        assert(stPinchSegment_getBlock(segment) != NULL);
-        stPinchSegment_split(segment, stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment) - 1 - blockEndTrim);
-        segment = stPinchSegment_get3Prime(segment);
-        assert(segment != NULL);
-        block = stPinchSegment_getBlock(segment);
-        assert(block != NULL);
-        stPinchBlock_destruct(block);
-    } else { //Two short, so we just destroy it
-        stPinchBlock_destruct(block);
-    }
+static void stPinchPools_init(stPinchPools *pools, int64_t *blockIdBound, int64_t *threadComponentNumber, int64_t *blockSegmentsVersion,
+        pthread_mutex_t *queryMutex) {
+    stPinchPool_init(&pools->segmentPool, sizeof(stPinchSegment), 1);
+    stPinchPool_init(&pools->blockPool, sizeof(stPinchBlock), 0);
+    pools->undoLog = NULL;
+    pools->adjacencyComponentChanges = NULL;
+    pools->trivialBoundaryChanges = NULL;
+    pools->blockIdBound = blockIdBound;
+    pools->threadComponentNumber = threadComponentNumber;
+    pools->blockSegmentsVersion = blockSegmentsVersion;
+    pools->queryMutex = queryMutex;
+    pools->indexBlockSegments = 0;
+    pools->firstBlock = NULL;
+    pools->lastBlock = NULL;
+    pools->blockNumber = 0;
+    pools->blockLog = NULL;
 }
 
-//Segments
-
-int64_t stPinchSegment_getStart(stPinchSegment *segment) {
-    return segment->start;
+static void stPinchPools_destruct(stPinchPools *pools) {
+    stPinchPool_destruct(&pools->segmentPool);
+    stPinchPool_destruct(&pools->blockPool);
 }
 
-int64_t stPinchSegment_getLength(stPinchSegment *segment) {
-    assert(segment->nSegment != NULL);
-    return segment->nSegment->start - segment->start;
+//Undo log
+
+static stPinchUndoEntry *stPinchUndoLog_add(stPinchUndoLog *undoLog, stPinchUndoType type, void *address) {
+    if (undoLog->length == undoLog->maxLength) {
+        undoLog->maxLength = undoLog->maxLength * 2 + 64;
+        undoLog->entries = reallocOrAbort(undoLog->entries, sizeof(stPinchUndoEntry) * undoLog->maxLength);
+    }
+    stPinchUndoEntry *entry = &undoLog->entries[undoLog->length++];
+    entry->type = type;
+    entry->address = address;
+    return entry;
 }
 
-stPinchBlock *stPinchSegment_getBlock(stPinchSegment *segment) {
-    return segment->block;
+static void stPinchUndoLog_destruct(stPinchUndoLog *undoLog) {
+    free(undoLog->entries);
+    free(undoLog);
 }
 
-bool stPinchSegment_getBlockOrientation(stPinchSegment *segment) {
-    return segment->blockOrientation;
+static inline void stPinchPools_logValue(stPinchPools *pools, stPinchUndoType type, void *address, int64_t value) {
+    if (pools->undoLog != NULL) {
+        stPinchUndoLog_add(pools->undoLog, type, address)->argument.value = value;
+    }
 }
 
-stPinchSegment *stPinchSegment_get5Prime(stPinchSegment *segment) {
-    return segment->pSegment;
+static inline void stPinchPools_logPointer(stPinchPools *pools, stPinchUndoType type, void *address, void *pointer) {
+    if (pools->undoLog != NULL) {
+        stPinchUndoLog_add(pools->undoLog, type, address)->argument.pointer = pointer;
+    }
 }
 
-stPinchSegment *stPinchSegment_get3Prime(stPinchSegment *segment) {
-    return segment->nSegment->nSegment != NULL ? segment->nSegment : NULL;
+//Dirty positions
+
+static stPinchDirtyPositions *stPinchDirtyPositions_construct(bool all) {
+    stPinchDirtyPositions *dirtyPositions = st_malloc(sizeof(stPinchDirtyPositions));
+    dirtyPositions->positions = NULL;
+    dirtyPositions->length = 0;
+    dirtyPositions->maxLength = 0;
+    dirtyPositions->all = all;
+    return dirtyPositions;
 }
 
-int64_t stPinchSegment_getName(stPinchSegment *segment) {
-    return stPinchThread_getName(segment->thread);
+static void stPinchDirtyPositions_destruct(stPinchDirtyPositions *dirtyPositions) {
+    if (dirtyPositions != NULL) {
+        free(dirtyPositions->positions);
+        free(dirtyPositions);
+    }
 }
 
-stPinchThread *stPinchSegment_getThread(stPinchSegment *segment) {
-    return segment->thread;
+static void stPinchDirtyPositions_add(stPinchDirtyPositions *dirtyPositions, int64_t name, int64_t coordinate) {
+    if (dirtyPositions->all) {
+        return;
+    }
+    if (dirtyPositions->length == dirtyPositions->maxLength) {
+        dirtyPositions->maxLength = dirtyPositions->maxLength * 2 + 64;
+        dirtyPositions->positions = reallocOrAbort(dirtyPositions->positions, sizeof(int64_t) * 2 * dirtyPositions->maxLength);
+    }
+    dirtyPositions->positions[2 * dirtyPositions->length] = name;
+    dirtyPositions->positions[2 * dirtyPositions->length + 1] = coordinate;
+    dirtyPositions->length++;
 }
 
-//Private segment functions
+static void stPinchDirtyPositions_clear(stPinchDirtyPositions *dirtyPositions, bool all) {
+    dirtyPositions->length = 0;
+    dirtyPositions->all = all;
+}
 
-void stPinchSegment_destruct(stPinchSegment *segment) {
-    if (stPinchSegment_getBlock(segment) != NULL) {
-        stPinchBlock_destruct(stPinchSegment_getBlock(segment));
+/*
+ * Records that the segment of the thread at the coordinate, or its block, changed.
+ */
+static inline void stPinchPools_recordChange(stPinchPools *pools, stPinchThread *thread, int64_t coordinate) {
+    if (pools->adjacencyComponentChanges != NULL) {
+        stPinchDirtyPositions_add(pools->adjacencyComponentChanges, thread->name, coordinate);
+    }
+    if (pools->trivialBoundaryChanges != NULL) {
+        stPinchDirtyPositions_add(pools->trivialBoundaryChanges, thread->name, coordinate);
     }
-    free(segment);
 }
 
-int stPinchSegment_compareBySequencePosition(const stPinchSegment *segment1, const stPinchSegment *segment2) {
-    return segment1->start < segment2->start ? -1 : (segment1->start > segment2->start ? 1 : 0);
+/*
+ * Assigns to a field of a segment or block, logging its old value if a transaction is open. Fields of objects
+ * allocated since the transaction began need not be assigned this way, as the objects are freed on rollback.
+ */
+#define stPinchPools_set(pools, field, newValue) do { \
+        if ((pools)->undoLog != NULL) { \
+            assert(sizeof(field) == sizeof(int64_t) || sizeof(field) == sizeof(stPinchSegmentLink)); \
+            stPinchUndoEntry *_entry = stPinchUndoLog_add((pools)->undoLog, \
+                    sizeof(field) == sizeof(int64_t) ? ST_PINCH_UNDO_WRITE : ST_PINCH_UNDO_WRITE_LINK, &(field)); \
+            memcpy(&_entry->argument.value, &(field), sizeof(field)); \
+        } \
+        (field) = (newValue); \
+    } while (0)
+
+static void *stPinchPools_calloc(stPinchPools *pools, stPinchPool *pool) {
+    void *object = stPinchPool_calloc(pool);
+    stPinchPools_logPointer(pools, ST_PINCH_UNDO_ALLOCATE, object, pool);
+    return object;
 }
 
-int stPinchSegment_compare(const stPinchSegment *segment1, const stPinchSegment *segment2) {
-    if(segment1->thread->name != segment2->thread->name) {
-        return segment1->thread->name > segment2->thread->name ? 1 : -1;
+static void stPinchBlockLog_add(stPinchBlockLog *blockLog, stPinchBlock *block, bool allocated) {
+    if (blockLog->length == blockLog->maxLength) {
+        blockLog->maxLength = blockLog->maxLength * 2 + 64;
+        blockLog->entries = reallocOrAbort(blockLog->entries, sizeof(stPinchBlockLogEntry) * blockLog->maxLength);
     }
-    return stPinchSegment_compareBySequencePosition(segment1, segment2);
+    stPinchBlockLogEntry *entry = &blockLog->entries[blockLog->length];
+    entry->key = blockLog->key;
+    entry->order = blockLog->length++;
+    entry->block = block;
+    entry->allocated = allocated;
 }
 
-static stPinchSegment *stPinchSegment_construct(int64_t start, stPinchThread *thread) {
-    stPinchSegment *segment = st_calloc(1, sizeof(stPinchSegment));
-    segment->start = start;
-    segment->thread = thread;
-    return segment;
+static void stPinchPools_registerBlock(stPinchPools *pools, stPinchBlock *block) {
+    block->registryOrder = pools->lastBlock != NULL ? pools->lastBlock->registryOrder + 1 : 0;
+    block->pBlock = pools->lastBlock;
+    if (pools->lastBlock != NULL) {
+        stPinchPools_set(pools, pools->lastBlock->nBlock, block);
+    } else {
+        stPinchPools_set(pools, pools->firstBlock, block);
+    }
+    stPinchPools_set(pools, pools->lastBlock, block);
+    stPinchPools_set(pools, pools->blockNumber, pools->blockNumber + 1);
 }
 
-static stPinchSegment *stPinchSegment_splitP(stPinchSegment *segment, int64_t leftBlockLength) {
-    stPinchSegment *nSegment = segment->nSegment;
-    assert(nSegment != NULL);
-    stPinchSegment *rightSegment = stPinchSegment_construct(stPinchSegment_getStart(segment) + leftBlockLength, segment->thread);
-    segment->nSegment = rightSegment;
-    rightSegment->pSegment = segment;
-    rightSegment->nSegment = nSegment;
-    nSegment->pSegment = rightSegment;
-    stSortedSet_insert(segment->thread->segments, rightSegment);
-    return rightSegment;
+/*
+ * Allocates a block, giving it the id of the freed block whose memory it reuses, else a new id. Ids are therefore
+ * unique among the blocks of a thread set and bounded by the largest number of blocks it has held at once. Freed
+ * blocks whose ids have been taken by others, see stPinchPools_replayBlockLog, follow those with ids in the free list.
+ */
+static stPinchBlock *stPinchPools_callocBlock(stPinchPools *pools) {
+    if (pools->blockLog != NULL) { //A worker's block is given its id and registered when the log is replayed
+        stPinchBlock *block = stPinchPools_calloc(pools, &pools->blockPool);
+        stPinchBlockLog_add(pools->blockLog, block, 1);
+        return block;
+    }
+    stPinchBlock *freeBlock = pools->blockPool.freeObjects;
+    int64_t id = freeBlock != NULL && freeBlock->id >= 0 ? freeBlock->id : (*pools->blockIdBound)++;
+    stPinchBlock *block = stPinchPools_calloc(pools, &pools->blockPool);
+    block->id = id;
+    stPinchPools_registerBlock(pools, block);
+    return block;
 }
 
-void stPinchSegment_split(stPinchSegment *segment, int64_t leftSideOfSplitPoint) {
-    if (leftSideOfSplitPoint == stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment) - 1) { //There is already a break
-        return;
+static void stPinchPools_unregisterBlock(stPinchPools *pools, stPinchBlock *block) {
+    if (block->pBlock != NULL) {
+        stPinchPools_set(pools, block->pBlock->nBlock, block->nBlock);
+    } else {
+        stPinchPools_set(pools, pools->firstBlock, block->nBlock);
     }
-    int64_t leftSegmentLength = leftSideOfSplitPoint - stPinchSegment_getStart(segment) + 1;
-    assert(leftSegmentLength > 0);
-    stPinchBlock *block;
-    if ((block = stPinchSegment_getBlock(segment)) != NULL) {
-        int64_t rightSegmentLength = stPinchBlock_getLength(block) - leftSegmentLength;
-        assert(rightSegmentLength > 0);
-        if (!stPinchSegment_getBlockOrientation(segment)) {
-            int64_t i = rightSegmentLength;
-            rightSegmentLength = leftSegmentLength;
-            leftSegmentLength = i;
-        }
-        stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(block);
-        segment = stPinchBlockIt_getNext(&blockIt);
-        assert(segment != NULL);
-        stPinchSegment *pSegment = NULL;
-        stPinchBlock *block2;
-        if (stPinchSegment_getBlockOrientation(segment)) {
-            stPinchSegment *segment2 = stPinchSegment_splitP(segment, leftSegmentLength);
-            block2 = stPinchBlock_construct2(segment2);
-            pSegment = segment;
-        } else {
-            stPinchSegment *segment2 = stPinchSegment_splitP(segment, rightSegmentLength);
-            block->headSegment = segment2;
-            connectBlockToSegment(segment2, 0, block, segment->nBlockSegment);
-            if (segment2->nBlockSegment == NULL) {
-                block->tailSegment = segment2;
-            }
-            block2 = stPinchBlock_construct2(segment);
-            segment->blockOrientation = 0; //This gets sets positive by default.
-            pSegment = segment2;
-        }
-        while ((segment = stPinchBlockIt_getNext(&blockIt)) != NULL) {
-            if (stPinchSegment_getBlockOrientation(segment)) {
-                stPinchSegment *segment2 = stPinchSegment_splitP(segment, leftSegmentLength);
-                stPinchBlock_pinch2(block2, segment2, 1);
-                pSegment = segment;
-            } else {
-                stPinchSegment *segment2 = stPinchSegment_splitP(segment, rightSegmentLength);
-                pSegment->nBlockSegment = segment2;
-                connectBlockToSegment(segment2, 0, block, segment->nBlockSegment);
-                if (segment2->nBlockSegment == NULL) {
-                    block->tailSegment = segment2;
-                }
-                stPinchBlock_pinch2(block2, segment, 0);
-                pSegment = segment2;
-            }
-        }
+    if (block->nBlock != NULL) {
+        stPinchPools_set(pools, block->nBlock->pBlock, block->pBlock);
     } else {
-        stPinchSegment_splitP(segment, leftSegmentLength);
+        stPinchPools_set(pools, pools->lastBlock, block->pBlock);
     }
+    stPinchPools_set(pools, pools->blockNumber, pools->blockNumber - 1);
 }
 
-void stPinchSegment_putSegmentFirstInBlock(stPinchSegment *segment) {
-    if(segment->block != NULL) {
-        if(segment->block->headSegment != segment) {
-            stPinchSegment *pBlockSegment = segment->block->headSegment;
-            while(pBlockSegment->nBlockSegment != segment) {
-                pBlockSegment = pBlockSegment->nBlockSegment;
-                assert(pBlockSegment != NULL);
-            }
-            pBlockSegment->nBlockSegment = segment->nBlockSegment;
-            if(segment->nBlockSegment == NULL) {
-                assert(segment->block->tailSegment == segment);
-                segment->block->tailSegment = pBlockSegment;
-            }
-            segment->nBlockSegment = segment->block->headSegment;
-            segment->block->headSegment = segment;
-        }
+static void stPinchPools_free(stPinchPools *pools, stPinchPool *pool, void *object) {
+    if (pools->undoLog != NULL) { //Keep the object intact, so that rollback can restore it
+        stPinchPools_logPointer(pools, ST_PINCH_UNDO_FREE, object, pool);
+    } else {
+        stPinchPool_free(pool, object);
     }
 }
 
-//Thread
+/*
+ * Frees a block, removing it from the registry. A parallel worker's block is removed from the registry and freed
+ * when the log is replayed.
+ */
+static void stPinchPools_freeBlock(stPinchPools *pools, stPinchBlock *block) {
+    free(block->sortedSegments); //Not logged, rollback leaves the block to rebuild it
+    block->sortedSegments = NULL;
+    if (pools->blockLog != NULL) {
+        block->degree = 0; //Marks the block as freed until then
+        stPinchBlockLog_add(pools->blockLog, block, 0);
+    } else {
+        stPinchPools_unregisterBlock(pools, block);
+        stPinchPools_free(pools, &pools->blockPool, block);
+    }
+}
 
-int64_t stPinchThread_getName(stPinchThread *thread) {
-    return thread->name;
+//Segment index
+
+#define ST_PINCH_SEGMENT_INDEX_MIN_LEAF_CAPACITY 4
+#define ST_PINCH_SEGMENT_INDEX_MAX_LEAF_CAPACITY 128
+
+static stPinchSegmentIndexLeaf *stPinchSegmentIndexLeaf_construct(int64_t capacity) {
+    stPinchSegmentIndexLeaf *leaf = st_malloc(sizeof(stPinchSegmentIndexLeaf) + capacity * (sizeof(int64_t) + sizeof(stPinchSegment *)));
+    leaf->size = 0;
+    leaf->capacity = capacity;
+    return leaf;
 }
 
-int64_t stPinchThread_getStart(stPinchThread *thread) {
-    return thread->start;
+static inline stPinchSegment **stPinchSegmentIndexLeaf_getSegments(stPinchSegmentIndexLeaf *leaf) {
+    return (stPinchSegment **) (leaf->starts + leaf->capacity);
 }
 
-int64_t stPinchThread_getLength(stPinchThread *thread) {
-    return thread->length;
+static stPinchSegmentIndexLeaf *stPinchSegmentIndexLeaf_resize(stPinchSegmentIndexLeaf *leaf, int64_t capacity) {
+    assert(capacity >= leaf->size);
+    stPinchSegmentIndexLeaf *leaf2 = stPinchSegmentIndexLeaf_construct(capacity);
+    leaf2->size = leaf->size;
+    memcpy(leaf2->starts, leaf->starts, leaf->size * sizeof(int64_t));
+    memcpy(stPinchSegmentIndexLeaf_getSegments(leaf2), stPinchSegmentIndexLeaf_getSegments(leaf), leaf->size * sizeof(stPinchSegment *));
+    free(leaf);
+    return leaf2;
 }
 
-stPinchSegment *stPinchThread_getSegment(stPinchThread *thread, int64_t coordinate) {
-    static stPinchSegment segment;
-    segment.start = coordinate;
-    stPinchSegment *segment2 = stSortedSet_searchLessThanOrEqual(thread->segments, &segment);
-    if (segment2 == NULL) {
-        return NULL;
+/*
+ * Returns the index of the last element of the sorted array that is less than or equal to key, or -1 if there is none.
+ * The range is halved without branching on the comparison, which compiles to conditional moves, so the search does
+ * not stall on mispredicted branches.
+ */
+static inline int64_t searchLessThanOrEqual(const int64_t *starts, int64_t size, int64_t key) {
+    if (size == 0) {
+        return -1;
     }
-    assert(stPinchSegment_getStart(segment2) <= coordinate);
-    if (stPinchSegment_getStart(segment2) + stPinchSegment_getLength(segment2) <= coordinate) {
-        return NULL;
+    const int64_t *base = starts;
+    while (size > 1) {
+        int64_t half = size / 2;
+        base = base[half] <= key ? base + half : base;
+        size -= half;
     }
-    return segment2;
+    return (base - starts) - (*base > key);
+}
+
+static void stPinchSegmentIndex_init(stPinchSegmentIndex *index) {
+    index->leafNumber = 0;
+    index->maxLeafNumber = 0;
+    index->leafStarts = NULL;
+    index->leaves = NULL;
+}
+
+static void stPinchSegmentIndex_destruct(stPinchSegmentIndex *index) {
+    for (int64_t i = 0; i < index->leafNumber; i++) {
+        free(index->leaves[i]);
+    }
+    if (index->leaves != &index->inlineLeaf) {
+        free(index->leafStarts);
+        free(index->leaves);
+    }
+    stPinchSegmentIndex_init(index);
+}
+
+static void stPinchSegmentIndex_insertLeaf(stPinchSegmentIndex *index, int64_t i, stPinchSegmentIndexLeaf *leaf) {
+    if (index->leafNumber == index->maxLeafNumber) {
+        if (index->maxLeafNumber == 0) {
+            index->maxLeafNumber = 1;
+            index->leafStarts = &index->inlineLeafStart;
+            index->leaves = &index->inlineLeaf;
+        } else if (index->leaves == &index->inlineLeaf) {
+            index->maxLeafNumber = 2;
+            index->leafStarts = st_malloc(index->maxLeafNumber * sizeof(int64_t));
+            index->leaves = st_malloc(index->maxLeafNumber * sizeof(stPinchSegmentIndexLeaf *));
+            index->leafStarts[0] = index->inlineLeafStart;
+            index->leaves[0] = index->inlineLeaf;
+        } else {
+            index->maxLeafNumber *= 2;
+            index->leafStarts = reallocOrAbort(index->leafStarts, index->maxLeafNumber * sizeof(int64_t));
+            index->leaves = reallocOrAbort(index->leaves, index->maxLeafNumber * sizeof(stPinchSegmentIndexLeaf *));
+        }
+    }
+    memmove(index->leafStarts + i + 1, index->leafStarts + i, (index->leafNumber - i) * sizeof(int64_t));
+    memmove(index->leaves + i + 1, index->leaves + i, (index->leafNumber - i) * sizeof(stPinchSegmentIndexLeaf *));
+    index->leafStarts[i] = leaf->starts[0];
+    index->leaves[i] = leaf;
+    index->leafNumber++;
+}
+
+static void stPinchSegmentIndex_removeLeaf(stPinchSegmentIndex *index, int64_t i) {
+    free(index->leaves[i]);
+    memmove(index->leafStarts + i, index->leafStarts + i + 1, (index->leafNumber - i - 1) * sizeof(int64_t));
+    memmove(index->leaves + i, index->leaves + i + 1, (index->leafNumber - i - 1) * sizeof(stPinchSegmentIndexLeaf *));
+    index->leafNumber--;
+}
+
+/*
+ * Returns the index of the leaf that contains, or would contain, the given start.
+ */
+static inline int64_t stPinchSegmentIndex_getLeafIndex(stPinchSegmentIndex *index, int64_t start) {
+    int64_t i = searchLessThanOrEqual(index->leafStarts, index->leafNumber, start);
+    return i < 0 ? 0 : i;
+}
+
+static stPinchSegment *stPinchSegmentIndex_searchLessThanOrEqual(stPinchSegmentIndex *index, int64_t start) {
+    int64_t i = searchLessThanOrEqual(index->leafStarts, index->leafNumber, start);
+    if (i < 0) {
+        return NULL;
+    }
+    stPinchSegmentIndexLeaf *leaf = index->leaves[i];
+    int64_t j = searchLessThanOrEqual(leaf->starts, leaf->size, start);
+    assert(j >= 0);
+    return stPinchSegmentIndexLeaf_getSegments(leaf)[j];
+}
+
+static int64_t stPinchSegmentIndex_getSize(stPinchSegmentIndex *index) {
+    int64_t size = 0;
+    for (int64_t i = 0; i < index->leafNumber; i++) {
+        size += index->leaves[i]->size;
+    }
+    return size;
+}
+
+static stPinchSegment *stPinchSegmentIndex_getFirst(stPinchSegmentIndex *index) {
+    return index->leafNumber == 0 ? NULL : stPinchSegmentIndexLeaf_getSegments(index->leaves[0])[0];
+}
+
+static stPinchSegment *stPinchSegmentIndex_getLast(stPinchSegmentIndex *index) {
+    if (index->leafNumber == 0) {
+        return NULL;
+    }
+    stPinchSegmentIndexLeaf *leaf = index->leaves[index->leafNumber - 1];
+    return stPinchSegmentIndexLeaf_getSegments(leaf)[leaf->size - 1];
+}
+
+static void stPinchSegmentIndex_insert(stPinchSegmentIndex *index, stPinchSegment *segment) {
+    int64_t start = segment->start;
+    if (index->leafNumber == 0) {
+        stPinchSegmentIndexLeaf *leaf = stPinchSegmentIndexLeaf_construct(ST_PINCH_SEGMENT_INDEX_MIN_LEAF_CAPACITY);
+        leaf->starts[0] = start;
+        stPinchSegmentIndexLeaf_getSegments(leaf)[0] = segment;
+        leaf->size = 1;
+        stPinchSegmentIndex_insertLeaf(index, 0, leaf);
+        return;
+    }
+    int64_t i = stPinchSegmentIndex_getLeafIndex(index, start);
+    stPinchSegmentIndexLeaf *leaf = index->leaves[i];
+    if (leaf->size == leaf->capacity) {
+        if (leaf->capacity < ST_PINCH_SEGMENT_INDEX_MAX_LEAF_CAPACITY) {
+            leaf = index->leaves[i] = stPinchSegmentIndexLeaf_resize(leaf, 2 * leaf->capacity);
+        } else { //Split the leaf in two
+            stPinchSegmentIndexLeaf *rightLeaf = stPinchSegmentIndexLeaf_construct(ST_PINCH_SEGMENT_INDEX_MAX_LEAF_CAPACITY);
+            int64_t leftSize = leaf->size / 2;
+            rightLeaf->size = leaf->size - leftSize;
+            memcpy(rightLeaf->starts, leaf->starts + leftSize, rightLeaf->size * sizeof(int64_t));
+            memcpy(stPinchSegmentIndexLeaf_getSegments(rightLeaf), stPinchSegmentIndexLeaf_getSegments(leaf) + leftSize,
+                    rightLeaf->size * sizeof(stPinchSegment *));
+            leaf->size = leftSize;
+            stPinchSegmentIndex_insertLeaf(index, i + 1, rightLeaf);
+            if (start >= rightLeaf->starts[0]) {
+                leaf = rightLeaf;
+                i++;
+            }
+        }
+    }
+    int64_t j = searchLessThanOrEqual(leaf->starts, leaf->size, start) + 1;
+    assert(j == 0 || leaf->starts[j - 1] < start);
+    stPinchSegment **segments = stPinchSegmentIndexLeaf_getSegments(leaf);
+    memmove(leaf->starts + j + 1, leaf->starts + j, (leaf->size - j) * sizeof(int64_t));
+    memmove(segments + j + 1, segments + j, (leaf->size - j) * sizeof(stPinchSegment *));
+    leaf->starts[j] = start;
+    segments[j] = segment;
+    leaf->size++;
+    index->leafStarts[i] = leaf->starts[0];
+}
+
+/*
+ * Returns the position of the segment with the given start in the leaf, or -1 if not present.
+ */
+static int64_t stPinchSegmentIndexLeaf_getPosition(stPinchSegmentIndexLeaf *leaf, int64_t start) {
+    int64_t j = searchLessThanOrEqual(leaf->starts, leaf->size, start);
+    return j >= 0 && leaf->starts[j] == start ? j : -1;
+}
+
+static void stPinchSegmentIndex_remove(stPinchSegmentIndex *index, int64_t start) {
+    int64_t i = stPinchSegmentIndex_getLeafIndex(index, start);
+    stPinchSegmentIndexLeaf *leaf = index->leaves[i];
+    int64_t j = stPinchSegmentIndexLeaf_getPosition(leaf, start);
+    if (j < 0) {
+        st_errAbort("No segment starting at %" PRIi64 " to remove from the thread's index\n", start);
+        return;
+    }
+    stPinchSegment **segments = stPinchSegmentIndexLeaf_getSegments(leaf);
+    memmove(leaf->starts + j, leaf->starts + j + 1, (leaf->size - j - 1) * sizeof(int64_t));
+    memmove(segments + j, segments + j + 1, (leaf->size - j - 1) * sizeof(stPinchSegment *));
+    if (--leaf->size == 0) {
+        stPinchSegmentIndex_removeLeaf(index, i);
+        return;
+    }
+    index->leafStarts[i] = leaf->starts[0];
+    //Merge with the following leaf if together they would be no more than half full, bounding the number of leaves
+    if (i + 1 < index->leafNumber && leaf->size + index->leaves[i + 1]->size <= ST_PINCH_SEGMENT_INDEX_MAX_LEAF_CAPACITY / 2) {
+        stPinchSegmentIndexLeaf *rightLeaf = index->leaves[i + 1];
+        if (leaf->capacity < leaf->size + rightLeaf->size) {
+            leaf = index->leaves[i] = stPinchSegmentIndexLeaf_resize(leaf, ST_PINCH_SEGMENT_INDEX_MAX_LEAF_CAPACITY);
+        }
+        memcpy(leaf->starts + leaf->size, rightLeaf->starts, rightLeaf->size * sizeof(int64_t));
+        memcpy(stPinchSegmentIndexLeaf_getSegments(leaf) + leaf->size, stPinchSegmentIndexLeaf_getSegments(rightLeaf),
+                rightLeaf->size * sizeof(stPinchSegment *));
+        leaf->size += rightLeaf->size;
+        stPinchSegmentIndex_removeLeaf(index, i + 1);
+    }
+}
+
+/*
+ * Changes the key of a segment in the index from start to newStart. The change must not alter the order of the segments.
+ */
+static void stPinchSegmentIndex_updateStart(stPinchSegmentIndex *index, int64_t start, int64_t newStart) {
+    int64_t i = stPinchSegmentIndex_getLeafIndex(index, start);
+    stPinchSegmentIndexLeaf *leaf = index->leaves[i];
+    int64_t j = stPinchSegmentIndexLeaf_getPosition(leaf, start);
+    if (j < 0) {
+        st_errAbort("No segment starting at %" PRIi64 " to update in the thread's index\n", start);
+        return;
+    }
+    assert(j == 0 || leaf->starts[j - 1] < newStart);
+    assert(j + 1 == leaf->size || leaf->starts[j + 1] > newStart);
+    leaf->starts[j] = newStart;
+    if (j == 0) {
+        index->leafStarts[i] = newStart;
+    }
+}
+
+//Thread components
+
+/*
+ * The threads joined by blocks are kept in a union-find, with threads joined as blocks gain segments. Removing a
+ * segment from a block may split a component, which the union-find cannot do, so instead it marks the components
+ * as unknown and they are rebuilt from the blocks when next queried. Queries may run concurrently, so the rebuild
+ * is done holding the thread set's query mutex, and the number of components is published only once it is complete.
+ */
+
+/*
+ * Adds delta to the number of thread components, or marks it unknown. Parallel workers share the number, so it is
+ * updated atomically.
+ */
+static void stPinchPools_updateThreadComponentNumber(stPinchPools *pools, int64_t delta, bool unknown) {
+    int64_t number = __atomic_load_n(pools->threadComponentNumber, __ATOMIC_RELAXED);
+    do {
+        if (number == -1) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(pools->threadComponentNumber, &number, unknown ? -1 : number + delta, 1,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    stPinchPools_logValue(pools, ST_PINCH_UNDO_WRITE, pools->threadComponentNumber, number);
+}
+
+static stPinchThread *stPinchThread_getComponent(stPinchThread *thread) {
+    while (thread->componentParent != thread) {
+        stPinchPools_set(thread->pools, thread->componentParent, thread->componentParent->componentParent); //Path halving
+        thread = thread->componentParent;
+    }
+    return thread;
+}
+
+/*
+ * Joins the components of the two threads, returning true if they were different.
+ */
+static bool stPinchThread_unionComponents(stPinchPools *pools, stPinchThread *thread1, stPinchThread *thread2) {
+    thread1 = stPinchThread_getComponent(thread1);
+    thread2 = stPinchThread_getComponent(thread2);
+    if (thread1 == thread2) {
+        return 0;
+    }
+    if (thread1->componentSize < thread2->componentSize) {
+        stPinchThread *thread = thread1;
+        thread1 = thread2;
+        thread2 = thread;
+    }
+    stPinchPools_set(pools, thread2->componentParent, thread1);
+    stPinchPools_set(pools, thread1->componentSize, thread1->componentSize + thread2->componentSize);
+    return 1;
+}
+
+static void stPinchThread_joinComponents(stPinchThread *thread1, stPinchThread *thread2) {
+    stPinchPools *pools = thread1->pools;
+    if (__atomic_load_n(pools->threadComponentNumber, __ATOMIC_RELAXED) == -1) {
+        return; //Rebuilt when next queried
+    }
+    if (stPinchThread_unionComponents(pools, thread1, thread2)) {
+        stPinchPools_updateThreadComponentNumber(pools, -1, 0);
+    }
+}
+
+/*
+ * Rebuilds the thread components from the blocks if they are unknown.
+ */
+static void stPinchThreadSet_updateThreadComponents(stPinchThreadSet *threadSet) {
+    if (__atomic_load_n(&threadSet->threadComponentNumber, __ATOMIC_ACQUIRE) != -1) {
+        return;
+    }
+    pthread_mutex_lock(&threadSet->queryMutex);
+    if (threadSet->threadComponentNumber == -1) {
+        stPinchPools *pools = &threadSet->pools;
+        stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+        stPinchThread *thread;
+        while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+            stPinchPools_set(pools, thread->componentParent, thread);
+            stPinchPools_set(pools, thread->componentSize, 1);
+        }
+        int64_t componentNumber = stPinchThreadSet_getSize(threadSet);
+        stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+        stPinchBlock *block;
+        while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+            stPinchBlockIt segmentIt = stPinchBlock_getSegmentIterator(block);
+            stPinchThread *firstThread = stPinchSegment_getThread(stPinchBlockIt_getNext(&segmentIt));
+            stPinchSegment *segment;
+            while ((segment = stPinchBlockIt_getNext(&segmentIt)) != NULL) {
+                componentNumber -= stPinchThread_unionComponents(pools, firstThread, stPinchSegment_getThread(segment));
+            }
+        }
+        stPinchPools_logValue(pools, ST_PINCH_UNDO_WRITE, &threadSet->threadComponentNumber, -1);
+        __atomic_store_n(&threadSet->threadComponentNumber, componentNumber, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&threadSet->queryMutex);
+}
+
+/*
+ * As stPinchThread_getComponent, but without shortening paths, so that it does not modify the graph.
+ */
+static stPinchThread *stPinchThread_getComponentP(stPinchThread *thread) {
+    while (thread->componentParent != thread) {
+        thread = thread->componentParent;
+    }
+    return thread;
+}
+
+//Blocks
+
+static stPinchPools *stPinchBlock_getPools(stPinchBlock *block) {
+    return block->headSegment->thread->pools;
+}
+
+/*
+ * Gives the block's segments a new version, invalidating its segment index. Versions are never reused, even after a
+ * rollback restores an older one, so an index built at any other version is known to be stale.
+ */
+static inline void stPinchBlock_segmentsChanged(stPinchPools *pools, stPinchBlock *block) {
+    if (pools->indexBlockSegments) {
+        stPinchPools_set(pools, block->segmentsVersion, __atomic_add_fetch(pools->blockSegmentsVersion, 1, __ATOMIC_RELAXED));
+    }
+}
+
+static void stPinchThreadSet_releaseBlockSegmentIndices(stPinchThreadSet *threadSet) {
+    for (stPinchBlock *block = threadSet->pools.firstBlock; block != NULL; block = block->nBlock) {
+        free(block->sortedSegments);
+        block->sortedSegments = NULL;
+    }
+}
+
+static inline void stPinchSegment_setBlock(stPinchSegment *segment, stPinchBlock *block, bool orientation) {
+    assert(((uintptr_t) block & 1) == 0);
+    stPinchPools *pools = segment->thread->pools;
+    stPinchPools_set(pools, segment->block, (uintptr_t) block | orientation);
+    stPinchPools_recordChange(pools, segment->thread, segment->start);
+}
+
+static void connectBlockToSegment(stPinchSegment *segment, bool orientation, stPinchBlock *block, stPinchSegment *pBlockSegment,
+        stPinchSegment *nBlockSegment) {
+    stPinchPools *pools = segment->thread->pools;
+    stPinchSegment_setBlock(segment, block, orientation);
+    stPinchPools_set(pools, segment->pBlockSegment, stPinchSegment_toLink(pBlockSegment));
+    stPinchPools_set(pools, segment->nBlockSegment, stPinchSegment_toLink(nBlockSegment));
+}
+
+stPinchBlock *stPinchBlock_construct3(stPinchSegment *segment, bool orientation) {
+    stPinchBlock *block = stPinchPools_callocBlock(segment->thread->pools);
+    block->headSegment = segment;
+    block->tailSegment = segment;
+    connectBlockToSegment(segment, orientation, block, NULL, NULL);
+    block->degree = 1;
+    return block;
+}
+
+stPinchBlock *stPinchBlock_construct2(stPinchSegment *segment) {
+    return stPinchBlock_construct3(segment, 1);
+}
+
+stPinchBlock *stPinchBlock_construct(stPinchSegment *segment1, bool orientation1, stPinchSegment *segment2, bool orientation2) {
+    assert(stPinchSegment_getLength(segment1) == stPinchSegment_getLength(segment2));
+    stPinchBlock *block = stPinchPools_callocBlock(segment1->thread->pools);
+    block->headSegment = segment1;
+    block->tailSegment = segment2;
+    connectBlockToSegment(segment1, orientation1, block, NULL, segment2);
+    connectBlockToSegment(segment2, orientation2, block, segment1, NULL);
+    block->degree = 2;
+    stPinchThread_joinComponents(segment1->thread, segment2->thread);
+    return block;
+}
+
+/*
+ * Destructs the block, marking the thread components unknown if the block joined different threads, unless
+ * the caller knows the threads remain joined by another block.
+ */
+static void stPinchBlock_destructP(stPinchBlock *block, bool threadsStayJoined) {
+    stPinchPools *pools = stPinchBlock_getPools(block);
+    stPinchThread *thread = block->headSegment->thread;
+    bool threadsJoined = 0;
+    stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(block);
+    stPinchSegment *segment = stPinchBlockIt_getNext(&blockIt);
+    while (segment != NULL) {
+        stPinchSegment *nSegment = stPinchBlockIt_getNext(&blockIt);
+        threadsJoined = threadsJoined || segment->thread != thread;
+        connectBlockToSegment(segment, 0, NULL, NULL, NULL);
+        segment = nSegment;
+    }
+    if (threadsJoined && !threadsStayJoined) {
+        stPinchPools_updateThreadComponentNumber(pools, 0, 1);
+    }
+    stPinchPools_freeBlock(pools, block);
+}
+
+void stPinchBlock_destruct(stPinchBlock *block) {
+    stPinchBlock_destructP(block, 0);
+}
+
+stPinchBlock *stPinchBlock_pinch(stPinchBlock *block1, stPinchBlock *block2, bool orientation) {
+    if (block1 == block2) {
+        return block1; //Already joined
+    }
+    if (stPinchBlock_getDegree(block1) < stPinchBlock_getDegree(block2)) { //Avoid merging large blocks into small blocks
+        return stPinchBlock_pinch(block2, block1, orientation);
+    }
+    assert(stPinchBlock_getLength(block1) == stPinchBlock_getLength(block2));
+    stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(block2);
+    stPinchSegment *segment = stPinchBlockIt_getNext(&blockIt);
+    while (segment != NULL) {
+        stPinchSegment *nSegment = stPinchBlockIt_getNext(&blockIt);
+        bool segmentOrientation = stPinchSegment_getBlockOrientation(segment);
+        stPinchBlock_pinch2(block1, segment, (segmentOrientation && orientation) || (!segmentOrientation && !orientation));
+        segment = nSegment;
+    }
+    stPinchPools *pools = stPinchBlock_getPools(block1);
+    stPinchPools_freeBlock(pools, block2);
+    return block1;
+}
+
+stPinchBlock *stPinchBlock_pinch2(stPinchBlock *block, stPinchSegment *segment, bool orientation) {
+    assert(block->tailSegment != NULL);
+    assert(block->tailSegment->nBlockSegment == 0);
+    stPinchPools *pools = segment->thread->pools;
+    stPinchBlock_segmentsChanged(pools, block);
+    stPinchThread_joinComponents(block->tailSegment->thread, segment->thread);
+    stPinchPools_set(pools, block->tailSegment->nBlockSegment, stPinchSegment_toLink(segment));
+    connectBlockToSegment(segment, orientation, block, block->tailSegment, NULL);
+    stPinchPools_set(pools, block->tailSegment, segment);
+    stPinchPools_set(pools, block->degree, block->degree + 1);
+    return block;
+}
+
+stPinchBlockIt stPinchBlock_getSegmentIterator(stPinchBlock *block) {
+    stPinchBlockIt blockIt;
+    blockIt.segment = block->headSegment;
+    return blockIt;
+}
+
+stPinchSegment *stPinchBlockIt_getNext(stPinchBlockIt *blockIt) {
+    stPinchSegment *segment = blockIt->segment;
+    if (segment != NULL) {
+        blockIt->segment = stPinchSegment_fromLink(segment->nBlockSegment);
+    }
+    return segment;
+}
+
+uint64_t stPinchBlock_getDegree(stPinchBlock *block) {
+    return block->degree;
+}
+
+int64_t stPinchBlock_getId(stPinchBlock *block) {
+    return block->id;
+}
+
+stPinchSegment *stPinchBlock_getFirst(stPinchBlock *block) {
+    assert(block->headSegment != NULL);
+    return block->headSegment;
+}
+
+int64_t stPinchBlock_getLength(stPinchBlock *block) {
+    return stPinchSegment_getLength(stPinchBlock_getFirst(block));
+}
+
+void stPinchBlock_trim(stPinchBlock *block, int64_t blockEndTrim) {
+    if (blockEndTrim <= 0) {
+        return;
+    }
+    if (stPinchBlock_getLength(block) > 2 * blockEndTrim) {
+        stPinchSegment *segment = stPinchBlock_getFirst(block);
+        stPinchSegment_split(segment, stPinchSegment_getStart(segment) + blockEndTrim - 1);
+        block = stPinchSegment_getBlock(segment);
+        assert(block != NULL);
+        stPinchBlock_destructP(block, 1); //The middle of the block still joins its threads
+        segment = stPinchSegment_get3Prime(segment);
+        assert(segment != NULL);
+        assert(stPinchSegment_getBlock(segment) != NULL);
+        stPinchSegment_split(segment, stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment) - 1 - blockEndTrim);
+        segment = stPinchSegment_get3Prime(segment);
+        assert(segment != NULL);
+        block = stPinchSegment_getBlock(segment);
+        assert(block != NULL);
+        stPinchBlock_destructP(block, 1);
+    } else { //Two short, so we just destroy it
+        stPinchBlock_destruct(block);
+    }
+}
+
+//Segments
+
+int64_t stPinchSegment_getStart(stPinchSegment *segment) {
+    return segment->start;
+}
+
+int64_t stPinchSegment_getLength(stPinchSegment *segment) {
+    assert(segment->nSegment != 0);
+    return stPinchSegment_fromLink(segment->nSegment)->start - segment->start;
+}
+
+stPinchBlock *stPinchSegment_getBlock(stPinchSegment *segment) {
+    return (stPinchBlock *) (segment->block & ~(uintptr_t) 1);
+}
+
+bool stPinchSegment_getBlockOrientation(stPinchSegment *segment) {
+    return segment->block & 1;
+}
+
+stPinchSegment *stPinchSegment_get5Prime(stPinchSegment *segment) {
+    return stPinchSegment_fromLink(segment->pSegment);
+}
+
+stPinchSegment *stPinchSegment_get3Prime(stPinchSegment *segment) {
+    stPinchSegment *nSegment = stPinchSegment_fromLink(segment->nSegment);
+    return nSegment->nSegment != 0 ? nSegment : NULL;
+}
+
+int64_t stPinchSegment_getName(stPinchSegment *segment) {
+    return stPinchThread_getName(segment->thread);
+}
+
+stPinchThread *stPinchSegment_getThread(stPinchSegment *segment) {
+    return segment->thread;
+}
+
+//Private segment functions
+
+void stPinchSegment_destruct(stPinchSegment *segment) {
+    if (stPinchSegment_getBlock(segment) != NULL) {
+        stPinchBlock_destruct(stPinchSegment_getBlock(segment));
+    }
+    stPinchPools_free(segment->thread->pools, &segment->thread->pools->segmentPool, segment);
+}
+
+int stPinchSegment_compareBySequencePosition(const stPinchSegment *segment1, const stPinchSegment *segment2) {
+    return segment1->start < segment2->start ? -1 : (segment1->start > segment2->start ? 1 : 0);
+}
+
+int stPinchSegment_compare(const stPinchSegment *segment1, const stPinchSegment *segment2) {
+    if(segment1->thread->name != segment2->thread->name) {
+        return segment1->thread->name > segment2->thread->name ? 1 : -1;
+    }
+    return stPinchSegment_compareBySequencePosition(segment1, segment2);
+}
+
+static stPinchSegment *stPinchSegment_construct(int64_t start, stPinchThread *thread) {
+    stPinchSegment *segment = stPinchPools_calloc(thread->pools, &thread->pools->segmentPool);
+    segment->start = start;
+    segment->thread = thread;
+    return segment;
+}
+
+static stPinchSegment *stPinchSegment_splitP(stPinchSegment *segment, int64_t leftBlockLength) {
+    stPinchSegment *nSegment = stPinchSegment_fromLink(segment->nSegment);
+    assert(nSegment != NULL);
+    stPinchSegment *rightSegment = stPinchSegment_construct(stPinchSegment_getStart(segment) + leftBlockLength, segment->thread);
+    stPinchPools *pools = segment->thread->pools;
+    stPinchSegmentLink rightLink = stPinchSegment_toLink(rightSegment);
+    stPinchPools_set(pools, segment->nSegment, rightLink);
+    rightSegment->pSegment = stPinchSegment_toLink(segment);
+    rightSegment->nSegment = stPinchSegment_toLink(nSegment);
+    stPinchPools_set(pools, nSegment->pSegment, rightLink);
+    stPinchSegmentIndex_insert(&segment->thread->segments, rightSegment);
+    stPinchPools_logValue(pools, ST_PINCH_UNDO_INDEX_INSERT, &segment->thread->segments, rightSegment->start);
+    stPinchPools_recordChange(pools, segment->thread, rightSegment->start);
+    return rightSegment;
+}
+
+void stPinchSegment_split(stPinchSegment *segment, int64_t leftSideOfSplitPoint) {
+    if (leftSideOfSplitPoint == stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment) - 1) { //There is already a break
+        return;
+    }
+    int64_t leftSegmentLength = leftSideOfSplitPoint - stPinchSegment_getStart(segment) + 1;
+    assert(leftSegmentLength > 0);
+    stPinchBlock *block;
+    if ((block = stPinchSegment_getBlock(segment)) != NULL) {
+        int64_t rightSegmentLength = stPinchBlock_getLength(block) - leftSegmentLength;
+        assert(rightSegmentLength > 0);
+        if (!stPinchSegment_getBlockOrientation(segment)) {
+            int64_t i = rightSegmentLength;
+            rightSegmentLength = leftSegmentLength;
+            leftSegmentLength = i;
+        }
+        stPinchPools *pools = segment->thread->pools;
+        stPinchBlock_segmentsChanged(pools, block); //Its reverse oriented segments are replaced by their right parts
+        stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(block);
+        segment = stPinchBlockIt_getNext(&blockIt);
+        assert(segment != NULL);
+        stPinchSegment *pSegment = NULL;
+        stPinchBlock *block2;
+        if (stPinchSegment_getBlockOrientation(segment)) {
+            stPinchSegment *segment2 = stPinchSegment_splitP(segment, leftSegmentLength);
+            block2 = stPinchBlock_construct2(segment2);
+            pSegment = segment;
+        } else {
+            stPinchSegment *segment2 = stPinchSegment_splitP(segment, rightSegmentLength);
+            stPinchPools_set(pools, block->headSegment, segment2);
+            connectBlockToSegment(segment2, 0, block, NULL, stPinchSegment_fromLink(segment->nBlockSegment));
+            if (segment2->nBlockSegment == 0) {
+                stPinchPools_set(pools, block->tailSegment, segment2);
+            }
+            block2 = stPinchBlock_construct2(segment);
+            stPinchSegment_setBlock(segment, block2, 0); //This gets sets positive by default.
+            pSegment = segment2;
+        }
+        while ((segment = stPinchBlockIt_getNext(&blockIt)) != NULL) {
+            if (stPinchSegment_getBlockOrientation(segment)) {
+                stPinchSegment *segment2 = stPinchSegment_splitP(segment, leftSegmentLength);
+                stPinchBlock_pinch2(block2, segment2, 1);
+                stPinchPools_set(pools, segment->pBlockSegment, stPinchSegment_toLink(pSegment)); //The previous segment may have been replaced
+                pSegment = segment;
+            } else {
+                stPinchSegment *segment2 = stPinchSegment_splitP(segment, rightSegmentLength);
+                stPinchPools_set(pools, pSegment->nBlockSegment, stPinchSegment_toLink(segment2));
+                connectBlockToSegment(segment2, 0, block, pSegment, stPinchSegment_fromLink(segment->nBlockSegment));
+                if (segment2->nBlockSegment == 0) {
+                    stPinchPools_set(pools, block->tailSegment, segment2);
+                }
+                stPinchBlock_pinch2(block2, segment, 0);
+                pSegment = segment2;
+            }
+        }
+    } else {
+        stPinchSegment_splitP(segment, leftSegmentLength);
+    }
+}
+
+void stPinchSegment_putSegmentFirstInBlock(stPinchSegment *segment) {
+    stPinchBlock *block = stPinchSegment_getBlock(segment);
+    if(block != NULL) {
+        if(block->headSegment != segment) {
+            stPinchPools *pools = segment->thread->pools;
+            stPinchSegment *pBlockSegment = stPinchSegment_fromLink(segment->pBlockSegment);
+            assert(pBlockSegment != NULL);
+            stPinchPools_set(pools, pBlockSegment->nBlockSegment, segment->nBlockSegment);
+            if(segment->nBlockSegment == 0) {
+                assert(block->tailSegment == segment);
+                stPinchPools_set(pools, block->tailSegment, pBlockSegment);
+            } else {
+                stPinchPools_set(pools, stPinchSegment_fromLink(segment->nBlockSegment)->pBlockSegment, segment->pBlockSegment);
+            }
+            stPinchPools_set(pools, segment->pBlockSegment, 0);
+            stPinchPools_set(pools, segment->nBlockSegment, stPinchSegment_toLink(block->headSegment));
+            stPinchPools_set(pools, block->headSegment->pBlockSegment, stPinchSegment_toLink(segment));
+            stPinchPools_set(pools, block->headSegment, segment);
+        }
+    }
+}
+
+void stPinchSegment_removeFromBlock(stPinchSegment *segment) {
+    stPinchBlock *block = stPinchSegment_getBlock(segment);
+    if(block != NULL) {
+        if(block->degree == 1) {
+            stPinchBlock_destruct(block);
+            return;
+        }
+        stPinchPools *pools = segment->thread->pools;
+        stPinchBlock_segmentsChanged(pools, block);
+        if(segment->pBlockSegment == 0) {
+            assert(block->headSegment == segment);
+            stPinchPools_set(pools, block->headSegment, stPinchSegment_fromLink(segment->nBlockSegment));
+        } else {
+            stPinchPools_set(pools, stPinchSegment_fromLink(segment->pBlockSegment)->nBlockSegment, segment->nBlockSegment);
+        }
+        if(segment->nBlockSegment == 0) {
+            assert(block->tailSegment == segment);
+            stPinchPools_set(pools, block->tailSegment, stPinchSegment_fromLink(segment->pBlockSegment));
+        } else {
+            stPinchPools_set(pools, stPinchSegment_fromLink(segment->nBlockSegment)->pBlockSegment, segment->pBlockSegment);
+        }
+        stPinchPools_set(pools, block->degree, block->degree - 1);
+        connectBlockToSegment(segment, 0, NULL, NULL, NULL);
+        stPinchPools_updateThreadComponentNumber(pools, 0, 1); //The segment's thread may have left the component
+        stPinchPools_recordChange(pools, block->headSegment->thread, block->headSegment->start); //The block's boundaries changed
+    }
+}
+
+//Thread
+
+int64_t stPinchThread_getName(stPinchThread *thread) {
+    return thread->name;
+}
+
+int64_t stPinchThread_getIndex(stPinchThread *thread) {
+    return thread->index;
+}
+
+int64_t stPinchThread_getStart(stPinchThread *thread) {
+    return thread->start;
+}
+
+int64_t stPinchThread_getLength(stPinchThread *thread) {
+    return thread->length;
+}
+
+stPinchSegment *stPinchThread_getSegment(stPinchThread *thread, int64_t coordinate) {
+    stPinchSegment *segment2 = stPinchSegmentIndex_searchLessThanOrEqual(&thread->segments, coordinate);
+    if (segment2 == NULL) {
+        return NULL;
+    }
+    assert(stPinchSegment_getStart(segment2) <= coordinate);
+    if (stPinchSegment_getStart(segment2) + stPinchSegment_getLength(segment2) <= coordinate) {
+        return NULL;
+    }
+    return segment2;
 }
 
 stPinchSegment *stPinchThread_getFirst(stPinchThread *thread) {
-    return stSortedSet_getFirst(thread->segments);
+    return stPinchSegmentIndex_getFirst(&thread->segments);
+}
+
+stPinchSegment *stPinchThread_getLast(stPinchThread *thread) {
+    return stPinchSegmentIndex_getLast(&thread->segments);
+}
+
+void stPinchThread_split(stPinchThread *thread, int64_t leftSideOfSplitPoint) {
+    stPinchSegment *segment = stPinchThread_getSegment(thread, leftSideOfSplitPoint);
+    if (segment == NULL) {
+        return;
+    }
+    stPinchSegment_split(segment, leftSideOfSplitPoint);
+}
+
+/*
+ * Merges the run of unaligned segments that follows an unaligned segment into it.
+ */
+static void stPinchSegment_joinUnaligned3Prime(stPinchSegment *segment) {
+    assert(stPinchSegment_getBlock(segment) == NULL);
+    stPinchThread *thread = segment->thread;
+    while (1) {
+        stPinchSegment *nSegment = stPinchSegment_get3Prime(segment);
+        if (nSegment != NULL) {
+            stPinchBlock *nBlock = stPinchSegment_getBlock(nSegment);
+            if (nBlock == NULL) {
+                //Trivial join
+                stPinchPools_set(thread->pools, segment->nSegment, nSegment->nSegment);
+                assert(nSegment->nSegment != 0);
+                stPinchPools_set(thread->pools, stPinchSegment_fromLink(nSegment->nSegment)->pSegment, stPinchSegment_toLink(segment));
+                stPinchSegmentIndex_remove(&thread->segments, nSegment->start);
+                stPinchPools_logPointer(thread->pools, ST_PINCH_UNDO_INDEX_REMOVE, &thread->segments, nSegment);
+                stPinchSegment_destruct(nSegment);
+                continue;
+            }
+        }
+        break;
+    }
+}
+
+void stPinchThread_joinTrivialBoundaries(stPinchThread *thread) {
+    stPinchSegment *segment = stPinchThread_getFirst(thread);
+    do {
+        if (stPinchSegment_getBlock(segment) == NULL) {
+            stPinchSegment_joinUnaligned3Prime(segment);
+        }
+    } while ((segment = stPinchSegment_get3Prime(segment)) != NULL);
+}
+
+stPinchSegment *stPinchThread_pinchP(stPinchSegment *segment1, int64_t start) {
+    assert(segment1 != NULL);
+    if (stPinchSegment_getStart(segment1) != start) {
+        stPinchSegment_split(segment1, start - 1);
+        segment1 = stPinchSegment_get3Prime(segment1);
+    }
+    return segment1;
+}
+
+stPinchSegment *stPinchThread_pinchTrimPositive(stPinchSegment *segment, int64_t length) {
+    assert(length > 0);
+    if (stPinchSegment_getLength(segment) <= length) {
+        return segment;
+    }
+    stPinchSegment_split(segment, stPinchSegment_getStart(segment) + length - 1);
+    return segment;
+}
+
+void stPinchThread_pinchPositiveP(stPinchSegment *segment1, stPinchSegment *segment2, int64_t start1, int64_t start2, int64_t length) {
+    while (length > 0) {
+        if (segment1 == segment2) {
+            return; //This is a trivial alignment
+        }
+        do {
+            int64_t i = stPinchSegment_getLength(segment1);
+            segment2 = stPinchThread_pinchTrimPositive(segment2, length > i ? i : length);
+            i = stPinchSegment_getLength(segment2);
+            stPinchThread_pinchTrimPositive(segment1, length > i ? i : length);
+        } while (stPinchSegment_getLength(segment1) != stPinchSegment_getLength(segment2));
+        stPinchBlock *block1, *block2;
+        if ((block1 = stPinchSegment_getBlock(segment1)) == NULL) {
+            block1 = stPinchBlock_construct2(segment1);
+        }
+        if ((block2 = stPinchSegment_getBlock(segment2)) == NULL) {
+            block2 = stPinchBlock_construct2(segment2);
+        }
+        bool bO1 = stPinchSegment_getBlockOrientation(segment1);
+        bool bO2 = stPinchSegment_getBlockOrientation(segment2);
+        bool alignmentOrientation = bO1 == bO2;
+        if (block1 == block2) {
+            if (stPinchSegment_getLength(segment1) > 1 && !alignmentOrientation) {
+                segment2 = stPinchThread_pinchTrimPositive(segment2, stPinchSegment_getLength(segment2) / 2);
+                continue;
+            }
+        }
+        block1 = stPinchBlock_pinch(block1, block2, alignmentOrientation);
+        length -= stPinchSegment_getLength(segment1);
+        segment1 = stPinchSegment_get3Prime(segment1);
+        segment2 = stPinchSegment_get3Prime(segment2);
+    }
+}
+
+void stPinchThread_pinchPositive(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length) {
+    stPinchSegment *segment1 = stPinchThread_pinchP(stPinchThread_getSegment(thread1, start1), start1);
+    stPinchSegment *segment2 = stPinchThread_pinchP(stPinchThread_getSegment(thread2, start2), start2);
+    stPinchThread_pinchPositiveP(segment1, segment2, start1, start2, length);
+}
+
+void stPinchThread_pinchPositive2(stPinchSegment *segment1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length) {
+    segment1 = stPinchThread_pinchP(segment1, start1);
+    stPinchSegment *segment2 = stPinchThread_pinchP(stPinchThread_getSegment(thread2, start2), start2);
+    stPinchThread_pinchPositiveP(segment1, segment2, start1, start2, length);
+}
+
+stPinchSegment *stPinchThread_pinchTrimNegative(stPinchSegment *segment, int64_t length) {
+    assert(length > 0);
+    if (stPinchSegment_getLength(segment) <= length) {
+        return segment;
+    }
+    stPinchSegment_split(segment, stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment) - 1 - length);
+    return stPinchSegment_get3Prime(segment);
+}
+
+void stPinchThread_pinchNegativeP(stPinchSegment *segment1, stPinchSegment *segment2, int64_t start1, int64_t start2, int64_t length) {
+    while (length > 0) {
+        if (segment1 == segment2) {
+            if (stPinchSegment_getLength(segment1) > 1) { //Split the block in two
+                segment2 = stPinchThread_pinchTrimNegative(segment2, stPinchSegment_getLength(segment1) / 2);
+            }
+        }
+        do {
+            int64_t i = stPinchSegment_getLength(segment1);
+            segment2 = stPinchThread_pinchTrimNegative(segment2, length > i ? i : length);
+            i = stPinchSegment_getLength(segment2);
+            stPinchThread_pinchTrimPositive(segment1, length > i ? i : length);
+        } while (stPinchSegment_getLength(segment1) != stPinchSegment_getLength(segment2));
+        stPinchBlock *block1, *block2;
+        if ((block1 = stPinchSegment_getBlock(segment1)) == NULL) {
+            block1 = stPinchBlock_construct2(segment1);
+        }
+        if ((block2 = stPinchSegment_getBlock(segment2)) == NULL) {
+            block2 = stPinchBlock_construct2(segment2);
+        }
+        bool bO1 = stPinchSegment_getBlockOrientation(segment1);
+        bool bO2 = stPinchSegment_getBlockOrientation(segment2);
+        bool alignmentOrientation = bO1 != bO2;
+        if (block1 == block2) {
+            if (stPinchSegment_getLength(segment1) > 1 && !alignmentOrientation) {
+                segment2 = stPinchThread_pinchTrimNegative(segment2, stPinchSegment_getLength(segment2) / 2);
+                continue;
+            }
+        }
+        block1 = stPinchBlock_pinch(block1, block2, alignmentOrientation);
+        length -= stPinchSegment_getLength(segment1);
+        segment1 = stPinchSegment_get3Prime(segment1);
+        segment2 = stPinchSegment_get5Prime(segment2);
+    }
+}
+
+void stPinchThread_pinchNegative(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length) {
+    stPinchSegment *segment1 = stPinchThread_pinchP(stPinchThread_getSegment(thread1, start1), start1);
+    stPinchSegment *segment2 = stPinchThread_getSegment(thread2, start2 + length - 1);
+    stPinchSegment_split(segment2, start2 + length - 1);
+    stPinchThread_pinchNegativeP(segment1, segment2, start1, start2, length);
+}
+
+void stPinchThread_pinchNegative2(stPinchSegment *segment1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length) {
+    segment1 = stPinchThread_pinchP(segment1, start1);
+    stPinchSegment *segment2 = stPinchThread_getSegment(thread2, start2 + length - 1);
+    stPinchSegment_split(segment2, start2 + length - 1);
+    stPinchThread_pinchNegativeP(segment1, segment2, start1, start2, length);
+}
+
+void stPinchThread_pinch(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length, bool strand2) {
+    assert(length >= 0);
+    if (length == 0) {
+        return;
+    }
+    assert(stPinchThread_getStart(thread1) <= start1);
+    assert(stPinchThread_getStart(thread1) + stPinchThread_getLength(thread1) >= start1 + length);
+    assert(stPinchThread_getStart(thread2) <= start2);
+    assert(stPinchThread_getStart(thread2) + stPinchThread_getLength(thread2) >= start2 + length);
+    if(strand2) {
+        stPinchThread_pinchPositive(thread1, thread2, start1, start2, length);
+    }
+    else {
+        stPinchThread_pinchNegative(thread1, thread2, start1, start2, length);
+    }
+}
+
+
+//Private functions
+
+static stPinchThread *stPinchThread_construct(stPinchThreadSet *threadSet, int64_t name, int64_t start, int64_t length) {
+    stPinchThread *thread = stPinchPool_calloc(&threadSet->threadPool);
+    thread->name = name;
+    thread->start = start;
+    thread->length = length;
+    thread->index = stPinchThreadSet_getSize(threadSet);
+    thread->pools = &threadSet->pools;
+    thread->componentParent = thread;
+    thread->componentSize = 1;
+    stPinchSegmentIndex_init(&thread->segments);
+    stPinchSegment *segment = stPinchSegment_construct(start, thread);
+    stPinchSegment *terminatorSegment = stPinchSegment_construct(start + length, thread);
+    segment->nSegment = stPinchSegment_toLink(terminatorSegment);
+    terminatorSegment->pSegment = stPinchSegment_toLink(segment);
+    stPinchSegmentIndex_insert(&thread->segments, segment);
+    return thread;
+}
+
+static void stPinchThread_destruct(stPinchThreadSet *threadSet, stPinchThread *thread) {
+    //The segments are owned by the thread set's segment pool, and the thread by its thread pool
+    stPinchSegmentIndex_destruct(&thread->segments);
+    stPinchPool_free(&threadSet->threadPool, thread);
+}
+
+/*
+ * Threads are found by name directly while their names are consecutive in order of addition, as is usual, else
+ * through a linear probing table of the threads, hashed by their names.
+ */
+#define ST_PINCH_THREAD_TABLE_MIN_SIZE 16
+
+static inline uint64_t stPinchThreadSet_hashName(int64_t name) {
+    uint64_t i = (uint64_t) name * 0x9E3779B97F4A7C15ULL; //Names are often consecutive, so spread them
+    return i ^ (i >> 32);
+}
+
+static void stPinchThreadSet_insertIntoThreadTable(stPinchThreadSet *threadSet, stPinchThread *thread) {
+    uint64_t mask = threadSet->threadTableSize - 1;
+    uint64_t i = stPinchThreadSet_hashName(thread->name) & mask;
+    while (threadSet->threadTable[i] != NULL) {
+        i = (i + 1) & mask;
+    }
+    threadSet->threadTable[i] = thread;
+}
+
+/*
+ * Builds the table, with room for at least the given number of threads.
+ */
+static void stPinchThreadSet_buildThreadTable(stPinchThreadSet *threadSet, int64_t maxThreadNumber) {
+    int64_t threadNumber = stPinchThreadSet_getSize(threadSet);
+    assert(maxThreadNumber >= threadNumber);
+    int64_t size = ST_PINCH_THREAD_TABLE_MIN_SIZE;
+    while (size < 2 * maxThreadNumber) {
+        size *= 2;
+    }
+    free(threadSet->threadTable);
+    threadSet->threadTable = st_calloc(size, sizeof(stPinchThread *));
+    threadSet->threadTableSize = size;
+    for (int64_t i = 0; i < threadNumber; i++) {
+        stPinchThreadSet_insertIntoThreadTable(threadSet, stList_get(threadSet->threads, i));
+    }
+}
+
+/*
+ * Removes the thread from the table, moving back the threads after it in its run that could then not be found.
+ */
+static void stPinchThreadSet_removeFromThreadTable(stPinchThreadSet *threadSet, stPinchThread *thread) {
+    uint64_t mask = threadSet->threadTableSize - 1;
+    uint64_t i = stPinchThreadSet_hashName(thread->name) & mask;
+    while (threadSet->threadTable[i] != thread) {
+        assert(threadSet->threadTable[i] != NULL);
+        i = (i + 1) & mask;
+    }
+    uint64_t j = i;
+    while (threadSet->threadTable[j = (j + 1) & mask] != NULL) {
+        uint64_t k = stPinchThreadSet_hashName(threadSet->threadTable[j]->name) & mask;
+        if (((j - k) & mask) >= ((j - i) & mask)) { //The thread's home slot is not between the gap and it
+            threadSet->threadTable[i] = threadSet->threadTable[j];
+            i = j;
+        }
+    }
+    threadSet->threadTable[i] = NULL;
+}
+
+//Thread set
+
+stPinchThreadSet *stPinchThreadSet_construct() {
+    stPinchThreadSet *threadSet = st_malloc(sizeof(stPinchThreadSet));
+    threadSet->threads = stList_construct();
+    stPinchPool_init(&threadSet->threadPool, sizeof(stPinchThread), 0);
+    threadSet->threadTable = NULL;
+    threadSet->threadTableSize = 0;
+    threadSet->firstThreadName = 0;
+    threadSet->blockIdBound = 0;
+    threadSet->threadComponentNumber = 0;
+    threadSet->blockSegmentsVersion = 0;
+    threadSet->nextAdjacencyComponentLabel = 1;
+    pthread_mutex_init(&threadSet->queryMutex, NULL);
+    stPinchPools_init(&threadSet->pools, &threadSet->blockIdBound, &threadSet->threadComponentNumber, &threadSet->blockSegmentsVersion,
+            &threadSet->queryMutex);
+    return threadSet;
+}
+
+void stPinchThreadSet_destruct(stPinchThreadSet *threadSet) {
+    if (threadSet->pools.undoLog != NULL) { //Objects freed by the open transaction are released with the pools
+        stPinchUndoLog_destruct(threadSet->pools.undoLog);
+    }
+    stPinchDirtyPositions_destruct(threadSet->pools.adjacencyComponentChanges);
+    stPinchDirtyPositions_destruct(threadSet->pools.trivialBoundaryChanges);
+    stPinchThreadSet_setBlockSegmentIndexing(threadSet, 0);
+    for (int64_t i = 0; i < stPinchThreadSet_getSize(threadSet); i++) {
+        stPinchThread_destruct(threadSet, stList_get(threadSet->threads, i));
+    }
+    stList_destruct(threadSet->threads);
+    stPinchPool_destruct(&threadSet->threadPool);
+    free(threadSet->threadTable);
+    //Releases all the segments and blocks in bulk
+    stPinchPools_destruct(&threadSet->pools);
+    pthread_mutex_destroy(&threadSet->queryMutex);
+    free(threadSet);
+}
+
+stPinchThread *stPinchThreadSet_addThread(stPinchThreadSet *threadSet, int64_t name, int64_t start, int64_t length) {
+    assert(stPinchThreadSet_getThread(threadSet, name) == NULL);
+    stPinchThread *thread = stPinchThread_construct(threadSet, name, start, length);
+    stList_append(threadSet->threads, thread);
+    if (threadSet->threadTable == NULL) {
+        if (thread->index == 0) {
+            threadSet->firstThreadName = name;
+        } else if ((uint64_t) name - (uint64_t) threadSet->firstThreadName != (uint64_t) thread->index) {
+            stPinchThreadSet_buildThreadTable(threadSet, 2 * stPinchThreadSet_getSize(threadSet)); //The names are no longer dense
+        }
+    } else if (2 * stPinchThreadSet_getSize(threadSet) > threadSet->threadTableSize) {
+        stPinchThreadSet_buildThreadTable(threadSet, 2 * stPinchThreadSet_getSize(threadSet));
+    } else {
+        stPinchThreadSet_insertIntoThreadTable(threadSet, thread);
+    }
+    stPinchPools_logPointer(&threadSet->pools, ST_PINCH_UNDO_ADD_THREAD, thread, NULL);
+    stPinchPools_updateThreadComponentNumber(&threadSet->pools, 1, 0);
+    return thread;
 }
 
-stPinchSegment *stPinchThread_getLast(stPinchThread *thread) {
-    return stSortedSet_getLast(thread->segments);
+void stPinchThreadSet_addThreads(stPinchThreadSet *threadSet, const int64_t *names, const int64_t *starts, const int64_t *lengths,
+        int64_t threadNumber) {
+    //Allocate the threads and their segments contiguously, and size the table once if the names will not be dense
+    stPinchPool_reserve(&threadSet->threadPool, threadNumber);
+    stPinchPool_reserve(&threadSet->pools.segmentPool, 2 * threadNumber);
+    int64_t firstIndex = stPinchThreadSet_getSize(threadSet);
+    bool dense = threadSet->threadTable == NULL;
+    for (int64_t i = 0; i < threadNumber && dense; i++) {
+        int64_t firstName = firstIndex > 0 ? threadSet->firstThreadName : names[0];
+        dense = (uint64_t) names[i] - (uint64_t) firstName == (uint64_t) (firstIndex + i);
+    }
+    if (!dense && (threadSet->threadTable == NULL || 2 * (firstIndex + threadNumber) > threadSet->threadTableSize)) {
+        stPinchThreadSet_buildThreadTable(threadSet, firstIndex + threadNumber);
+    }
+    for (int64_t i = 0; i < threadNumber; i++) {
+        stPinchThreadSet_addThread(threadSet, names[i], starts[i], lengths[i]);
+    }
 }
 
-void stPinchThread_split(stPinchThread *thread, int64_t leftSideOfSplitPoint) {
-    stPinchSegment *segment = stPinchThread_getSegment(thread, leftSideOfSplitPoint);
-    if (segment == NULL) {
-        return;
+stPinchThread *stPinchThreadSet_getThread(stPinchThreadSet *threadSet, int64_t name) {
+    if (threadSet->threadTable == NULL) {
+        uint64_t i = (uint64_t) name - (uint64_t) threadSet->firstThreadName;
+        return i < (uint64_t) stPinchThreadSet_getSize(threadSet) ? stList_get(threadSet->threads, i) : NULL;
     }
-    stPinchSegment_split(segment, leftSideOfSplitPoint);
+    uint64_t mask = threadSet->threadTableSize - 1;
+    uint64_t i = stPinchThreadSet_hashName(name) & mask;
+    stPinchThread *thread;
+    while ((thread = threadSet->threadTable[i]) != NULL) {
+        if (thread->name == name) {
+            return thread;
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
 }
 
-void stPinchThread_joinTrivialBoundaries(stPinchThread *thread) {
-    stPinchSegment *segment = stPinchThread_getFirst(thread);
-    do {
-        if (stPinchSegment_getBlock(segment) == NULL) {
-            while (1) {
-                stPinchSegment *nSegment = stPinchSegment_get3Prime(segment);
-                if (nSegment != NULL) {
-                    stPinchBlock *nBlock = stPinchSegment_getBlock(nSegment);
-                    if (nBlock == NULL) {
-                        //Trivial join
-                        segment->nSegment = nSegment->nSegment;
-                        assert(nSegment->nSegment != NULL);
-                        nSegment->nSegment->pSegment = segment;
-                        stSortedSet_remove(thread->segments, nSegment);
-                        stPinchSegment_destruct(nSegment);
-                        continue;
+stPinchThread *stPinchThreadSet_getThreadByIndex(stPinchThreadSet *threadSet, int64_t index) {
+    assert(index >= 0 && index < stPinchThreadSet_getSize(threadSet));
+    return stList_get(threadSet->threads, index);
+}
+
+int64_t stPinchThreadSet_getSize(stPinchThreadSet *threadSet) {
+    return stList_length(threadSet->threads);
+}
+
+stPinchThreadSetIt stPinchThreadSet_getIt(stPinchThreadSet *threadSet) {
+    stPinchThreadSetIt threadIt;
+    threadIt.threadSet = threadSet;
+    threadIt.index = 0;
+    return threadIt;
+}
+
+stPinchThread *stPinchThreadSetIt_getNext(stPinchThreadSetIt *threadIt) {
+    if (threadIt->index < stPinchThreadSet_getSize(threadIt->threadSet)) {
+        return stList_get(threadIt->threadSet->threads, threadIt->index++);
+    }
+    return NULL;
+}
+
+static stPinchBlock *stPinchEnd_getTrivialBoundaryBlock(stPinchEnd end);
+
+static stPinchBlock *stPinchEnd_joinTrivialBoundaryP(stPinchEnd end);
+
+/*
+ * Joins the trivial boundaries that may have been made by the changes at the given positions. A full join leaves
+ * none, and after it a new trivial boundary or pair of adjacent unaligned segments can only arise where segments or
+ * block membership changed, so only the segments and blocks at these positions need be examined. Joining the
+ * boundary of a block may make its new neighbour's boundary trivial in turn, so each end is joined until it is not.
+ */
+static void stPinchThreadSet_joinTrivialBoundariesAroundChanges(stPinchThreadSet *threadSet, stPinchDirtyPositions *changes) {
+    for (int64_t i = 0; i < changes->length; i++) {
+        stPinchSegment *segment = stPinchThreadSet_getSegment(threadSet, changes->positions[2 * i], changes->positions[2 * i + 1]);
+        if (segment != NULL && stPinchSegment_getBlock(segment) == NULL) {
+            stPinchSegment *pSegment;
+            while ((pSegment = stPinchSegment_get5Prime(segment)) != NULL && stPinchSegment_getBlock(pSegment) == NULL) {
+                segment = pSegment;
+            }
+            stPinchSegment_joinUnaligned3Prime(segment);
+        }
+    }
+    for (int64_t i = 0; i < changes->length; i++) {
+        stPinchSegment *segment = stPinchThreadSet_getSegment(threadSet, changes->positions[2 * i], changes->positions[2 * i + 1]);
+        stPinchBlock *block = segment != NULL ? stPinchSegment_getBlock(segment) : NULL;
+        while (block != NULL) { //Joining may keep the block on the other side, so the ends are those of the block kept
+            stPinchEnd end = stPinchEnd_constructStatic(block, 0), end2 = stPinchEnd_constructStatic(block, 1);
+            block = stPinchEnd_boundaryIsTrivial(end) ? stPinchEnd_joinTrivialBoundaryP(end) :
+                    (stPinchEnd_boundaryIsTrivial(end2) ? stPinchEnd_joinTrivialBoundaryP(end2) : NULL);
+        }
+    }
+}
+
+void stPinchThreadSet_joinTrivialBoundaries(stPinchThreadSet *threadSet) {
+    stPinchDirtyPositions *changes = threadSet->pools.trivialBoundaryChanges;
+    threadSet->pools.trivialBoundaryChanges = NULL; //Joining makes no trivial boundaries, so its changes are not recorded
+    if (changes != NULL && !changes->all) {
+        stPinchThreadSet_joinTrivialBoundariesAroundChanges(threadSet, changes);
+    } else {
+        stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+        stPinchThread *thread;
+        while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+            stPinchThread_joinTrivialBoundaries(thread);
+        }
+        //The blocks before each in the registry have been joined with their neighbours, so each block is kept
+        stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+        stPinchBlock *block;
+        while ((block = stPinchThreadSetBlockIt_getNext(&blockIt))) {
+            for (int64_t orientation = 0; orientation < 2; orientation++) {
+                stPinchEnd end = stPinchEnd_constructStatic(block, orientation);
+                while (stPinchEnd_boundaryIsTrivial(end)) {
+                    if (stPinchEnd_getTrivialBoundaryBlock(end) == blockIt.block) { //Step over the block the join destructs
+                        stPinchThreadSetBlockIt_getNext(&blockIt);
                     }
+                    stPinchEnd_joinTrivialBoundaryP(end);
                 }
-                break;
             }
         }
-    } while ((segment = stPinchSegment_get3Prime(segment)) != NULL);
+    }
+    if (changes != NULL) {
+        stPinchDirtyPositions_clear(changes, 0);
+        threadSet->pools.trivialBoundaryChanges = changes;
+    }
 }
 
-stPinchSegment *stPinchThread_pinchP(stPinchSegment *segment1, int64_t start) {
-    assert(segment1 != NULL);
-    if (stPinchSegment_getStart(segment1) != start) {
-        stPinchSegment_split(segment1, start - 1);
-        segment1 = stPinchSegment_get3Prime(segment1);
+/*
+ * Moves the block onto the segments following its segments on their threads, which must not be in blocks, leaving
+ * its segments unaligned. The block keeps its id and place in the registry, and the order and orientations of its
+ * segments.
+ */
+static void stPinchBlock_moveToMiddleSegments(stPinchPools *pools, stPinchBlock *block) {
+    stPinchSegment *segment = block->headSegment, *pMiddleSegment = NULL;
+    while (segment != NULL) {
+        stPinchSegment *nBlockSegment = stPinchSegment_fromLink(segment->nBlockSegment);
+        stPinchSegment *middleSegment = stPinchSegment_fromLink(segment->nSegment);
+        assert(stPinchSegment_getBlock(middleSegment) == NULL);
+        stPinchPools_set(pools, middleSegment->block, segment->block);
+        stPinchPools_set(pools, middleSegment->pBlockSegment, stPinchSegment_toLink(pMiddleSegment));
+        if (pMiddleSegment != NULL) {
+            stPinchPools_set(pools, pMiddleSegment->nBlockSegment, stPinchSegment_toLink(middleSegment));
+        } else {
+            stPinchPools_set(pools, block->headSegment, middleSegment);
+        }
+        pMiddleSegment = middleSegment;
+        stPinchPools_set(pools, segment->block, 0);
+        stPinchPools_set(pools, segment->pBlockSegment, 0);
+        stPinchPools_set(pools, segment->nBlockSegment, 0);
+        segment = nBlockSegment;
     }
-    return segment1;
+    stPinchPools_set(pools, block->tailSegment, pMiddleSegment);
+    stPinchBlock_segmentsChanged(pools, block);
 }
 
-stPinchSegment *stPinchThread_pinchTrimPositive(stPinchSegment *segment, int64_t length) {
-    assert(length > 0);
-    if (stPinchSegment_getLength(segment) <= length) {
-        return segment;
+void stPinchThreadSet_trimAllBlocks(stPinchThreadSet *threadSet, int64_t blockEndTrim) {
+    if (blockEndTrim <= 0) {
+        return;
+    }
+    stPinchBlock *block = threadSet->pools.firstBlock;
+    while (block != NULL) {
+        stPinchBlock *nBlock = block->nBlock;
+        int64_t length = stPinchBlock_getLength(block);
+        if (length > 2 * blockEndTrim) {
+            for (stPinchSegment *segment = block->headSegment; segment != NULL; segment = stPinchSegment_fromLink(segment->nBlockSegment)) {
+                stPinchPools_recordChange(&threadSet->pools, segment->thread, segment->start); //The segment leaves its block
+                stPinchSegment_splitP(stPinchSegment_splitP(segment, blockEndTrim), length - 2 * blockEndTrim);
+            }
+            stPinchBlock_moveToMiddleSegments(&threadSet->pools, block);
+        } else {
+            stPinchBlock_destruct(block);
+        }
+        block = nBlock;
     }
-    stPinchSegment_split(segment, stPinchSegment_getStart(segment) + length - 1);
-    return segment;
 }
 
-void stPinchThread_pinchPositiveP(stPinchSegment *segment1, stPinchSegment *segment2, int64_t start1, int64_t start2, int64_t length) {
-    while (length > 0) {
-        if (segment1 == segment2) {
-            return; //This is a trivial alignment
-        }
-        do {
-            int64_t i = stPinchSegment_getLength(segment1);
-            segment2 = stPinchThread_pinchTrimPositive(segment2, length > i ? i : length);
-            i = stPinchSegment_getLength(segment2);
-            stPinchThread_pinchTrimPositive(segment1, length > i ? i : length);
-        } while (stPinchSegment_getLength(segment1) != stPinchSegment_getLength(segment2));
-        stPinchBlock *block1, *block2;
-        if ((block1 = stPinchSegment_getBlock(segment1)) == NULL) {
-            block1 = stPinchBlock_construct2(segment1);
+void stPinchThreadSet_setTrivialBoundaryTracking(stPinchThreadSet *threadSet, bool track) {
+    if (track && threadSet->pools.trivialBoundaryChanges == NULL) {
+        threadSet->pools.trivialBoundaryChanges = stPinchDirtyPositions_construct(1); //Until the first join
+    } else if (!track && threadSet->pools.trivialBoundaryChanges != NULL) {
+        stPinchDirtyPositions_destruct(threadSet->pools.trivialBoundaryChanges);
+        threadSet->pools.trivialBoundaryChanges = NULL;
+    }
+}
+
+void stPinchThreadSet_compactSegments(stPinchThreadSet *threadSet) {
+    if (threadSet->pools.undoLog != NULL) {
+        st_errAbort("Segments can not be compacted during a transaction\n");
+    }
+    stPinchPool segmentPool;
+    stPinchPool_init(&segmentPool, sizeof(stPinchSegment), 1);
+    //Copy the segments of each thread in 5' to 3' order, leaving a link to the copy in pSegment of the original
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        for (stPinchSegment *segment = stPinchThread_getFirst(thread); segment != NULL; segment = stPinchSegment_fromLink(segment->nSegment)) {
+            stPinchSegment *segment2 = stPinchPool_calloc(&segmentPool);
+            *segment2 = *segment;
+            segment->pSegment = stPinchSegment_toLink(segment2);
         }
-        if ((block2 = stPinchSegment_getBlock(segment2)) == NULL) {
-            block2 = stPinchBlock_construct2(segment2);
+    }
+    //Redirect the links of the copies, and of the blocks and indexes, to the copies
+    threadIt = stPinchThreadSet_getIt(threadSet);
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        stPinchSegment *pSegment2 = NULL;
+        for (stPinchSegment *segment = stPinchThread_getFirst(thread); segment != NULL; segment = stPinchSegment_fromLink(segment->nSegment)) {
+            stPinchSegment *segment2 = stPinchSegment_fromLink(segment->pSegment);
+            segment2->pSegment = stPinchSegment_toLink(pSegment2);
+            segment2->nSegment = segment->nSegment != 0 ? stPinchSegment_fromLink(segment->nSegment)->pSegment : 0;
+            segment2->pBlockSegment = segment->pBlockSegment != 0 ? stPinchSegment_fromLink(segment->pBlockSegment)->pSegment : 0;
+            segment2->nBlockSegment = segment->nBlockSegment != 0 ? stPinchSegment_fromLink(segment->nBlockSegment)->pSegment : 0;
+            stPinchBlock *block = stPinchSegment_getBlock(segment);
+            if (block != NULL) {
+                if (block->headSegment == segment) {
+                    block->headSegment = segment2;
+                }
+                if (block->tailSegment == segment) {
+                    block->tailSegment = segment2;
+                }
+            }
+            pSegment2 = segment2;
         }
-        bool bO1 = stPinchSegment_getBlockOrientation(segment1);
-        bool bO2 = stPinchSegment_getBlockOrientation(segment2);
-        bool alignmentOrientation = bO1 == bO2;
-        if (block1 == block2) {
-            if (stPinchSegment_getLength(segment1) > 1 && !alignmentOrientation) {
-                segment2 = stPinchThread_pinchTrimPositive(segment2, stPinchSegment_getLength(segment2) / 2);
-                continue;
+        stPinchSegmentIndex *index = &thread->segments;
+        for (int64_t i = 0; i < index->leafNumber; i++) {
+            stPinchSegmentIndexLeaf *leaf = index->leaves[i];
+            stPinchSegment **segments = stPinchSegmentIndexLeaf_getSegments(leaf);
+            for (int64_t j = 0; j < leaf->size; j++) {
+                segments[j] = stPinchSegment_fromLink(segments[j]->pSegment);
             }
         }
-        block1 = stPinchBlock_pinch(block1, block2, alignmentOrientation);
-        length -= stPinchSegment_getLength(segment1);
-        segment1 = stPinchSegment_get3Prime(segment1);
-        segment2 = stPinchSegment_get3Prime(segment2);
     }
+    stPinchPool_destruct(&threadSet->pools.segmentPool);
+    threadSet->pools.segmentPool = segmentPool;
+    stPinchThreadSet_releaseBlockSegmentIndices(threadSet); //They point to the old segments
 }
 
-void stPinchThread_pinchPositive(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length) {
-    stPinchSegment *segment1 = stPinchThread_pinchP(stPinchThread_getSegment(thread1, start1), start1);
-    stPinchSegment *segment2 = stPinchThread_pinchP(stPinchThread_getSegment(thread2, start2), start2);
-    stPinchThread_pinchPositiveP(segment1, segment2, start1, start2, length);
+void stPinchThreadSet_beginTransaction(stPinchThreadSet *threadSet) {
+    if (threadSet->pools.undoLog != NULL) {
+        st_errAbort("A transaction is already open on the thread set\n");
+    }
+    stPinchUndoLog *undoLog = st_malloc(sizeof(stPinchUndoLog));
+    undoLog->entries = NULL;
+    undoLog->length = 0;
+    undoLog->maxLength = 0;
+    threadSet->pools.undoLog = undoLog;
 }
 
-void stPinchThread_pinchPositive2(stPinchSegment *segment1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length) {
-    segment1 = stPinchThread_pinchP(segment1, start1);
-    stPinchSegment *segment2 = stPinchThread_pinchP(stPinchThread_getSegment(thread2, start2), start2);
-    stPinchThread_pinchPositiveP(segment1, segment2, start1, start2, length);
+static stPinchUndoLog *stPinchThreadSet_endTransaction(stPinchThreadSet *threadSet) {
+    stPinchUndoLog *undoLog = threadSet->pools.undoLog;
+    if (undoLog == NULL) {
+        st_errAbort("There is no open transaction on the thread set\n");
+    }
+    threadSet->pools.undoLog = NULL;
+    return undoLog;
 }
 
-stPinchSegment *stPinchThread_pinchTrimNegative(stPinchSegment *segment, int64_t length) {
-    assert(length > 0);
-    if (stPinchSegment_getLength(segment) <= length) {
-        return segment;
+void stPinchThreadSet_commitTransaction(stPinchThreadSet *threadSet) {
+    stPinchUndoLog *undoLog = stPinchThreadSet_endTransaction(threadSet);
+    for (int64_t i = 0; i < undoLog->length; i++) {
+        stPinchUndoEntry *entry = &undoLog->entries[i];
+        if (entry->type == ST_PINCH_UNDO_FREE) {
+            stPinchPool_free(entry->argument.pointer, entry->address);
+        }
     }
-    stPinchSegment_split(segment, stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment) - 1 - length);
-    return stPinchSegment_get3Prime(segment);
+    stPinchUndoLog_destruct(undoLog);
 }
 
-void stPinchThread_pinchNegativeP(stPinchSegment *segment1, stPinchSegment *segment2, int64_t start1, int64_t start2, int64_t length) {
-    while (length > 0) {
-        if (segment1 == segment2) {
-            if (stPinchSegment_getLength(segment1) > 1) { //Split the block in two
-                segment2 = stPinchThread_pinchTrimNegative(segment2, stPinchSegment_getLength(segment1) / 2);
+void stPinchThreadSet_rollbackTransaction(stPinchThreadSet *threadSet) {
+    stPinchUndoLog *undoLog = stPinchThreadSet_endTransaction(threadSet);
+    //Components may have been repaired and boundaries joined within the transaction, so start again
+    if (threadSet->pools.adjacencyComponentChanges != NULL) {
+        stPinchDirtyPositions_clear(threadSet->pools.adjacencyComponentChanges, 1);
+    }
+    if (threadSet->pools.trivialBoundaryChanges != NULL) {
+        stPinchDirtyPositions_clear(threadSet->pools.trivialBoundaryChanges, 1);
+    }
+    for (int64_t i = undoLog->length - 1; i >= 0; i--) {
+        stPinchUndoEntry *entry = &undoLog->entries[i];
+        switch (entry->type) {
+        case ST_PINCH_UNDO_WRITE:
+            memcpy(entry->address, &entry->argument.value, sizeof(int64_t));
+            break;
+        case ST_PINCH_UNDO_WRITE_LINK:
+            memcpy(entry->address, &entry->argument.value, sizeof(stPinchSegmentLink));
+            break;
+        case ST_PINCH_UNDO_ALLOCATE:
+            if (entry->argument.pointer == &threadSet->pools.blockPool) {
+                free(((stPinchBlock *) entry->address)->sortedSegments);
             }
+            stPinchPool_free(entry->argument.pointer, entry->address);
+            break;
+        case ST_PINCH_UNDO_FREE: //The object was never released, so is already intact
+            break;
+        case ST_PINCH_UNDO_INDEX_INSERT:
+            stPinchSegmentIndex_remove(entry->address, entry->argument.value);
+            break;
+        case ST_PINCH_UNDO_INDEX_REMOVE:
+            stPinchSegmentIndex_insert(entry->address, entry->argument.pointer);
+            break;
+        case ST_PINCH_UNDO_INDEX_UPDATE_START: {
+            //The segment's start has already been restored, the index still has it at the new start
+            stPinchSegment *segment = stPinchSegmentIndex_searchLessThanOrEqual(entry->address, entry->argument.value);
+            assert(segment != NULL);
+            stPinchSegmentIndex_updateStart(entry->address, entry->argument.value, segment->start);
+            break;
         }
-        do {
-            int64_t i = stPinchSegment_getLength(segment1);
-            segment2 = stPinchThread_pinchTrimNegative(segment2, length > i ? i : length);
-            i = stPinchSegment_getLength(segment2);
-            stPinchThread_pinchTrimPositive(segment1, length > i ? i : length);
-        } while (stPinchSegment_getLength(segment1) != stPinchSegment_getLength(segment2));
-        stPinchBlock *block1, *block2;
-        if ((block1 = stPinchSegment_getBlock(segment1)) == NULL) {
-            block1 = stPinchBlock_construct2(segment1);
+        case ST_PINCH_UNDO_ADD_THREAD: { //Threads are only appended, so in reverse order this is always the last
+            stPinchThread *thread = stList_pop(threadSet->threads);
+            assert(thread == entry->address);
+            if (threadSet->threadTable != NULL) {
+                stPinchThreadSet_removeFromThreadTable(threadSet, thread);
+            }
+            stPinchThread_destruct(threadSet, thread);
+            break;
         }
-        if ((block2 = stPinchSegment_getBlock(segment2)) == NULL) {
-            block2 = stPinchBlock_construct2(segment2);
         }
-        bool bO1 = stPinchSegment_getBlockOrientation(segment1);
-        bool bO2 = stPinchSegment_getBlockOrientation(segment2);
-        bool alignmentOrientation = bO1 != bO2;
-        if (block1 == block2) {
-            if (stPinchSegment_getLength(segment1) > 1 && !alignmentOrientation) {
-                segment2 = stPinchThread_pinchTrimNegative(segment2, stPinchSegment_getLength(segment2) / 2);
-                continue;
+    }
+    stPinchUndoLog_destruct(undoLog);
+}
+
+/*
+ * Snapshots. The file is a header followed by arrays of 64 bit integers in the byte order of the machine that wrote
+ * it: for each thread its name, start, length and number of segments; the starts of the segments of each thread
+ * in turn; the degree of each block; and for each segment of each block, in block order, the index of its thread
+ * times two plus its orientation, then its start.
+ */
+
+static const char stPinchSnapshotMagic[8] = { 's', 't', 'P', 'i', 'n', 'c', 'h', 'S' };
+
+#define ST_PINCH_SNAPSHOT_VERSION 1
+#define ST_PINCH_SNAPSHOT_BYTE_ORDER 0x0102030405060708LL
+
+typedef struct _stPinchSnapshotHeader {
+    char magic[8];
+    int64_t version;
+    int64_t byteOrder;
+    int64_t threadNumber;
+    int64_t segmentNumber;
+    int64_t blockNumber;
+    int64_t blockSegmentNumber;
+} stPinchSnapshotHeader;
+
+static void writeInts(FILE *fileHandle, const int64_t *ints, int64_t intNumber) {
+    if (fwrite(ints, sizeof(int64_t), intNumber, fileHandle) != (size_t) intNumber) {
+        st_errAbort("Failed to write pinch graph snapshot\n");
+    }
+}
+
+void stPinchThreadSet_saveSnapshot(stPinchThreadSet *threadSet, const char *fileName) {
+    stPinchSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, stPinchSnapshotMagic, sizeof(header.magic));
+    header.version = ST_PINCH_SNAPSHOT_VERSION;
+    header.byteOrder = ST_PINCH_SNAPSHOT_BYTE_ORDER;
+    header.threadNumber = stPinchThreadSet_getSize(threadSet);
+    int64_t bufferSize = 4 * header.threadNumber; //Enough for the largest array written with one call
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        header.blockNumber++;
+        header.blockSegmentNumber += stPinchBlock_getDegree(block);
+        bufferSize = 2 * stPinchBlock_getDegree(block) > bufferSize ? 2 * stPinchBlock_getDegree(block) : bufferSize;
+    }
+    bufferSize = header.blockNumber > bufferSize ? header.blockNumber : bufferSize;
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        int64_t segmentNumber = stPinchSegmentIndex_getSize(&thread->segments);
+        header.segmentNumber += segmentNumber;
+        bufferSize = segmentNumber > bufferSize ? segmentNumber : bufferSize;
+    }
+
+    FILE *fileHandle = fopen(fileName, "wb");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open pinch graph snapshot file %s for writing\n", fileName);
+    }
+    if (fwrite(&header, sizeof(header), 1, fileHandle) != 1) {
+        st_errAbort("Failed to write pinch graph snapshot\n");
+    }
+    //Each array is gathered into the buffer and written with a single call
+    int64_t *buffer = st_malloc(sizeof(int64_t) * (bufferSize > 0 ? bufferSize : 1));
+    int64_t intNumber = 0;
+    threadIt = stPinchThreadSet_getIt(threadSet);
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        buffer[intNumber++] = thread->name;
+        buffer[intNumber++] = thread->start;
+        buffer[intNumber++] = thread->length;
+        buffer[intNumber++] = stPinchSegmentIndex_getSize(&thread->segments);
+    }
+    writeInts(fileHandle, buffer, intNumber);
+    threadIt = stPinchThreadSet_getIt(threadSet);
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        intNumber = 0;
+        for (stPinchSegment *segment = stPinchThread_getFirst(thread); segment->nSegment != 0; segment = stPinchSegment_fromLink(segment->nSegment)) {
+            buffer[intNumber++] = segment->start;
+        }
+        writeInts(fileHandle, buffer, intNumber);
+    }
+    intNumber = 0;
+    blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        buffer[intNumber++] = stPinchBlock_getDegree(block);
+    }
+    writeInts(fileHandle, buffer, intNumber);
+    blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        intNumber = 0;
+        for (stPinchSegment *segment = block->headSegment; segment != NULL; segment = stPinchSegment_fromLink(segment->nBlockSegment)) {
+            buffer[intNumber++] = segment->thread->index * 2 + stPinchSegment_getBlockOrientation(segment);
+            buffer[intNumber++] = segment->start;
+        }
+        writeInts(fileHandle, buffer, intNumber);
+    }
+    free(buffer);
+    if (fclose(fileHandle) != 0) {
+        st_errAbort("Failed to write pinch graph snapshot\n");
+    }
+}
+
+stPinchThreadSet *stPinchThreadSet_loadSnapshot(const char *fileName) {
+    int fileDescriptor = open(fileName, O_RDONLY);
+    if (fileDescriptor < 0) {
+        st_errAbort("Could not open pinch graph snapshot file %s\n", fileName);
+    }
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size < (off_t) sizeof(stPinchSnapshotHeader)) {
+        st_errAbort("Pinch graph snapshot file %s is truncated\n", fileName);
+    }
+    void *file = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (file == MAP_FAILED) {
+        st_errAbort("Could not map pinch graph snapshot file %s\n", fileName);
+    }
+    close(fileDescriptor);
+    const stPinchSnapshotHeader *header = file;
+    if (memcmp(header->magic, stPinchSnapshotMagic, sizeof(header->magic)) != 0 || header->byteOrder != ST_PINCH_SNAPSHOT_BYTE_ORDER) {
+        st_errAbort("File %s is not a pinch graph snapshot written on a machine of this byte order\n", fileName);
+    }
+    if (header->version != ST_PINCH_SNAPSHOT_VERSION) {
+        st_errAbort("Pinch graph snapshot file %s has unsupported version %" PRIi64 "\n", fileName, header->version);
+    }
+    //Bound each count by the ints in the file before summing them, so that the sum can not overflow
+    int64_t intNumber = (fileStat.st_size - (off_t) sizeof(stPinchSnapshotHeader)) / (off_t) sizeof(int64_t);
+    if ((fileStat.st_size - (off_t) sizeof(stPinchSnapshotHeader)) % (off_t) sizeof(int64_t) != 0
+            || header->threadNumber < 0 || header->threadNumber > intNumber / 4
+            || header->segmentNumber < 0 || header->segmentNumber > intNumber
+            || header->blockNumber < 0 || header->blockNumber > intNumber
+            || header->blockSegmentNumber < 0 || header->blockSegmentNumber > intNumber / 2
+            || 4 * header->threadNumber + header->segmentNumber + header->blockNumber + 2 * header->blockSegmentNumber != intNumber) {
+        st_errAbort("Pinch graph snapshot file %s has the wrong size\n", fileName);
+    }
+    const int64_t *threadInts = (const int64_t *) (header + 1);
+    const int64_t *segmentStarts = threadInts + 4 * header->threadNumber;
+    const int64_t *blockDegrees = segmentStarts + header->segmentNumber;
+    const int64_t *blockSegments = blockDegrees + header->blockNumber;
+
+    //Make the threads, splitting each at the starts of its segments
+    stPinchThreadSet *threadSet = stPinchThreadSet_construct();
+    const int64_t *start = segmentStarts;
+    for (int64_t i = 0; i < header->threadNumber; i++) {
+        const int64_t *ints = threadInts + 4 * i;
+        if (ints[2] < 0 || ints[1] > INT64_MAX - ints[2] || ints[3] < 1 || ints[3] > blockDegrees - start
+                || start[0] != ints[1] || stPinchThreadSet_getThread(threadSet, ints[0]) != NULL) {
+            st_errAbort("Pinch graph snapshot file %s has malformed threads\n", fileName);
+        }
+        stPinchThread *thread = stPinchThreadSet_addThread(threadSet, ints[0], ints[1], ints[2]);
+        stPinchSegment *segment = stPinchThread_getFirst(thread);
+        for (int64_t j = 1; j < ints[3]; j++) {
+            if (start[j] <= start[j - 1] || start[j] >= ints[1] + ints[2]) {
+                st_errAbort("Pinch graph snapshot file %s has malformed segments\n", fileName);
+            }
+            segment = stPinchSegment_splitP(segment, start[j] - start[j - 1]);
+        }
+        start += ints[3];
+    }
+    if (start != blockDegrees) {
+        st_errAbort("Pinch graph snapshot file %s has segments of no thread\n", fileName);
+    }
+
+    //Make the blocks, adding the segments in their original order
+    const int64_t *blockSegment = blockSegments, *blockSegmentsEnd = blockSegments + 2 * header->blockSegmentNumber;
+    for (int64_t i = 0; i < header->blockNumber; i++) {
+        if (blockDegrees[i] < 1 || blockDegrees[i] > (blockSegmentsEnd - blockSegment) / 2) {
+            st_errAbort("Pinch graph snapshot file %s has malformed blocks\n", fileName);
+        }
+        stPinchBlock *block = NULL;
+        for (int64_t j = 0; j < blockDegrees[i]; j++, blockSegment += 2) {
+            int64_t threadIndex = blockSegment[0] / 2;
+            stPinchSegment *segment = blockSegment[0] >= 0 && threadIndex < header->threadNumber ?
+                    stPinchThread_getSegment(stList_get(threadSet->threads, threadIndex), blockSegment[1]) : NULL;
+            if (segment == NULL || segment->start != blockSegment[1] || stPinchSegment_getBlock(segment) != NULL
+                    || (block != NULL && stPinchSegment_getLength(segment) != stPinchBlock_getLength(block))) {
+                st_errAbort("Pinch graph snapshot file %s has malformed blocks\n", fileName);
             }
+            bool orientation = blockSegment[0] & 1;
+            block = block == NULL ? stPinchBlock_construct3(segment, orientation) : stPinchBlock_pinch2(block, segment, orientation);
+        }
+    }
+    if (blockSegment != blockSegmentsEnd) {
+        st_errAbort("Pinch graph snapshot file %s has block segments of no block\n", fileName);
+    }
+    munmap(file, fileStat.st_size);
+    return threadSet;
+}
+
+stPinchSegment *stPinchThreadSet_getSegment(stPinchThreadSet *threadSet, int64_t name, int64_t coordinate) {
+    stPinchThread *thread = stPinchThreadSet_getThread(threadSet, name);
+    if (thread == NULL) {
+        return NULL;
+    }
+    return stPinchThread_getSegment(thread, coordinate);
+}
+
+/*
+ * A cursor over the segments of a thread. It caches the thread and the last segment it returned, so that
+ * successive lookups of the same or nearby coordinates avoid the thread hash and segment index searches.
+ * Segments are never destructed by pinching, so a cursor remains valid across pinches.
+ */
+typedef struct _stPinchThreadCursor {
+    stPinchThread *thread;
+    stPinchSegment *segment;
+} stPinchThreadCursor;
+
+#define ST_PINCH_THREAD_CURSOR_MAX_WALK 16
+
+static void stPinchThreadCursor_setThread(stPinchThreadCursor *cursor, stPinchThreadSet *threadSet, int64_t name, bool byIndex) {
+    if (cursor->thread == NULL || (byIndex ? cursor->thread->index : stPinchThread_getName(cursor->thread)) != name) {
+        cursor->thread = byIndex ? stPinchThreadSet_getThreadByIndex(threadSet, name) : stPinchThreadSet_getThread(threadSet, name);
+        assert(cursor->thread != NULL);
+        cursor->segment = NULL;
+    }
+}
+
+static stPinchSegment *stPinchThreadCursor_getSegment(stPinchThreadCursor *cursor, int64_t coordinate) {
+    stPinchSegment *segment = cursor->segment;
+    //Walk a short distance from the last segment, falling back to searching the index
+    for (int64_t i = 0; segment != NULL && i < ST_PINCH_THREAD_CURSOR_MAX_WALK; i++) {
+        if (coordinate < stPinchSegment_getStart(segment)) {
+            segment = stPinchSegment_get5Prime(segment);
+        } else if (coordinate >= stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment)) {
+            segment = stPinchSegment_get3Prime(segment);
+        } else {
+            return cursor->segment = segment;
+        }
+    }
+    return cursor->segment = stPinchThread_getSegment(cursor->thread, coordinate);
+}
+
+/*
+ * Applies the pinches in order. If pinchIndices is not NULL the threads are being pinched by a parallel worker, and
+ * the blocks it allocates and frees are logged with the given indices of the pinches that allocated and freed them.
+ */
+static void stPinchThreadSet_pinchBatchP(stPinchThreadSet *threadSet, stPinch *pinches, const int64_t *pinchIndices, int64_t pinchNumber,
+        bool byIndex) {
+    stPinchThreadCursor cursor1 = { NULL, NULL }, cursor2 = { NULL, NULL };
+    for (int64_t i = 0; i < pinchNumber; i++) {
+        stPinch *pinch = &pinches[i];
+        assert(pinch->length >= 0);
+        if (pinch->length == 0) {
+            continue;
+        }
+        stPinchThreadCursor_setThread(&cursor1, threadSet, pinch->name1, byIndex);
+        stPinchThreadCursor_setThread(&cursor2, threadSet, pinch->name2, byIndex);
+        if (pinchIndices != NULL) {
+            cursor1.thread->pools->blockLog->key = pinchIndices[i];
+        }
+        assert(stPinchThread_getStart(cursor1.thread) <= pinch->start1);
+        assert(stPinchThread_getStart(cursor1.thread) + stPinchThread_getLength(cursor1.thread) >= pinch->start1 + pinch->length);
+        assert(stPinchThread_getStart(cursor2.thread) <= pinch->start2);
+        assert(stPinchThread_getStart(cursor2.thread) + stPinchThread_getLength(cursor2.thread) >= pinch->start2 + pinch->length);
+        //As in stPinchThread_pinch, the second segment is found after the first has been split, which may split it
+        stPinchSegment *segment1 = stPinchThread_pinchP(stPinchThreadCursor_getSegment(&cursor1, pinch->start1), pinch->start1);
+        if (pinch->strand) {
+            stPinchSegment *segment2 = stPinchThread_pinchP(stPinchThreadCursor_getSegment(&cursor2, pinch->start2), pinch->start2);
+            stPinchThread_pinchPositiveP(segment1, segment2, pinch->start1, pinch->start2, pinch->length);
+        } else {
+            stPinchSegment *segment2 = stPinchThreadCursor_getSegment(&cursor2, pinch->start2 + pinch->length - 1);
+            stPinchSegment_split(segment2, pinch->start2 + pinch->length - 1);
+            stPinchThread_pinchNegativeP(segment1, segment2, pinch->start1, pinch->start2, pinch->length);
         }
-        block1 = stPinchBlock_pinch(block1, block2, alignmentOrientation);
-        length -= stPinchSegment_getLength(segment1);
-        segment1 = stPinchSegment_get3Prime(segment1);
-        segment2 = stPinchSegment_get5Prime(segment2);
     }
 }
 
-void stPinchThread_pinchNegative(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length) {
-    stPinchSegment *segment1 = stPinchThread_pinchP(stPinchThread_getSegment(thread1, start1), start1);
-    stPinchSegment *segment2 = stPinchThread_getSegment(thread2, start2 + length - 1);
-    stPinchSegment_split(segment2, start2 + length - 1);
-    stPinchThread_pinchNegativeP(segment1, segment2, start1, start2, length);
+void stPinchThreadSet_pinchBatch(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber) {
+    stPinchThreadSet_pinchBatchP(threadSet, pinches, NULL, pinchNumber, 0);
 }
 
-void stPinchThread_pinchNegative2(stPinchSegment *segment1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length) {
-    segment1 = stPinchThread_pinchP(segment1, start1);
-    stPinchSegment *segment2 = stPinchThread_getSegment(thread2, start2 + length - 1);
-    stPinchSegment_split(segment2, start2 + length - 1);
-    stPinchThread_pinchNegativeP(segment1, segment2, start1, start2, length);
+void stPinchThreadSet_pinchBatchByIndex(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber) {
+    stPinchThreadSet_pinchBatchP(threadSet, pinches, NULL, pinchNumber, 1);
 }
 
-void stPinchThread_pinch(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length, bool strand2) {
-    assert(length >= 0);
-    if (length == 0) {
-        return;
-    }
-    assert(stPinchThread_getStart(thread1) <= start1);
-    assert(stPinchThread_getStart(thread1) + stPinchThread_getLength(thread1) >= start1 + length);
-    assert(stPinchThread_getStart(thread2) <= start2);
-    assert(stPinchThread_getStart(thread2) + stPinchThread_getLength(thread2) >= start2 + length);
-    if(strand2) {
-        stPinchThread_pinchPositive(thread1, thread2, start1, start2, length);
-    }
-    else {
-        stPinchThread_pinchNegative(thread1, thread2, start1, start2, length);
+#ifdef _OPENMP
+
+static int64_t getComponent(int64_t *components, int64_t i) {
+    while (components[i] != i) {
+        components[i] = components[components[i]]; //Path halving
+        i = components[i];
     }
+    return i;
 }
 
+static void joinComponents(int64_t *components, int64_t *componentSizes, int64_t i, int64_t j) {
+    i = getComponent(components, i);
+    j = getComponent(components, j);
+    if (i != j) {
+        if (componentSizes[i] < componentSizes[j]) {
+            int64_t k = i;
+            i = j;
+            j = k;
+        }
+        components[j] = i;
+        componentSizes[i] += componentSizes[j];
+    }
+}
 
-//Private functions
+typedef struct _stPinchGroup {
+    int64_t size;
+    int64_t index;
+} stPinchGroup;
 
-static stPinchThread *stPinchThread_construct(int64_t name, int64_t start, int64_t length) {
-    stPinchThread *thread = st_malloc(sizeof(stPinchThread));
-    thread->name = name;
-    thread->start = start;
-    thread->length = length;
-    thread->segments = stSortedSet_construct3((int(*)(const void *, const void *)) stPinchSegment_compareBySequencePosition,
-            (void(*)(void *)) stPinchSegment_destruct);
-    stPinchSegment *segment = stPinchSegment_construct(start, thread);
-    stPinchSegment *terminatorSegment = stPinchSegment_construct(start + length, thread);
-    segment->nSegment = terminatorSegment;
-    terminatorSegment->pSegment = segment;
-    stSortedSet_insert(thread->segments, segment);
-    return thread;
+static int stPinchGroup_compareByDecreasingSize(const void *a, const void *b) {
+    const stPinchGroup *group1 = a, *group2 = b;
+    return group1->size > group2->size ? -1 : (group1->size < group2->size ? 1 : 0);
 }
 
-static void stPinchThread_destruct(stPinchThread *thread) {
-    stPinchSegment *segment = stPinchThread_getLast(thread);
-    free(segment->nSegment);
-    stSortedSet_destruct(thread->segments);
-    free(thread);
+/*
+ * Fills in a union-find of the threads, indexed by thread index, joining the threads that share blocks, as a copy
+ * of the thread components, which the callers extend.
+ */
+static void getThreadComponentsByBlocks(stPinchThreadSet *threadSet, int64_t *components, int64_t *componentSizes) {
+    stPinchThreadSet_updateThreadComponents(threadSet);
+    for (int64_t i = 0; i < stPinchThreadSet_getSize(threadSet); i++) {
+        stPinchThread *thread = stPinchThread_getComponentP(stList_get(threadSet->threads, i));
+        components[i] = thread->index;
+        componentSizes[i] = thread->componentSize;
+    }
 }
 
-static uint64_t stPinchThread_hashKey(const stPinchThread *thread) {
-    return thread->name;
+/*
+ * Constructs pools for each worker, each tracking the changes the worker makes if the thread set tracks them.
+ */
+static stPinchPools *constructWorkerPools(stPinchThreadSet *threadSet, int64_t workerNumber) {
+    stPinchPools *workerPools = st_malloc(sizeof(stPinchPools) * workerNumber);
+    for (int64_t i = 0; i < workerNumber; i++) {
+        stPinchPools_init(&workerPools[i], &threadSet->blockIdBound, &threadSet->threadComponentNumber, &threadSet->blockSegmentsVersion,
+                &threadSet->queryMutex);
+        workerPools[i].indexBlockSegments = threadSet->pools.indexBlockSegments;
+        workerPools[i].blockLog = st_calloc(1, sizeof(stPinchBlockLog));
+        if (threadSet->pools.adjacencyComponentChanges != NULL) {
+            workerPools[i].adjacencyComponentChanges = stPinchDirtyPositions_construct(threadSet->pools.adjacencyComponentChanges->all);
+        }
+        if (threadSet->pools.trivialBoundaryChanges != NULL) {
+            workerPools[i].trivialBoundaryChanges = stPinchDirtyPositions_construct(threadSet->pools.trivialBoundaryChanges->all);
+        }
+    }
+    return workerPools;
 }
 
-static int stPinchThread_equals(const stPinchThread *thread1, const stPinchThread *thread2) {
-    return thread1->name == thread2->name;
+static int stPinchBlockLogEntry_compare(const void *a, const void *b) {
+    const stPinchBlockLogEntry *entry1 = a, *entry2 = b;
+    if (entry1->key != entry2->key) {
+        return entry1->key < entry2->key ? -1 : 1;
+    }
+    return entry1->order < entry2->order ? -1 : (entry1->order > entry2->order ? 1 : 0);
 }
 
-//Thread set
+/*
+ * Registers and frees the blocks of the entries, in order, giving each allocated block an id, just as
+ * stPinchPools_callocBlock and stPinchPools_freeBlock would have done had the entries been made by them. The free
+ * blocks with ids are kept as a stack, the first in the free list at its top. A block given the id of a free block
+ * does not take its memory, which is put at the end of the free list without an id, to be reused after every free
+ * block with an id, when stPinchPools_callocBlock gives it a new id as it would to newly allocated memory.
+ */
+static void stPinchPools_replayBlockLog(stPinchPools *pools, stPinchBlockLogEntry *entries, int64_t entryNumber) {
+    int64_t maxFreeBlockNumber = entryNumber;
+    for (void *object = pools->blockPool.freeObjects; object != NULL; object = *(void **) object) {
+        maxFreeBlockNumber++;
+    }
+    stPinchBlock **freeBlocks = st_malloc(sizeof(stPinchBlock *) * (maxFreeBlockNumber + 1));
+    stPinchBlock **idlessBlocks = st_malloc(sizeof(stPinchBlock *) * (maxFreeBlockNumber + 1));
+    int64_t freeBlockNumber = 0, idlessBlockNumber = 0;
+    for (stPinchBlock *block = pools->blockPool.freeObjects; block != NULL; block = *(void **) block) {
+        if (block->id >= 0) {
+            freeBlocks[freeBlockNumber++] = block;
+        } else {
+            idlessBlocks[idlessBlockNumber++] = block;
+        }
+    }
+    for (int64_t i = 0; i < freeBlockNumber / 2; i++) { //Put the first in the free list at the top
+        stPinchBlock *block = freeBlocks[i];
+        freeBlocks[i] = freeBlocks[freeBlockNumber - 1 - i];
+        freeBlocks[freeBlockNumber - 1 - i] = block;
+    }
+    for (int64_t i = 0; i < entryNumber; i++) {
+        stPinchBlock *block = entries[i].block;
+        if (entries[i].allocated) {
+            if (freeBlockNumber > 0) {
+                stPinchBlock *freeBlock = freeBlocks[--freeBlockNumber];
+                block->id = freeBlock->id;
+                freeBlock->id = -1;
+                idlessBlocks[idlessBlockNumber++] = freeBlock;
+            } else {
+                block->id = (*pools->blockIdBound)++;
+            }
+            stPinchPools_registerBlock(pools, block);
+        } else {
+            stPinchPools_unregisterBlock(pools, block);
+            freeBlocks[freeBlockNumber++] = block;
+        }
+    }
+    //Rebuild the free list, pushing the blocks without ids first so that they end up last
+    pools->blockPool.freeObjects = NULL;
+    for (int64_t i = 0; i < idlessBlockNumber; i++) {
+        stPinchPool_free(&pools->blockPool, idlessBlocks[i]);
+    }
+    for (int64_t i = 0; i < freeBlockNumber; i++) {
+        stPinchPool_free(&pools->blockPool, freeBlocks[i]);
+    }
+    free(idlessBlocks);
+    free(freeBlocks);
+}
 
-stPinchThreadSet *stPinchThreadSet_construct() {
-    stPinchThreadSet *threadSet = st_malloc(sizeof(stPinchThreadSet));
-    threadSet->threads = stList_construct3(0, (void(*)(void *)) stPinchThread_destruct);
-    threadSet->threadsHash = stHash_construct3((uint64_t(*)(const void *)) stPinchThread_hashKey,
-            (int(*)(const void *, const void *)) stPinchThread_equals, NULL, NULL);
-    return threadSet;
+/*
+ * Moves the slabs and free objects of pool2 into pool, leaving pool2 empty. Of the unused space at the ends of the
+ * current slabs of the two pools the smaller is abandoned.
+ */
+static void stPinchPool_merge(stPinchPool *pool, stPinchPool *pool2) {
+    assert(pool->objectSize == pool2->objectSize && pool->indexed == pool2->indexed);
+    if (pool2->slabEnd - pool2->nextObject > pool->slabEnd - pool->nextObject) {
+        pool->nextObject = pool2->nextObject;
+        pool->slabEnd = pool2->slabEnd;
+    }
+    if (pool2->slabs != NULL) {
+        void *slab = pool2->slabs;
+        while (*(void **) slab != NULL) {
+            slab = *(void **) slab;
+        }
+        *(void **) slab = pool->slabs;
+        pool->slabs = pool2->slabs;
+    }
+    if (pool2->freeObjects != NULL) {
+        void *object = pool2->freeObjects;
+        while (*(void **) object != NULL) {
+            object = *(void **) object;
+        }
+        *(void **) object = pool->freeObjects;
+        pool->freeObjects = pool2->freeObjects;
+    }
+    stPinchPool_init(pool2, pool2->objectSize, pool2->indexed);
 }
 
-void stPinchThreadSet_destruct(stPinchThreadSet *threadSet) {
-    stList_destruct(threadSet->threads);
-    stHash_destruct(threadSet->threadsHash);
-    free(threadSet);
+/*
+ * Adds the positions of dirtyPositions2 to dirtyPositions, destructing dirtyPositions2.
+ */
+static void stPinchDirtyPositions_merge(stPinchDirtyPositions *dirtyPositions, stPinchDirtyPositions *dirtyPositions2) {
+    for (int64_t i = 0; i < dirtyPositions2->length; i++) {
+        stPinchDirtyPositions_add(dirtyPositions, dirtyPositions2->positions[2 * i], dirtyPositions2->positions[2 * i + 1]);
+    }
+    stPinchDirtyPositions_destruct(dirtyPositions2);
 }
 
-stPinchThread *stPinchThreadSet_addThread(stPinchThreadSet *threadSet, int64_t name, int64_t start, int64_t length) {
-    stPinchThread *thread = stPinchThread_construct(name, start, length);
-    assert(stPinchThreadSet_getThread(threadSet, name) == NULL);
-    stHash_insert(threadSet->threadsHash, thread, thread);
-    stList_append(threadSet->threads, thread);
-    return thread;
+static void stPinchPools_merge(stPinchPools *pools, stPinchPools *pools2) {
+    stPinchPool_merge(&pools->segmentPool, &pools2->segmentPool);
+    stPinchPool_merge(&pools->blockPool, &pools2->blockPool);
+    assert(pools->undoLog == NULL && pools2->undoLog == NULL);
+    assert(pools2->firstBlock == NULL && pools2->blockLog == NULL);
+    if (pools2->adjacencyComponentChanges != NULL) {
+        stPinchDirtyPositions_merge(pools->adjacencyComponentChanges, pools2->adjacencyComponentChanges);
+        pools2->adjacencyComponentChanges = NULL;
+    }
+    if (pools2->trivialBoundaryChanges != NULL) {
+        stPinchDirtyPositions_merge(pools->trivialBoundaryChanges, pools2->trivialBoundaryChanges);
+        pools2->trivialBoundaryChanges = NULL;
+    }
 }
 
-stPinchThread *stPinchThreadSet_getThread(stPinchThreadSet *threadSet, int64_t name) {
-    static stPinchThread thread;
-    thread.name = name;
-    return stHash_search(threadSet->threadsHash, &thread);
+/*
+ * Merges the workers' pools into those of the thread set, replaying their block logs in the order of their keys.
+ */
+static void mergeWorkerPools(stPinchThreadSet *threadSet, stPinchPools *workerPools, int64_t workerNumber) {
+    int64_t entryNumber = 0;
+    for (int64_t i = 0; i < workerNumber; i++) {
+        entryNumber += workerPools[i].blockLog->length;
+    }
+    stPinchBlockLogEntry *entries = st_malloc(sizeof(stPinchBlockLogEntry) * (entryNumber + 1));
+    entryNumber = 0;
+    for (int64_t i = 0; i < workerNumber; i++) {
+        stPinchBlockLog *blockLog = workerPools[i].blockLog;
+        for (int64_t j = 0; j < blockLog->length; j++) {
+            entries[entryNumber++] = blockLog->entries[j];
+        }
+        free(blockLog->entries);
+        free(blockLog);
+        workerPools[i].blockLog = NULL;
+        stPinchPools_merge(&threadSet->pools, &workerPools[i]);
+    }
+    qsort(entries, entryNumber, sizeof(stPinchBlockLogEntry), stPinchBlockLogEntry_compare);
+    stPinchPools_replayBlockLog(&threadSet->pools, entries, entryNumber);
+    free(entries);
+    free(workerPools);
 }
 
-int64_t stPinchThreadSet_getSize(stPinchThreadSet *threadSet) {
-    return stList_length(threadSet->threads);
+/*
+ * Runs parallelFn with pools for each of the OpenMP workers, merging them into the thread set's pools afterwards.
+ * The workers' pools do not log, so if a transaction is open serialFn is run instead, into the transaction.
+ */
+static void stPinchThreadSet_runWorkers(stPinchThreadSet *threadSet, void (*serialFn)(stPinchThreadSet *threadSet, void *extraArg),
+        void (*parallelFn)(stPinchThreadSet *threadSet, stPinchPools *workerPools, void *extraArg), void *extraArg) {
+    if (threadSet->pools.undoLog != NULL) {
+        serialFn(threadSet, extraArg);
+        return;
+    }
+    int64_t workerNumber = omp_get_max_threads();
+    stPinchPools *workerPools = constructWorkerPools(threadSet, workerNumber);
+    parallelFn(threadSet, workerPools, extraArg);
+    mergeWorkerPools(threadSet, workerPools, workerNumber);
 }
 
-stPinchThreadSetIt stPinchThreadSet_getIt(stPinchThreadSet *threadSet) {
-    stPinchThreadSetIt threadIt;
-    threadIt.threadSet = threadSet;
-    threadIt.index = 0;
-    return threadIt;
+typedef struct _stPinchBatch {
+    stPinch *pinches;
+    int64_t pinchNumber;
+} stPinchBatch;
+
+static void stPinchThreadSet_pinchBatchSerially(stPinchThreadSet *threadSet, void *extraArg) {
+    stPinchBatch *batch = extraArg;
+    stPinchThreadSet_pinchBatch(threadSet, batch->pinches, batch->pinchNumber);
 }
 
-stPinchThread *stPinchThreadSetIt_getNext(stPinchThreadSetIt *threadIt) {
-    if (threadIt->index < stPinchThreadSet_getSize(threadIt->threadSet)) {
-        return stList_get(threadIt->threadSet->threads, threadIt->index++);
+/*
+ * Divides the pinches into groups that involve disjoint sets of threads, accounting for the threads already joined
+ * by blocks, as a split propagates to every segment in a block. Each group is then pinched by a different worker,
+ * which allocates from its own pools, logging the blocks it allocates and frees by the index of the pinch that did
+ * so. Replaying the logs in the order of the pinches gives the blocks the ids and registry order that
+ * stPinchThreadSet_pinchBatch would have given them.
+ */
+static void stPinchThreadSet_pinchBatchInWorkers(stPinchThreadSet *threadSet, stPinchPools *workerPools, void *extraArg) {
+    stPinch *pinches = ((stPinchBatch *) extraArg)->pinches;
+    int64_t pinchNumber = ((stPinchBatch *) extraArg)->pinchNumber;
+    int64_t threadNumber = stPinchThreadSet_getSize(threadSet);
+    int64_t *components = st_malloc(sizeof(int64_t) * (threadNumber + 1));
+    int64_t *componentSizes = st_malloc(sizeof(int64_t) * (threadNumber + 1));
+    getThreadComponentsByBlocks(threadSet, components, componentSizes);
+    int64_t *pinchGroups = st_malloc(sizeof(int64_t) * (pinchNumber + 1));
+    for (int64_t i = 0; i < pinchNumber; i++) {
+        stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, pinches[i].name1);
+        stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, pinches[i].name2);
+        assert(thread1 != NULL && thread2 != NULL);
+        pinchGroups[i] = thread1->index;
+        if (pinches[i].length > 0) {
+            joinComponents(components, componentSizes, thread1->index, thread2->index);
+        }
     }
-    return NULL;
+
+    //Number the groups, and counting sort the pinches and threads by group, keeping the pinches of a group in order
+    int64_t *componentGroups = componentSizes; //Reused, as the sizes are no longer needed
+    for (int64_t i = 0; i < threadNumber; i++) {
+        componentGroups[i] = -1;
+    }
+    int64_t groupNumber = 0;
+    for (int64_t i = 0; i < pinchNumber; i++) {
+        int64_t j = getComponent(components, pinchGroups[i]);
+        if (componentGroups[j] == -1) {
+            componentGroups[j] = groupNumber++;
+        }
+        pinchGroups[i] = componentGroups[j];
+    }
+    int64_t *pinchOffsets = st_calloc(groupNumber + 1, sizeof(int64_t));
+    int64_t *threadOffsets = st_calloc(groupNumber + 1, sizeof(int64_t));
+    for (int64_t i = 0; i < pinchNumber; i++) {
+        pinchOffsets[pinchGroups[i] + 1]++;
+    }
+    for (int64_t i = 0; i < threadNumber; i++) {
+        int64_t j = componentGroups[getComponent(components, i)];
+        if (j != -1) {
+            threadOffsets[j + 1]++;
+        }
+    }
+    for (int64_t i = 0; i < groupNumber; i++) {
+        pinchOffsets[i + 1] += pinchOffsets[i];
+        threadOffsets[i + 1] += threadOffsets[i];
+    }
+    stPinch *groupedPinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+    int64_t *groupedPinchIndices = st_malloc(sizeof(int64_t) * (pinchNumber + 1));
+    stPinchThread **groupedThreads = st_malloc(sizeof(stPinchThread *) * (threadOffsets[groupNumber] + 1));
+    int64_t *groupSizes = st_malloc(sizeof(int64_t) * (groupNumber + 1));
+    for (int64_t i = 0; i < groupNumber; i++) {
+        groupSizes[i] = 0;
+    }
+    for (int64_t i = 0; i < pinchNumber; i++) {
+        int64_t j = pinchGroups[i], k = pinchOffsets[j] + groupSizes[j]++;
+        groupedPinches[k] = pinches[i];
+        groupedPinchIndices[k] = i;
+    }
+    for (int64_t i = 0; i < groupNumber; i++) {
+        groupSizes[i] = 0;
+    }
+    for (int64_t i = 0; i < threadNumber; i++) {
+        int64_t j = componentGroups[getComponent(components, i)];
+        if (j != -1) {
+            groupedThreads[threadOffsets[j] + groupSizes[j]++] = stList_get(threadSet->threads, i);
+        }
+    }
+
+    //Start the largest groups first, to balance the load
+    stPinchGroup *groupOrder = st_malloc(sizeof(stPinchGroup) * (groupNumber + 1));
+    for (int64_t i = 0; i < groupNumber; i++) {
+        groupOrder[i].size = pinchOffsets[i + 1] - pinchOffsets[i];
+        groupOrder[i].index = i;
+    }
+    qsort(groupOrder, groupNumber, sizeof(stPinchGroup), stPinchGroup_compareByDecreasingSize);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = 0; i < groupNumber; i++) {
+        int64_t j = groupOrder[i].index;
+        stPinchPools *pools = &workerPools[omp_get_thread_num()];
+        for (int64_t k = threadOffsets[j]; k < threadOffsets[j + 1]; k++) {
+            groupedThreads[k]->pools = pools;
+        }
+        stPinchThreadSet_pinchBatchP(threadSet, groupedPinches + pinchOffsets[j], groupedPinchIndices + pinchOffsets[j],
+                pinchOffsets[j + 1] - pinchOffsets[j], 0);
+        for (int64_t k = threadOffsets[j]; k < threadOffsets[j + 1]; k++) {
+            groupedThreads[k]->pools = &threadSet->pools;
+        }
+    }
+
+    //Cleanup
+    free(groupOrder);
+    free(groupSizes);
+    free(groupedThreads);
+    free(groupedPinchIndices);
+    free(groupedPinches);
+    free(threadOffsets);
+    free(pinchOffsets);
+    free(pinchGroups);
+    free(componentSizes);
+    free(components);
 }
 
-void stPinchThreadSet_joinTrivialBoundaries(stPinchThreadSet *threadSet) {
-    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
-    stPinchThread *thread;
-    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
-        stPinchThread_joinTrivialBoundaries(thread);
+void stPinchThreadSet_pinchBatchParallel(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber) {
+    stPinchBatch batch = { pinches, pinchNumber };
+    stPinchThreadSet_runWorkers(threadSet, stPinchThreadSet_pinchBatchSerially, stPinchThreadSet_pinchBatchInWorkers, &batch);
+}
+
+static void stPinchThreadSet_joinTrivialBoundariesSerially(stPinchThreadSet *threadSet, void *extraArg) {
+    stPinchThreadSet_joinTrivialBoundaries(threadSet);
+}
+
+/*
+ * Joins boundaries within each group of threads joined by blocks in parallel, as joining a boundary changes only the
+ * threads of the blocks either side of it. Within a group the blocks are visited in registry order, as they are by
+ * stPinchThreadSet_joinTrivialBoundaries, so the result is the same.
+ */
+static void stPinchThreadSet_joinTrivialBoundariesInWorkers(stPinchThreadSet *threadSet, stPinchPools *workerPools, void *extraArg) {
+    int64_t threadNumber = stPinchThreadSet_getSize(threadSet);
+    int64_t *components = st_malloc(sizeof(int64_t) * (threadNumber + 1));
+    int64_t *componentSizes = st_malloc(sizeof(int64_t) * (threadNumber + 1));
+    getThreadComponentsByBlocks(threadSet, components, componentSizes);
+
+    //Number the groups, and counting sort the threads and blocks by group, keeping the blocks in registry order
+    int64_t *threadGroups = componentSizes; //Reused, as the sizes are no longer needed
+    for (int64_t i = 0; i < threadNumber; i++) {
+        threadGroups[i] = -1;
+    }
+    int64_t groupNumber = 0;
+    for (int64_t i = 0; i < threadNumber; i++) {
+        int64_t j = getComponent(components, i);
+        if (threadGroups[j] == -1) {
+            threadGroups[j] = groupNumber++;
+        }
+    }
+    for (int64_t i = 0; i < threadNumber; i++) {
+        threadGroups[i] = threadGroups[getComponent(components, i)];
+    }
+    int64_t blockNumber = stPinchThreadSet_getTotalBlockNumber(threadSet);
+    int64_t *threadOffsets = st_calloc(groupNumber + 1, sizeof(int64_t));
+    int64_t *blockOffsets = st_calloc(groupNumber + 1, sizeof(int64_t));
+    for (int64_t i = 0; i < threadNumber; i++) {
+        threadOffsets[threadGroups[i] + 1]++;
     }
     stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
     stPinchBlock *block;
-    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt))) {
-        stPinchEnd end = stPinchEnd_constructStatic(block, 0);
-        if (stPinchEnd_boundaryIsTrivial(end)) {
-            stPinchEnd_joinTrivialBoundary(end);
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        blockOffsets[threadGroups[block->headSegment->thread->index] + 1]++;
+    }
+    for (int64_t i = 0; i < groupNumber; i++) {
+        threadOffsets[i + 1] += threadOffsets[i];
+        blockOffsets[i + 1] += blockOffsets[i];
+    }
+    stPinchThread **groupedThreads = st_malloc(sizeof(stPinchThread *) * (threadNumber + 1));
+    stPinchBlock **groupedBlocks = st_malloc(sizeof(stPinchBlock *) * (blockNumber + 1));
+    int64_t *groupedBlockIndices = st_malloc(sizeof(int64_t) * (blockNumber + 1)); //The positions of the blocks in the registry
+    int64_t *groupSizes = st_calloc(groupNumber + 1, sizeof(int64_t));
+    for (int64_t i = 0; i < threadNumber; i++) {
+        int64_t j = threadGroups[i];
+        groupedThreads[threadOffsets[j] + groupSizes[j]++] = stList_get(threadSet->threads, i);
+    }
+    for (int64_t i = 0; i < groupNumber; i++) {
+        groupSizes[i] = 0;
+    }
+    blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    for (int64_t i = 0; (block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL; i++) {
+        int64_t j = threadGroups[block->headSegment->thread->index], k = blockOffsets[j] + groupSizes[j]++;
+        groupedBlocks[k] = block;
+        groupedBlockIndices[k] = i;
+    }
+
+    //Start the groups with the most blocks first, to balance the load
+    stPinchGroup *groupOrder = st_malloc(sizeof(stPinchGroup) * (groupNumber + 1));
+    for (int64_t i = 0; i < groupNumber; i++) {
+        groupOrder[i].size = blockOffsets[i + 1] - blockOffsets[i];
+        groupOrder[i].index = i;
+    }
+    qsort(groupOrder, groupNumber, sizeof(stPinchGroup), stPinchGroup_compareByDecreasingSize);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = 0; i < groupNumber; i++) {
+        int64_t j = groupOrder[i].index;
+        stPinchPools *pools = &workerPools[omp_get_thread_num()];
+        for (int64_t k = threadOffsets[j]; k < threadOffsets[j + 1]; k++) {
+            groupedThreads[k]->pools = pools;
+            stPinchThread_joinTrivialBoundaries(groupedThreads[k]);
+        }
+        for (int64_t k = blockOffsets[j]; k < blockOffsets[j + 1]; k++) {
+            stPinchBlock *block = groupedBlocks[k];
+            pools->blockLog->key = groupedBlockIndices[k]; //The blocks freed are freed in the order of the serial join
+            for (int64_t orientation = 0; orientation < 2 && block->degree > 0; orientation++) { //Skip blocks already joined
+                stPinchEnd end = stPinchEnd_constructStatic(block, orientation);
+                while (stPinchEnd_boundaryIsTrivial(end)) {
+                    stPinchEnd_joinTrivialBoundaryP(end);
+                }
+            }
         }
-        end.orientation = 1;
-        if (stPinchEnd_boundaryIsTrivial(end)) {
-            stPinchEnd_joinTrivialBoundary(end);
+        for (int64_t k = threadOffsets[j]; k < threadOffsets[j + 1]; k++) {
+            groupedThreads[k]->pools = &threadSet->pools;
         }
     }
+
+    //Cleanup
+    free(groupOrder);
+    free(groupSizes);
+    free(groupedBlockIndices);
+    free(groupedBlocks);
+    free(groupedThreads);
+    free(blockOffsets);
+    free(threadOffsets);
+    free(componentSizes);
+    free(components);
 }
 
-stPinchSegment *stPinchThreadSet_getSegment(stPinchThreadSet *threadSet, int64_t name, int64_t coordinate) {
-    stPinchThread *thread = stPinchThreadSet_getThread(threadSet, name);
-    if (thread == NULL) {
-        return NULL;
+void stPinchThreadSet_joinTrivialBoundariesParallel(stPinchThreadSet *threadSet) {
+    stPinchDirtyPositions *changes = threadSet->pools.trivialBoundaryChanges;
+    if (changes != NULL && !changes->all) { //Joining around the changes is quick anyway
+        stPinchThreadSet_joinTrivialBoundaries(threadSet);
+        return;
     }
-    return stPinchThread_getSegment(thread, coordinate);
+    threadSet->pools.trivialBoundaryChanges = NULL; //Joining makes no trivial boundaries, so its changes are not recorded
+    stPinchThreadSet_runWorkers(threadSet, stPinchThreadSet_joinTrivialBoundariesSerially, stPinchThreadSet_joinTrivialBoundariesInWorkers, NULL);
+    if (changes != NULL) {
+        stPinchDirtyPositions_clear(changes, 0);
+        threadSet->pools.trivialBoundaryChanges = changes;
+    }
+}
+
+static void stPinchThreadSet_trimAllBlocksSerially(stPinchThreadSet *threadSet, void *extraArg) {
+    stPinchThreadSet_trimAllBlocks(threadSet, *(int64_t *) extraArg);
+}
+
+/*
+ * Trimming a block splits each of its segments at the same offsets, whatever their orientations, so the splits are
+ * made thread by thread, concurrently, leaving the middle parts of the trimmed blocks' segments outside the blocks.
+ * Each block is then moved onto the middle parts of its segments or destructed, again concurrently, the blocks
+ * destructed being logged by their positions in the registry, the order stPinchThreadSet_trimAllBlocks destructs them in.
+ */
+static void stPinchThreadSet_trimAllBlocksInWorkers(stPinchThreadSet *threadSet, stPinchPools *workerPools, void *extraArg) {
+    int64_t blockEndTrim = *(int64_t *) extraArg;
+    int64_t blockNumber = stPinchThreadSet_getTotalBlockNumber(threadSet);
+    stPinchBlock **blocks = st_malloc(sizeof(stPinchBlock *) * (blockNumber + 1));
+    bool *trimmed = st_malloc(sizeof(bool) * (blockNumber + 1));
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    for (int64_t i = 0; i < blockNumber; i++) {
+        blocks[i] = stPinchThreadSetBlockIt_getNext(&blockIt);
+        trimmed[i] = stPinchBlock_getLength(blocks[i]) > 2 * blockEndTrim;
+    }
+    int64_t threadNumber = stPinchThreadSet_getSize(threadSet);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = 0; i < threadNumber; i++) {
+        stPinchThread *thread = stList_get(threadSet->threads, i);
+        thread->pools = &workerPools[omp_get_thread_num()];
+        stPinchSegment *segment = stPinchThread_getFirst(thread);
+        while (segment != NULL) {
+            if (stPinchSegment_getBlock(segment) != NULL) {
+                stPinchPools_recordChange(thread->pools, thread, segment->start); //The segment leaves its block
+                int64_t length = stPinchSegment_getLength(segment);
+                if (length > 2 * blockEndTrim) {
+                    segment = stPinchSegment_splitP(stPinchSegment_splitP(segment, blockEndTrim), length - 2 * blockEndTrim);
+                }
+            }
+            segment = stPinchSegment_get3Prime(segment);
+        }
+        thread->pools = &threadSet->pools;
+    }
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int64_t i = 0; i < blockNumber; i++) {
+        stPinchPools *pools = &workerPools[omp_get_thread_num()];
+        stPinchBlock *block = blocks[i];
+        pools->blockLog->key = i;
+        if (trimmed[i]) {
+            stPinchBlock_moveToMiddleSegments(pools, block);
+            continue;
+        }
+        stPinchThread *thread = block->headSegment->thread;
+        bool threadsJoined = 0;
+        stPinchSegment *segment = block->headSegment;
+        while (segment != NULL) {
+            stPinchSegment *nBlockSegment = stPinchSegment_fromLink(segment->nBlockSegment);
+            threadsJoined = threadsJoined || segment->thread != thread;
+            stPinchPools_set(pools, segment->block, 0);
+            stPinchPools_set(pools, segment->pBlockSegment, 0);
+            stPinchPools_set(pools, segment->nBlockSegment, 0);
+            segment = nBlockSegment;
+        }
+        if (threadsJoined) {
+            stPinchPools_updateThreadComponentNumber(pools, 0, 1);
+        }
+        stPinchPools_freeBlock(pools, block);
+    }
+    free(trimmed);
+    free(blocks);
+}
+
+void stPinchThreadSet_trimAllBlocksParallel(stPinchThreadSet *threadSet, int64_t blockEndTrim) {
+    if (blockEndTrim > 0) {
+        stPinchThreadSet_runWorkers(threadSet, stPinchThreadSet_trimAllBlocksSerially, stPinchThreadSet_trimAllBlocksInWorkers, &blockEndTrim);
+    }
+}
+
+#else
+
+void stPinchThreadSet_pinchBatchParallel(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber) {
+    stPinchThreadSet_pinchBatch(threadSet, pinches, pinchNumber); //Built without OpenMP, so there is nothing to be gained
+}
+
+void stPinchThreadSet_joinTrivialBoundariesParallel(stPinchThreadSet *threadSet) {
+    stPinchThreadSet_joinTrivialBoundaries(threadSet);
+}
+
+void stPinchThreadSet_trimAllBlocksParallel(stPinchThreadSet *threadSet, int64_t blockEndTrim) {
+    stPinchThreadSet_trimAllBlocks(threadSet, blockEndTrim);
 }
 
+#endif
+
 //convenience functions
 
 stPinchThreadSetSegmentIt stPinchThreadSet_getSegmentIt(stPinchThreadSet *threadSet) {
@@ -654,37 +2797,35 @@ stPinchSegment *stPinchThreadSetSegmentIt_getNext(stPinchThreadSetSegmentIt *seg
 
 stPinchThreadSetBlockIt stPinchThreadSet_getBlockIt(stPinchThreadSet *threadSet) {
     stPinchThreadSetBlockIt blockIt;
-    blockIt.segmentIt = stPinchThreadSet_getSegmentIt(threadSet);
+    blockIt.block = threadSet->pools.firstBlock;
     return blockIt;
 }
 
 stPinchBlock *stPinchThreadSetBlockIt_getNext(stPinchThreadSetBlockIt *blockIt) {
-    while (1) {
-        stPinchSegment *segment = stPinchThreadSetSegmentIt_getNext(&(blockIt->segmentIt));
-        if (segment == NULL) {
-            return NULL;
-        }
-        stPinchBlock *block;
-        if ((block = stPinchSegment_getBlock(segment)) != NULL && stPinchBlock_getFirst(block) == segment) {
-            return block;
-        }
+    stPinchBlock *block = blockIt->block;
+    if (block != NULL) {
+        blockIt->block = block->nBlock;
     }
-    return NULL;
+    return block;
 }
 
 int64_t stPinchThreadSet_getTotalBlockNumber(stPinchThreadSet *threadSet) {
-    int64_t blockCount = 0;
-    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
-    while (stPinchThreadSetBlockIt_getNext(&blockIt) != NULL) {
-        blockCount++;
-    }
-    return blockCount;
+    return threadSet->pools.blockNumber;
+}
+
+int64_t stPinchThreadSet_getBlockIdBound(stPinchThreadSet *threadSet) {
+    return threadSet->blockIdBound;
 }
 
-void stPinchThreadSet_getAdjacencyComponentsP2(stHash *endsToAdjacencyComponents, stList *adjacencyComponent, stPinchEnd *end) {
+/*
+ * The end ids to components array duplicates the hash, so that testing if an end has been visited is an array lookup.
+ */
+void stPinchThreadSet_getAdjacencyComponentsP2(stHash *endsToAdjacencyComponents, stList **endIdsToAdjacencyComponents,
+        stList *adjacencyComponent, stPinchEnd *end) {
     stList *stack = stList_construct();
     stList_append(adjacencyComponent, end);
     stHash_insert(endsToAdjacencyComponents, end, adjacencyComponent);
+    endIdsToAdjacencyComponents[stPinchEnd_getId(end)] = adjacencyComponent;
     stList_append(stack, end);
     while (stList_length(stack) > 0) {
         end = stList_pop(stack);
@@ -700,85 +2841,323 @@ void stPinchThreadSet_getAdjacencyComponentsP2(stHash *endsToAdjacencyComponents
                 stPinchBlock *block = stPinchSegment_getBlock(segment);
                 if (block != NULL) {
                     stPinchEnd end2 = stPinchEnd_constructStatic(block, stPinchEnd_endOrientation(_5PrimeTraversal, segment));
-                    if (stHash_search(endsToAdjacencyComponents, &end2) == NULL) {
+                    if (endIdsToAdjacencyComponents[stPinchEnd_getId(&end2)] == NULL) {
                         stPinchEnd *end3 = stPinchEnd_construct(end2.block, end2.orientation);
                         stList_append(adjacencyComponent, end3);
                         stHash_insert(endsToAdjacencyComponents, end3, adjacencyComponent);
+                        endIdsToAdjacencyComponents[stPinchEnd_getId(end3)] = adjacencyComponent;
                         stList_append(stack, end3);
                     }
-                    break;
+                    break;
+                }
+            }
+        }
+    }
+    stList_destruct(stack);
+}
+
+void stPinchThreadSet_getAdjacencyComponentsP(stHash *endsToAdjacencyComponents, stList **endIdsToAdjacencyComponents,
+        stList *adjacencyComponents, stPinchBlock *block, bool orientation) {
+    if (endIdsToAdjacencyComponents[2 * block->id + orientation] == NULL) {
+        stList *adjacencyComponent = stList_construct3(0, (void(*)(void *)) stPinchEnd_destruct);
+        stList_append(adjacencyComponents, adjacencyComponent);
+        stPinchThreadSet_getAdjacencyComponentsP2(endsToAdjacencyComponents, endIdsToAdjacencyComponents, adjacencyComponent,
+                stPinchEnd_construct(block, orientation));
+    }
+}
+
+void stPinchThreadSet_setAdjacencyComponentTracking(stPinchThreadSet *threadSet, bool track) {
+    if (track && threadSet->pools.adjacencyComponentChanges == NULL) {
+        threadSet->pools.adjacencyComponentChanges = stPinchDirtyPositions_construct(1);
+    } else if (!track && threadSet->pools.adjacencyComponentChanges != NULL) {
+        stPinchDirtyPositions_destruct(threadSet->pools.adjacencyComponentChanges);
+        threadSet->pools.adjacencyComponentChanges = NULL;
+    }
+}
+
+static stPinchSegment *getNextAlignedSegment(stPinchSegment *segment, bool _5PrimeTraversal) {
+    do {
+        segment = _5PrimeTraversal ? stPinchSegment_get5Prime(segment) : stPinchSegment_get3Prime(segment);
+    } while (segment != NULL && stPinchSegment_getBlock(segment) == NULL);
+    return segment;
+}
+
+/*
+ * Gives a fresh label to the adjacency component of the end, unless it has already been relabelled in this repair.
+ */
+static void relabelAdjacencyComponent(stPinchThreadSet *threadSet, int64_t firstLabel, stList *stack, stPinchBlock *block,
+        bool orientation) {
+    if (block->adjacencyComponentLabels[orientation] >= firstLabel) {
+        return;
+    }
+    int64_t label = threadSet->nextAdjacencyComponentLabel++;
+    block->adjacencyComponentLabels[orientation] = label;
+    stList_append(stack, block);
+    stList_append(stack, (void *) (intptr_t) orientation);
+    while (stList_length(stack) > 0) {
+        orientation = (intptr_t) stList_pop(stack);
+        block = stList_pop(stack);
+        for (stPinchSegment *segment = block->headSegment; segment != NULL; segment = stPinchSegment_fromLink(segment->nBlockSegment)) {
+            bool _5PrimeTraversal = stPinchEnd_traverse5Prime(orientation, segment);
+            stPinchSegment *segment2 = getNextAlignedSegment(segment, _5PrimeTraversal);
+            if (segment2 != NULL) {
+                stPinchBlock *block2 = stPinchSegment_getBlock(segment2);
+                bool orientation2 = stPinchEnd_endOrientation(_5PrimeTraversal, segment2);
+                if (block2->adjacencyComponentLabels[orientation2] < firstLabel) {
+                    block2->adjacencyComponentLabels[orientation2] = label;
+                    stList_append(stack, block2);
+                    stList_append(stack, (void *) (intptr_t) orientation2);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Relabels the adjacency components containing the ends next to the positions where block membership changed. Every
+ * end whose adjacencies changed is in such a component, so the components left alone are still exact. Called holding
+ * the query mutex, it publishes the repair by clearing the positions with release stores, see
+ * stPinchThreadSet_getAdjacencyComponentLabel.
+ */
+static void stPinchThreadSet_repairAdjacencyComponents(stPinchThreadSet *threadSet) {
+    stPinchDirtyPositions *dirtyPositions = threadSet->pools.adjacencyComponentChanges;
+    assert(dirtyPositions != NULL);
+    int64_t firstLabel = threadSet->nextAdjacencyComponentLabel;
+    stList *stack = stList_construct();
+    if (dirtyPositions->all) {
+        stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+        stPinchBlock *block;
+        while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+            relabelAdjacencyComponent(threadSet, firstLabel, stack, block, 0);
+            relabelAdjacencyComponent(threadSet, firstLabel, stack, block, 1);
+        }
+    } else {
+        for (int64_t i = 0; i < dirtyPositions->length; i++) {
+            stPinchSegment *segment = stPinchThreadSet_getSegment(threadSet, dirtyPositions->positions[2 * i],
+                    dirtyPositions->positions[2 * i + 1]);
+            if (segment == NULL) {
+                continue;
+            }
+            stPinchBlock *block = stPinchSegment_getBlock(segment);
+            if (block != NULL) {
+                relabelAdjacencyComponent(threadSet, firstLabel, stack, block, 0);
+                relabelAdjacencyComponent(threadSet, firstLabel, stack, block, 1);
+            } else { //The segment is unaligned, so repair the ends either side of it, which may have been joined
+                for (int64_t j = 0; j < 2; j++) {
+                    stPinchSegment *segment2 = getNextAlignedSegment(segment, j);
+                    if (segment2 != NULL) {
+                        relabelAdjacencyComponent(threadSet, firstLabel, stack, stPinchSegment_getBlock(segment2),
+                                stPinchEnd_endOrientation(j, segment2));
+                    }
                 }
             }
         }
     }
     stList_destruct(stack);
+    __atomic_store_n(&dirtyPositions->all, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&dirtyPositions->length, 0, __ATOMIC_RELEASE);
 }
 
-void stPinchThreadSet_getAdjacencyComponentsP(stHash *endsToAdjacencyComponents, stList *adjacencyComponents, stPinchBlock *block,
-        bool orientation) {
-    stPinchEnd end = stPinchEnd_constructStatic(block, orientation);
-    stList *adjacencyComponent = stHash_search(endsToAdjacencyComponents, &end);
-    if (adjacencyComponent == NULL) {
-        adjacencyComponent = stList_construct3(0, (void(*)(void *)) stPinchEnd_destruct);
-        stList_append(adjacencyComponents, adjacencyComponent);
-        stPinchThreadSet_getAdjacencyComponentsP2(endsToAdjacencyComponents, adjacencyComponent, stPinchEnd_construct(block, orientation));
+int64_t stPinchThreadSet_getAdjacencyComponentLabel(stPinchThreadSet *threadSet, stPinchEnd *end) {
+    stPinchDirtyPositions *dirtyPositions = threadSet->pools.adjacencyComponentChanges;
+    if (dirtyPositions == NULL) {
+        st_errAbort("Adjacency components are not being tracked for the thread set\n");
     }
+    //Queries may run concurrently, so only one repairs the labels, and the others wait for it
+    if (__atomic_load_n(&dirtyPositions->all, __ATOMIC_ACQUIRE) || __atomic_load_n(&dirtyPositions->length, __ATOMIC_ACQUIRE) > 0) {
+        pthread_mutex_lock(&threadSet->queryMutex);
+        if (dirtyPositions->all || dirtyPositions->length > 0) {
+            stPinchThreadSet_repairAdjacencyComponents(threadSet);
+        }
+        pthread_mutex_unlock(&threadSet->queryMutex);
+    }
+    return end->block->adjacencyComponentLabels[end->orientation];
 }
 
-stList *stPinchThreadSet_getAdjacencyComponents2(stPinchThreadSet *threadSet, stHash **endsToAdjacencyComponents) {
-    *endsToAdjacencyComponents = stHash_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, NULL, NULL);
+/*
+ * Gets the adjacency components from the tracked labels. The components are ordered by their first ends, and the ends
+ * within them ordered, as the blocks are by stPinchThreadSet_getBlockIt, the 0 end of a block before its 1 end.
+ */
+static stList *stPinchThreadSet_getTrackedAdjacencyComponents(stPinchThreadSet *threadSet, stHash *endsToAdjacencyComponents) {
     stList *adjacencyComponents = stList_construct3(0, (void(*)(void *)) stList_destruct);
+    stHash *labelsToAdjacencyComponents = stHash_construct();
     stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
     stPinchBlock *block;
     while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
-        stPinchThreadSet_getAdjacencyComponentsP(*endsToAdjacencyComponents, adjacencyComponents, block, 0);
-        stPinchThreadSet_getAdjacencyComponentsP(*endsToAdjacencyComponents, adjacencyComponents, block, 1);
+        for (int64_t orientation = 0; orientation < 2; orientation++) {
+            stPinchEnd *end = stPinchEnd_construct(block, orientation);
+            void *label = (void *) (intptr_t) stPinchThreadSet_getAdjacencyComponentLabel(threadSet, end);
+            assert(label != NULL);
+            stList *adjacencyComponent = stHash_search(labelsToAdjacencyComponents, label);
+            if (adjacencyComponent == NULL) {
+                adjacencyComponent = stList_construct3(0, (void(*)(void *)) stPinchEnd_destruct);
+                stList_append(adjacencyComponents, adjacencyComponent);
+                stHash_insert(labelsToAdjacencyComponents, label, adjacencyComponent);
+            }
+            stList_append(adjacencyComponent, end);
+            stHash_insert(endsToAdjacencyComponents, end, adjacencyComponent);
+        }
     }
+    stHash_destruct(labelsToAdjacencyComponents);
     return adjacencyComponents;
 }
 
-stList *stPinchThreadSet_getAdjacencyComponents(stPinchThreadSet *threadSet) {
-    stHash *endsToAdjacencyComponents;
-    stList *adjacencyComponents = stPinchThreadSet_getAdjacencyComponents2(threadSet, &endsToAdjacencyComponents);
-    stHash_destruct(endsToAdjacencyComponents);
+stList *stPinchThreadSet_getAdjacencyComponents2(stPinchThreadSet *threadSet, stHash **endsToAdjacencyComponents) {
+    *endsToAdjacencyComponents = stHash_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, NULL, NULL);
+    if (threadSet->pools.adjacencyComponentChanges != NULL) {
+        return stPinchThreadSet_getTrackedAdjacencyComponents(threadSet, *endsToAdjacencyComponents);
+    }
+    stList *adjacencyComponents = stList_construct3(0, (void(*)(void *)) stList_destruct);
+    stList **endIdsToAdjacencyComponents = st_calloc(2 * stPinchThreadSet_getBlockIdBound(threadSet) + 1, sizeof(stList *));
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        stPinchThreadSet_getAdjacencyComponentsP(*endsToAdjacencyComponents, endIdsToAdjacencyComponents, adjacencyComponents, block, 0);
+        stPinchThreadSet_getAdjacencyComponentsP(*endsToAdjacencyComponents, endIdsToAdjacencyComponents, adjacencyComponents, block, 1);
+    }
+    free(endIdsToAdjacencyComponents);
     return adjacencyComponents;
 }
 
-stSortedSet *stPinchThreadSet_getThreadComponents(stPinchThreadSet *threadSet) {
-    stUnionFind *components = stUnionFind_construct();
-    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
-    stPinchThread *thread;
+/*
+ * Concurrent union-find over indices, for use by many threads at once. The root of a set is always its smallest
+ * member, as sets are joined by pointing the larger root at the smaller, so the result does not depend on the order
+ * of the unions.
+ */
+static int64_t getComponentConcurrent(int64_t *components, int64_t i) {
+    int64_t j;
+    while ((j = __atomic_load_n(&components[i], __ATOMIC_RELAXED)) != i) {
+        int64_t k = __atomic_load_n(&components[j], __ATOMIC_RELAXED);
+        if (k != j) { //Path halving, which is harmless if it loses a race
+            __atomic_compare_exchange_n(&components[i], &j, k, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        i = k;
+    }
+    return i;
+}
 
-    //Make a component for each thread.
-    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
-        stUnionFind_add(components, thread);
+static void joinComponentsConcurrent(int64_t *components, int64_t i, int64_t j) {
+    while (1) {
+        i = getComponentConcurrent(components, i);
+        j = getComponentConcurrent(components, j);
+        if (i == j) {
+            return;
+        }
+        if (i < j) {
+            int64_t k = i;
+            i = j;
+            j = k;
+        }
+        int64_t expected = i;
+        if (__atomic_compare_exchange_n(&components[i], &expected, j, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return;
+        }
     }
+}
 
-    //Now join components progressively according to blocks
+stList *stPinchThreadSet_getAdjacencyComponentsParallel(stPinchThreadSet *threadSet, stHash **endsToAdjacencyComponents) {
+    //Number the blocks in the order of the block iterator, the ends of block i being 2i and 2i + 1
+    stList *blocks = stList_construct();
+    int64_t *blockIdsToIndices = st_malloc(sizeof(int64_t) * (stPinchThreadSet_getBlockIdBound(threadSet) + 1));
     stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
     stPinchBlock *block;
     while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
-        stPinchBlockIt segmentIt = stPinchBlock_getSegmentIterator(block);
-        stPinchSegment *segment = stPinchBlockIt_getNext(&segmentIt);
-        assert(segment != NULL);
-        stPinchThread *firstThread = stPinchSegment_getThread(segment);
-        while ((segment = stPinchBlockIt_getNext(&segmentIt)) != NULL) {
-            stUnionFind_union(components, firstThread, stPinchSegment_getThread(segment));
+        blockIdsToIndices[block->id] = stList_length(blocks);
+        stList_append(blocks, block);
+    }
+    int64_t endNumber = 2 * stList_length(blocks);
+    int64_t *components = st_malloc(sizeof(int64_t) * (endNumber + 1));
+    for (int64_t i = 0; i < endNumber; i++) {
+        components[i] = i;
+    }
+
+    //Join the ends of consecutive aligned segments along each thread
+    int64_t threadNumber = stList_length(threadSet->threads);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int64_t i = 0; i < threadNumber; i++) {
+        stPinchThread *thread = stList_get(threadSet->threads, i);
+        stPinchSegment *pSegment = NULL;
+        int64_t pBlockIndex = 0;
+        for (stPinchSegment *segment = stPinchThread_getFirst(thread); segment != NULL; segment = stPinchSegment_get3Prime(segment)) {
+            stPinchBlock *block = stPinchSegment_getBlock(segment);
+            if (block == NULL) {
+                continue;
+            }
+            int64_t blockIndex = blockIdsToIndices[block->id];
+            if (pSegment != NULL) {
+                joinComponentsConcurrent(components, 2 * pBlockIndex + stPinchEnd_endOrientation(1, pSegment),
+                        2 * blockIndex + stPinchEnd_endOrientation(0, segment));
+            }
+            pSegment = segment;
+            pBlockIndex = blockIndex;
         }
     }
 
-    //Get a list of the components
-    stSortedSet *threadComponentsSet = stSortedSet_construct2((void(*)(void *)) stList_destruct);
-    stUnionFindIt *componentsIt = stUnionFind_getIterator(components);
-    stSet *component;
-    while ((component = stUnionFindIt_getNext(componentsIt)) != NULL) {
-        stList *componentList = stSet_getList(component);
-        stSortedSet_insert(threadComponentsSet, componentList);
+    //Collect the components, in order of their first ends
+    *endsToAdjacencyComponents = stHash_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, NULL, NULL);
+    stList *adjacencyComponents = stList_construct3(0, (void(*)(void *)) stList_destruct);
+    stList **rootsToAdjacencyComponents = st_malloc(sizeof(stList *) * (endNumber + 1));
+    for (int64_t i = 0; i < endNumber; i++) {
+        int64_t j = getComponentConcurrent(components, i);
+        if (j == i) {
+            rootsToAdjacencyComponents[i] = stList_construct3(0, (void(*)(void *)) stPinchEnd_destruct);
+            stList_append(adjacencyComponents, rootsToAdjacencyComponents[i]);
+        }
+        stList *adjacencyComponent = rootsToAdjacencyComponents[j];
+        stPinchEnd *end = stPinchEnd_construct(stList_get(blocks, i / 2), i % 2);
+        stList_append(adjacencyComponent, end);
+        stHash_insert(*endsToAdjacencyComponents, end, adjacencyComponent);
     }
 
     //Cleanup
-    stUnionFind_destructIterator(componentsIt);
-    stUnionFind_destruct(components);
+    free(rootsToAdjacencyComponents);
+    free(components);
+    free(blockIdsToIndices);
+    stList_destruct(blocks);
+    return adjacencyComponents;
+}
+
+stList *stPinchThreadSet_getAdjacencyComponents(stPinchThreadSet *threadSet) {
+    stHash *endsToAdjacencyComponents;
+    stList *adjacencyComponents = stPinchThreadSet_getAdjacencyComponents2(threadSet, &endsToAdjacencyComponents);
+    stHash_destruct(endsToAdjacencyComponents);
+    return adjacencyComponents;
+}
+
+int64_t stPinchThreadSet_getThreadComponentNumber(stPinchThreadSet *threadSet) {
+    stPinchThreadSet_updateThreadComponents(threadSet);
+    return threadSet->threadComponentNumber;
+}
+
+int64_t stPinchThreadSet_getThreadComponentLabel(stPinchThreadSet *threadSet, stPinchThread *thread) {
+    stPinchThreadSet_updateThreadComponents(threadSet);
+    return stPinchThread_getComponentP(thread)->name;
+}
+
+bool stPinchThreadSet_threadsAreInSameComponent(stPinchThreadSet *threadSet, stPinchThread *thread1, stPinchThread *thread2) {
+    stPinchThreadSet_updateThreadComponents(threadSet);
+    return stPinchThread_getComponentP(thread1) == stPinchThread_getComponentP(thread2);
+}
+
+stSortedSet *stPinchThreadSet_getThreadComponents(stPinchThreadSet *threadSet) {
+    stPinchThreadSet_updateThreadComponents(threadSet);
+    //Make a list for each component, indexed by the index of the component's root thread
+    int64_t threadNumber = stPinchThreadSet_getSize(threadSet);
+    stList **componentLists = st_calloc(threadNumber + 1, sizeof(stList *));
+    stSortedSet *threadComponentsSet = stSortedSet_construct2((void(*)(void *)) stList_destruct);
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        int64_t i = stPinchThread_getComponentP(thread)->index;
+        if (componentLists[i] == NULL) {
+            componentLists[i] = stList_construct();
+            stSortedSet_insert(threadComponentsSet, componentLists[i]);
+        }
+        stList_append(componentLists[i], thread);
+    }
+    free(componentLists);
     return threadComponentsSet;
 }
 
@@ -815,6 +3194,10 @@ bool stPinchEnd_getOrientation(stPinchEnd *end) {
     return end->orientation;
 }
 
+int64_t stPinchEnd_getId(stPinchEnd *end) {
+    return 2 * end->block->id + end->orientation;
+}
+
 int stPinchEnd_equalsFn(const void *a, const void *b) {
     const stPinchEnd *end1 = a, *end2 = b;
     return end1->block == end2->block && end1->orientation == end2->orientation;
@@ -858,8 +3241,52 @@ bool stPinchEnd_boundaryIsTrivial(stPinchEnd end) {
     return 1;
 }
 
-stSet *stPinchEnd_getConnectedPinchEnds(stPinchEnd *end) {
-    stSet *l = stSet_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, (void (*)(void *))stPinchEnd_destruct);
+/*
+ * A set of end ids, used to visit each connected end once. It is open addressed, in an array on the stack unless the
+ * block has too many segments for it, so that the neighbourhood queries need not allocate.
+ */
+#define ST_PINCH_END_ID_SET_INLINE_SIZE 64
+
+typedef struct _stPinchEndIdSet {
+    int64_t *ids; //-1 marks an empty slot
+    uint64_t mask;
+    int64_t inlineIds[ST_PINCH_END_ID_SET_INLINE_SIZE];
+} stPinchEndIdSet;
+
+static void stPinchEndIdSet_init(stPinchEndIdSet *set, int64_t maxSize) {
+    uint64_t size = ST_PINCH_END_ID_SET_INLINE_SIZE;
+    while (size < 2 * (uint64_t) maxSize) { //At most half full
+        size *= 2;
+    }
+    set->ids = size == ST_PINCH_END_ID_SET_INLINE_SIZE ? set->inlineIds : st_malloc(sizeof(int64_t) * size);
+    set->mask = size - 1;
+    memset(set->ids, 0xff, sizeof(int64_t) * size);
+}
+
+static void stPinchEndIdSet_destruct(stPinchEndIdSet *set) {
+    if (set->ids != set->inlineIds) {
+        free(set->ids);
+    }
+}
+
+/*
+ * Adds the id, returning true if it was not already present.
+ */
+static inline bool stPinchEndIdSet_add(stPinchEndIdSet *set, int64_t id) {
+    for (uint64_t i = (((uint64_t) id * 0x9E3779B97F4A7C15ULL) >> 32) & set->mask;; i = (i + 1) & set->mask) {
+        if (set->ids[i] == id) {
+            return 0;
+        }
+        if (set->ids[i] == -1) {
+            set->ids[i] = id;
+            return 1;
+        }
+    }
+}
+
+void stPinchEnd_visitConnectedPinchEnds(stPinchEnd *end, void (*visitFn)(stPinchEnd *, void *), void *extraArg) {
+    stPinchEndIdSet visited;
+    stPinchEndIdSet_init(&visited, stPinchBlock_getDegree(end->block));
     stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(end->block);
     stPinchSegment *segment;
     while ((segment = stPinchBlockIt_getNext(&blockIt)) != NULL) {
@@ -872,45 +3299,153 @@ stSet *stPinchEnd_getConnectedPinchEnds(stPinchEnd *end) {
             stPinchBlock *block = stPinchSegment_getBlock(segment);
             if (block != NULL) {
                 stPinchEnd end2 = stPinchEnd_constructStatic(block, stPinchEnd_endOrientation(_5PrimeTraversal, segment));
-                if (stSet_search(l, &end2) == NULL) {
-                    stSet_insert(l, stPinchEnd_construct(end2.block, end2.orientation));
+                if (stPinchEndIdSet_add(&visited, stPinchEnd_getId(&end2))) {
+                    visitFn(&end2, extraArg);
                 }
                 break;
             }
         }
     }
+    stPinchEndIdSet_destruct(&visited);
+}
+
+static void insertConnectedPinchEnd(stPinchEnd *end, void *set) {
+    stSet_insert(set, stPinchEnd_construct(end->block, end->orientation));
+}
+
+stSet *stPinchEnd_getConnectedPinchEnds(stPinchEnd *end) {
+    stSet *l = stSet_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, (void (*)(void *))stPinchEnd_destruct);
+    stPinchEnd_visitConnectedPinchEnds(end, insertConnectedPinchEnd, l);
     return l;
 }
 
+typedef struct _stPinchEndBuffer {
+    stPinchEnd *ends;
+    int64_t maxEndNumber;
+    int64_t endNumber;
+} stPinchEndBuffer;
+
+static void addConnectedPinchEnd(stPinchEnd *end, void *buffer) {
+    stPinchEndBuffer *endBuffer = buffer;
+    if (endBuffer->endNumber < endBuffer->maxEndNumber) {
+        endBuffer->ends[endBuffer->endNumber] = *end;
+    }
+    endBuffer->endNumber++;
+}
+
+int64_t stPinchEnd_getConnectedPinchEnds2(stPinchEnd *end, stPinchEnd *ends, int64_t maxEndNumber) {
+    stPinchEndBuffer buffer = { ends, maxEndNumber, 0 };
+    stPinchEnd_visitConnectedPinchEnds(end, addConnectedPinchEnd, &buffer);
+    return buffer.endNumber;
+}
+
 int64_t stPinchEnd_getNumberOfConnectedPinchEnds(stPinchEnd *end) {
-    stSet *set = stPinchEnd_getConnectedPinchEnds(end);
-    int64_t i = stSet_size(set);
-    stSet_destruct(set);
-    return i;
+    return stPinchEnd_getConnectedPinchEnds2(end, NULL, 0);
 }
 
-static void appendBlocksSegments(stPinchBlock *block, stList *list) {
+static int stPinchSegment_comparePointers(const void *a, const void *b) {
+    return stPinchSegment_compare(*(stPinchSegment * const *) a, *(stPinchSegment * const *) b);
+}
+
+static stPinchSegment **appendBlocksSegments(stPinchBlock *block, stPinchSegment **segments) {
     stPinchBlockIt it = stPinchBlock_getSegmentIterator(block);
     stPinchSegment *segment;
     while((segment = stPinchBlockIt_getNext(&it))) {
-        stList_append(list, segment);
+        *segments++ = segment;
+    }
+    return segments;
+}
+
+/*
+ * Returns the block's segments sorted by stPinchSegment_compare, building the block segment index if it is stale.
+ * Queries may run concurrently, so the index is built holding the query mutex and published by release stores of
+ * it and then its version, which a query that finds the index current has acquired.
+ */
+static stPinchSegment **stPinchBlock_getSortedSegments(stPinchBlock *block) {
+    if (__atomic_load_n(&block->sortedSegmentsVersion, __ATOMIC_ACQUIRE) == block->segmentsVersion) {
+        stPinchSegment **sortedSegments = __atomic_load_n(&block->sortedSegments, __ATOMIC_ACQUIRE);
+        if (sortedSegments != NULL) {
+            return sortedSegments;
+        }
+    }
+    pthread_mutex_t *queryMutex = stPinchBlock_getPools(block)->queryMutex;
+    pthread_mutex_lock(queryMutex);
+    if (block->sortedSegments == NULL || block->sortedSegmentsVersion != block->segmentsVersion) {
+        stPinchSegment **sortedSegments = reallocOrAbort(block->sortedSegments, sizeof(stPinchSegment *) * block->degree);
+        appendBlocksSegments(block, sortedSegments);
+        qsort(sortedSegments, block->degree, sizeof(stPinchSegment *), stPinchSegment_comparePointers);
+        __atomic_store_n(&block->sortedSegments, sortedSegments, __ATOMIC_RELEASE);
+        __atomic_store_n(&block->sortedSegmentsVersion, block->segmentsVersion, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(queryMutex);
+    return block->sortedSegments;
+}
+
+/*
+ * Iterates over the segments of one or two blocks in the order of stPinchSegment_compare. If block segment indices
+ * are kept the blocks' indices are merged, else a copy of the segments is sorted.
+ */
+typedef struct _stPinchBlockSegmentMerge {
+    stPinchSegment **segments1;
+    int64_t length1;
+    stPinchSegment **segments2;
+    int64_t length2;
+    stPinchSegment **copy;
+} stPinchBlockSegmentMerge;
+
+static void stPinchBlockSegmentMerge_init(stPinchBlockSegmentMerge *merge, stPinchBlock *block1, stPinchBlock *block2) {
+    int64_t length2 = block1 != block2 ? block2->degree : 0;
+    if (stPinchBlock_getPools(block1)->indexBlockSegments) {
+        merge->segments1 = stPinchBlock_getSortedSegments(block1);
+        merge->segments2 = length2 > 0 ? stPinchBlock_getSortedSegments(block2) : NULL;
+        merge->length1 = block1->degree;
+        merge->length2 = length2;
+        merge->copy = NULL;
+    } else {
+        merge->copy = st_malloc(sizeof(stPinchSegment *) * (block1->degree + length2));
+        stPinchSegment **segments = appendBlocksSegments(block1, merge->copy);
+        if (length2 > 0) {
+            appendBlocksSegments(block2, segments);
+        }
+        qsort(merge->copy, block1->degree + length2, sizeof(stPinchSegment *), stPinchSegment_comparePointers);
+        merge->segments1 = merge->copy;
+        merge->length1 = block1->degree + length2;
+        merge->segments2 = NULL;
+        merge->length2 = 0;
     }
 }
 
+static stPinchSegment *stPinchBlockSegmentMerge_getNext(stPinchBlockSegmentMerge *merge) {
+    if (merge->length1 > 0 && (merge->length2 == 0 || stPinchSegment_compare(merge->segments1[0], merge->segments2[0]) < 0)) {
+        merge->length1--;
+        return *merge->segments1++;
+    }
+    if (merge->length2 > 0) {
+        merge->length2--;
+        return *merge->segments2++;
+    }
+    return NULL;
+}
+
+static void stPinchBlockSegmentMerge_destruct(stPinchBlockSegmentMerge *merge) {
+    free(merge->copy);
+}
+
+void stPinchThreadSet_setBlockSegmentIndexing(stPinchThreadSet *threadSet, bool index) {
+    if (!index) { //Release the indices, which are invalidated no longer
+        stPinchThreadSet_releaseBlockSegmentIndices(threadSet);
+    }
+    threadSet->pools.indexBlockSegments = index;
+}
+
 bool stPinchEnd_hasSelfLoopWithRespectToOtherBlock(stPinchEnd *end, stPinchBlock *otherBlock) {
-    //Construct list of segments in end and otherEnd's blocks.
-    stList *l = stList_construct();
-    appendBlocksSegments(stPinchEnd_getBlock(end), l);
-    if(stPinchEnd_getBlock(end) != otherBlock) {
-        appendBlocksSegments(otherBlock, l);
-    }
-    //Sort segments by thread and then coordinate.
-    stList_sort(l, (int (*)(const void *, const void *))stPinchSegment_compare);
-
-    //Walk through list of segments
-    for(int64_t i=1; i<stList_length(l); i++) {
-        stPinchSegment *s1 = stList_get(l, i-1);
-        stPinchSegment *s2 = stList_get(l, i);
+    //Iterate over the segments in end and otherEnd's blocks, sorted by thread and then coordinate.
+    stPinchBlockSegmentMerge merge;
+    stPinchBlockSegmentMerge_init(&merge, stPinchEnd_getBlock(end), otherBlock);
+
+    //Walk through the segments
+    stPinchSegment *s1 = stPinchBlockSegmentMerge_getNext(&merge), *s2;
+    for(; (s2 = stPinchBlockSegmentMerge_getNext(&merge)) != NULL; s1 = s2) {
         //If there exists two successive segments in the same thread from block's end that are joined by an interstitial sequence,
         //without an intervening segment from otherEnd's block then we have identified a self-loop.
         if(stPinchSegment_getBlock(s1) == stPinchEnd_getBlock(end) && //same block
@@ -919,31 +3454,25 @@ bool stPinchEnd_hasSelfLoopWithRespectToOtherBlock(stPinchEnd *end, stPinchBlock
            !stPinchEnd_traverse5Prime(stPinchEnd_getOrientation(end), s1) && //contiguous
            stPinchEnd_traverse5Prime(stPinchEnd_getOrientation(end), s2) /*contiguous*/) {
             assert(stPinchSegment_getStart(s1) + stPinchSegment_getLength(s1) <= s2->start);
-            stList_destruct(l);
+            stPinchBlockSegmentMerge_destruct(&merge);
             return 1;
         }
     }
-    stList_destruct(l);
+    stPinchBlockSegmentMerge_destruct(&merge);
     return 0;
 }
 
 stList *stPinchEnd_getSubSequenceLengthsConnectingEnds(stPinchEnd *end, stPinchEnd *otherEnd) {
-    //Construct list of segments in end and otherEnd's blocks.
-    stList *l = stList_construct();
-    appendBlocksSegments(stPinchEnd_getBlock(end), l);
-    if(stPinchEnd_getBlock(otherEnd) != stPinchEnd_getBlock(end)) {
-        appendBlocksSegments(stPinchEnd_getBlock(otherEnd), l);
-    }
-    //Sort segments by thread and then coordinate.
-    stList_sort(l, (int (*)(const void *, const void *))stPinchSegment_compare);
+    //Iterate over the segments in end and otherEnd's blocks, sorted by thread and then coordinate.
+    stPinchBlockSegmentMerge merge;
+    stPinchBlockSegmentMerge_init(&merge, stPinchEnd_getBlock(end), stPinchEnd_getBlock(otherEnd));
 
     //List of segments to return.
     stList *lengths = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
 
-    //Walk through list of segments
-    for(int64_t i=1; i<stList_length(l); i++) {
-        stPinchSegment *s1 = stList_get(l, i-1);
-        stPinchSegment *s2 = stList_get(l, i);
+    //Walk through the segments
+    stPinchSegment *s1 = stPinchBlockSegmentMerge_getNext(&merge), *s2;
+    for(; (s2 = stPinchBlockSegmentMerge_getNext(&merge)) != NULL; s1 = s2) {
         //If there exists two successive segments in different ends that are contigous add their length.
         if(stPinchSegment_getThread(s1) == stPinchSegment_getThread(s2)) { //same thread
             if(stPinchSegment_getBlock(s1) == stPinchEnd_getBlock(end)) { //case where first segment is from first block.
@@ -969,42 +3498,58 @@ stList *stPinchEnd_getSubSequenceLengthsConnectingEnds(stPinchEnd *end, stPinchE
             }
         }
     }
-    stList_destruct(l);
+    stPinchBlockSegmentMerge_destruct(&merge);
     return lengths;
 }
 
 static void merge3Prime(stPinchSegment *segment) {
-    stPinchSegment *nSegment = segment->nSegment;
+    stPinchSegment *nSegment = stPinchSegment_fromLink(segment->nSegment);
     assert(nSegment != NULL && nSegment != segment);
-    stSortedSet_remove(segment->thread->segments, nSegment);
-    assert(nSegment->block == NULL);
-    assert(nSegment->nSegment != NULL);
-    segment->nSegment = nSegment->nSegment;
-    nSegment->nSegment->pSegment = segment;
+    stPinchPools *pools = segment->thread->pools;
+    stPinchSegmentIndex_remove(&segment->thread->segments, nSegment->start);
+    stPinchPools_logPointer(pools, ST_PINCH_UNDO_INDEX_REMOVE, &segment->thread->segments, nSegment);
+    assert(stPinchSegment_getBlock(nSegment) == NULL);
+    assert(nSegment->nSegment != 0);
+    stPinchPools_set(pools, segment->nSegment, nSegment->nSegment);
+    stPinchPools_set(pools, stPinchSegment_fromLink(nSegment->nSegment)->pSegment, stPinchSegment_toLink(segment));
     stPinchSegment_destruct(nSegment);
 }
 
 static void merge5Prime(stPinchSegment *segment) {
-    stPinchSegment *pSegment = segment->pSegment;
+    stPinchSegment *pSegment = stPinchSegment_fromLink(segment->pSegment);
     assert(pSegment != NULL && pSegment != segment);
-    stSortedSet_remove(segment->thread->segments, pSegment);
-    assert(pSegment->block == NULL);
-    segment->pSegment = pSegment->pSegment;
-    if (pSegment->pSegment != NULL) {
-        pSegment->pSegment->nSegment = segment;
+    stPinchPools *pools = segment->thread->pools;
+    stPinchSegmentIndex_remove(&segment->thread->segments, pSegment->start);
+    stPinchPools_logPointer(pools, ST_PINCH_UNDO_INDEX_REMOVE, &segment->thread->segments, pSegment);
+    assert(stPinchSegment_getBlock(pSegment) == NULL);
+    stPinchPools_set(pools, segment->pSegment, pSegment->pSegment);
+    if (pSegment->pSegment != 0) {
+        stPinchPools_set(pools, stPinchSegment_fromLink(pSegment->pSegment)->nSegment, stPinchSegment_toLink(segment));
     }
     assert(pSegment->start < segment->start);
-    segment->start = pSegment->start;
+    stPinchSegmentIndex_updateStart(&segment->thread->segments, segment->start, pSegment->start);
+    //Logged before the start itself, so that rollback restores the start before reversing the index update
+    stPinchPools_logValue(pools, ST_PINCH_UNDO_INDEX_UPDATE_START, &segment->thread->segments, pSegment->start);
+    stPinchPools_set(pools, segment->start, pSegment->start);
     stPinchSegment_destruct(pSegment);
 }
 
-void stPinchEnd_joinTrivialBoundary(stPinchEnd end) {
+/*
+ * Returns the block on the other side of a trivial boundary, which is merged into the end's block by joining it.
+ */
+static stPinchBlock *stPinchEnd_getTrivialBoundaryBlock(stPinchEnd end) {
     stPinchSegment *segment = stPinchBlock_getFirst(end.block);
     assert(segment != NULL);
     bool _5PrimeTraversal = stPinchEnd_traverse5Prime(end.orientation, segment);
     segment = _5PrimeTraversal ? stPinchSegment_get5Prime(segment) : stPinchSegment_get3Prime(segment);
     assert(segment != NULL && stPinchSegment_getBlock(segment) != NULL && stPinchSegment_getBlock(segment) != end.block);
-    stPinchBlock_destruct(stPinchSegment_getBlock(segment)); //get rid of the old block
+    return stPinchSegment_getBlock(segment);
+}
+
+void stPinchEnd_joinTrivialBoundary(stPinchEnd end) {
+    //get rid of the old block, whose segments' threads are those of the end's block
+    stPinchBlock_destructP(stPinchEnd_getTrivialBoundaryBlock(end), 1);
+    stPinchSegment *segment;
     stPinchBlockIt segmentIt = stPinchBlock_getSegmentIterator(end.block);
     while ((segment = stPinchBlockIt_getNext(&segmentIt)) != NULL) {
         bool _5PrimeTraversal = stPinchEnd_traverse5Prime(end.orientation, segment);
@@ -1016,6 +3561,23 @@ void stPinchEnd_joinTrivialBoundary(stPinchEnd end) {
     }
 }
 
+/*
+ * Joins the trivial boundary at the end, keeping whichever of the two blocks is earlier in the registry, so that a run
+ * of blocks separated by trivial boundaries becomes its earliest block, with that block's orientation and order of
+ * segments, whatever the order the boundaries are joined in. Returns the block kept.
+ */
+static stPinchBlock *stPinchEnd_joinTrivialBoundaryP(stPinchEnd end) {
+    stPinchSegment *segment = stPinchBlock_getFirst(end.block);
+    bool _5PrimeTraversal = stPinchEnd_traverse5Prime(end.orientation, segment);
+    segment = _5PrimeTraversal ? stPinchSegment_get5Prime(segment) : stPinchSegment_get3Prime(segment);
+    stPinchBlock *block = stPinchSegment_getBlock(segment);
+    if (block->registryOrder < end.block->registryOrder) { //Join from the other side
+        end = stPinchEnd_constructStatic(block, stPinchEnd_endOrientation(_5PrimeTraversal, segment));
+    }
+    stPinchEnd_joinTrivialBoundary(end);
+    return end.block;
+}
+
 //stPinch
 
 void stPinch_fillOut(stPinch *pinch, int64_t name1, int64_t name2, int64_t start1, int64_t start2, int64_t length, bool strand) {
@@ -1084,14 +3646,34 @@ void stPinchInterval_destruct(stPinchInterval *pinchInterval) {
     free(pinchInterval);
 }
 
-void stPinchThreadSet_getLabelIntervalsP2(stPinchThread *thread, stSortedSet *pinchIntervals, int64_t start, void *label) {
+/*
+ * A growable array of intervals.
+ */
+typedef struct _stPinchIntervalBuffer {
+    stPinchInterval *intervals;
+    int64_t length;
+    int64_t maxLength;
+} stPinchIntervalBuffer;
+
+static void stPinchIntervalBuffer_add(stPinchIntervalBuffer *buffer, int64_t name, int64_t start, int64_t length, void *label) {
+    if (buffer->length == buffer->maxLength) {
+        buffer->maxLength = buffer->maxLength * 2 + 64;
+        buffer->intervals = reallocOrAbort(buffer->intervals, sizeof(stPinchInterval) * buffer->maxLength);
+    }
+    stPinchInterval_fillOut(&buffer->intervals[buffer->length++], name, start, length, label);
+}
+
+static void stPinchThreadSet_getLabelIntervalsP2(stPinchThread *thread, stPinchIntervalBuffer *pinchIntervals, int64_t start, void *label) {
     int64_t end = stPinchThread_getLength(thread) + stPinchThread_getStart(thread);
     if (start < end) {
-        stSortedSet_insert(pinchIntervals, stPinchInterval_construct(stPinchThread_getName(thread), start, end - start, label));
+        stPinchIntervalBuffer_add(pinchIntervals, stPinchThread_getName(thread), start, end - start, label);
     }
 }
 
-void stPinchThreadSet_getLabelIntervalsP(stPinchThread *thread, stHash *pinchEndsToLabels, stSortedSet *pinchIntervals) {
+/*
+ * Appends the label intervals of the thread to the buffer, in order of start.
+ */
+static void stPinchThreadSet_getLabelIntervalsP(stPinchThread *thread, stHash *pinchEndsToLabels, stPinchIntervalBuffer *pinchIntervals) {
     stPinchSegment *segment = stPinchThread_getFirst(thread);
     if (segment == NULL) {
         return;
@@ -1124,7 +3706,7 @@ void stPinchThreadSet_getLabelIntervalsP(stPinchThread *thread, stHash *pinchEnd
         if (label != label2) {
             int64_t end = stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment) / 2;
             if (start < end) {
-                stSortedSet_insert(pinchIntervals, stPinchInterval_construct(stPinchThread_getName(thread), start, end - start, label));
+                stPinchIntervalBuffer_add(pinchIntervals, stPinchThread_getName(thread), start, end - start, label);
             }
             start = end;
             label = label2;
@@ -1137,14 +3719,176 @@ void stPinchThreadSet_getLabelIntervalsP(stPinchThread *thread, stHash *pinchEnd
 stSortedSet *stPinchThreadSet_getLabelIntervals(stPinchThreadSet *threadSet, stHash *pinchEndsToLabels) {
     stSortedSet *pinchIntervals = stSortedSet_construct3((int(*)(const void *, const void *)) stPinchInterval_compareFunction,
             (void(*)(void *)) stPinchInterval_destruct);
+    stPinchIntervalBuffer buffer = { NULL, 0, 0 };
     stPinchThread *thread;
     stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
     while ((thread = stPinchThreadSetIt_getNext(&threadIt))) {
-        stPinchThreadSet_getLabelIntervalsP(thread, pinchEndsToLabels, pinchIntervals);
+        buffer.length = 0;
+        stPinchThreadSet_getLabelIntervalsP(thread, pinchEndsToLabels, &buffer);
+        for (int64_t i = 0; i < buffer.length; i++) {
+            stPinchInterval *interval = &buffer.intervals[i];
+            stSortedSet_insert(pinchIntervals, stPinchInterval_construct(interval->name, interval->start, interval->length, interval->label));
+        }
     }
+    free(buffer.intervals);
     return pinchIntervals;
 }
 
+//stPinchIntervalIndex
+
+struct _stPinchIntervalIndex {
+    int64_t threadNumber;
+    int64_t *names; //The names of the threads, sorted
+    int64_t *offsets; //The intervals of the ith thread are those from offsets[i] up to offsets[i + 1]
+    int64_t *starts; //The starts of the intervals, kept apart so that searches scan contiguous keys
+    stPinchInterval *intervals; //Sorted by name then start
+};
+
+static int stPinchThread_compareByName(const void *a, const void *b) {
+    const stPinchThread *thread1 = *(stPinchThread * const *) a, *thread2 = *(stPinchThread * const *) b;
+    return thread1->name > thread2->name ? 1 : (thread1->name < thread2->name ? -1 : 0);
+}
+
+/*
+ * Constructs an index without intervals, with the names of the threads in sorted order, and returns the threads in
+ * that order.
+ */
+static stPinchIntervalIndex *stPinchIntervalIndex_construct(stPinchThreadSet *threadSet, stPinchThread ***threads) {
+    stPinchIntervalIndex *index = st_malloc(sizeof(stPinchIntervalIndex));
+    index->threadNumber = stPinchThreadSet_getSize(threadSet);
+    *threads = st_malloc(sizeof(stPinchThread *) * (index->threadNumber + 1));
+    for (int64_t i = 0; i < index->threadNumber; i++) {
+        (*threads)[i] = stList_get(threadSet->threads, i);
+    }
+    qsort(*threads, index->threadNumber, sizeof(stPinchThread *), stPinchThread_compareByName);
+    index->names = st_malloc(sizeof(int64_t) * (index->threadNumber + 1));
+    index->offsets = st_malloc(sizeof(int64_t) * (index->threadNumber + 1));
+    for (int64_t i = 0; i < index->threadNumber; i++) {
+        index->names[i] = (*threads)[i]->name;
+    }
+    index->starts = NULL;
+    index->intervals = NULL;
+    return index;
+}
+
+stPinchIntervalIndex *stPinchThreadSet_getLabelIntervalIndex(stPinchThreadSet *threadSet, stHash *pinchEndsToLabels) {
+    stPinchThread **threads;
+    stPinchIntervalIndex *index = stPinchIntervalIndex_construct(threadSet, &threads);
+    stPinchIntervalBuffer buffer = { NULL, 0, 0 };
+    for (int64_t i = 0; i < index->threadNumber; i++) {
+        index->offsets[i] = buffer.length;
+        stPinchThreadSet_getLabelIntervalsP(threads[i], pinchEndsToLabels, &buffer);
+    }
+    index->offsets[index->threadNumber] = buffer.length;
+    index->intervals = buffer.intervals;
+    index->starts = st_malloc(sizeof(int64_t) * (buffer.length + 1));
+    for (int64_t i = 0; i < buffer.length; i++) {
+        index->starts[i] = buffer.intervals[i].start;
+    }
+    free(threads);
+    return index;
+}
+
+/*
+ * Each thread's intervals are made into a buffer of its own, then the buffers, each sorted by start and taken in
+ * order of name, are copied into place after a prefix sum of their lengths.
+ */
+stPinchIntervalIndex *stPinchThreadSet_getLabelIntervalIndexParallel(stPinchThreadSet *threadSet, stHash *pinchEndsToLabels) {
+    stPinchThread **threads;
+    stPinchIntervalIndex *index = stPinchIntervalIndex_construct(threadSet, &threads);
+    int64_t threadNumber = index->threadNumber;
+    stPinchIntervalBuffer *buffers = st_calloc(threadNumber + 1, sizeof(stPinchIntervalBuffer));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int64_t i = 0; i < threadNumber; i++) {
+        stPinchThreadSet_getLabelIntervalsP(threads[i], pinchEndsToLabels, &buffers[i]);
+    }
+    int64_t intervalNumber = 0;
+    for (int64_t i = 0; i < threadNumber; i++) {
+        index->offsets[i] = intervalNumber;
+        intervalNumber += buffers[i].length;
+    }
+    index->offsets[threadNumber] = intervalNumber;
+    index->intervals = st_malloc(sizeof(stPinchInterval) * (intervalNumber + 1));
+    index->starts = st_malloc(sizeof(int64_t) * (intervalNumber + 1));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int64_t i = 0; i < threadNumber; i++) {
+        stPinchIntervalBuffer *buffer = &buffers[i];
+        for (int64_t j = 0; j < buffer->length; j++) {
+            index->intervals[index->offsets[i] + j] = buffer->intervals[j];
+            index->starts[index->offsets[i] + j] = buffer->intervals[j].start;
+        }
+        free(buffer->intervals);
+    }
+    free(buffers);
+    free(threads);
+    return index;
+}
+
+void stPinchIntervalIndex_destruct(stPinchIntervalIndex *index) {
+    free(index->names);
+    free(index->offsets);
+    free(index->starts);
+    free(index->intervals);
+    free(index);
+}
+
+int64_t stPinchIntervalIndex_getSize(stPinchIntervalIndex *index) {
+    return index->offsets[index->threadNumber];
+}
+
+/*
+ * Returns the index of the thread with the given name, or -1 if there is none.
+ */
+static int64_t stPinchIntervalIndex_getThreadIndex(stPinchIntervalIndex *index, int64_t name) {
+    int64_t i = searchLessThanOrEqual(index->names, index->threadNumber, name);
+    return i >= 0 && index->names[i] == name ? i : -1;
+}
+
+/*
+ * Returns the interval j if it contains the position, else NULL.
+ */
+static inline stPinchInterval *stPinchIntervalIndex_getIntervalP(stPinchIntervalIndex *index, int64_t j, int64_t position) {
+    stPinchInterval *interval = &index->intervals[j];
+    return interval->start + interval->length > position ? interval : NULL;
+}
+
+stPinchInterval *stPinchIntervalIndex_getInterval(stPinchIntervalIndex *index, int64_t name, int64_t position) {
+    int64_t i = stPinchIntervalIndex_getThreadIndex(index, name);
+    if (i == -1) {
+        return NULL;
+    }
+    int64_t offset = index->offsets[i];
+    int64_t j = searchLessThanOrEqual(index->starts + offset, index->offsets[i + 1] - offset, position);
+    return j >= 0 ? stPinchIntervalIndex_getIntervalP(index, offset + j, position) : NULL;
+}
+
+void stPinchIntervalIndex_getIntervals(stPinchIntervalIndex *index, int64_t name, const int64_t *positions, int64_t positionNumber,
+        stPinchInterval **intervals) {
+    int64_t i = stPinchIntervalIndex_getThreadIndex(index, name);
+    int64_t j = i == -1 ? 0 : index->offsets[i], end = i == -1 ? 0 : index->offsets[i + 1];
+    for (int64_t k = 0; k < positionNumber; k++) {
+        int64_t position = positions[k];
+        assert(k == 0 || positions[k - 1] <= position);
+        //Gallop forward to bracket the last interval starting at or before the position, then search the bracket
+        int64_t step = 1;
+        while (j + step < end && index->starts[j + step] <= position) {
+            j += step;
+            step *= 2;
+        }
+        if (j < end && index->starts[j] <= position) {
+            int64_t bracketEnd = j + step < end ? j + step : end;
+            j += searchLessThanOrEqual(index->starts + j, bracketEnd - j, position);
+            intervals[k] = stPinchIntervalIndex_getIntervalP(index, j, position);
+        } else {
+            intervals[k] = NULL;
+        }
+    }
+}
+
 static inline int cmp64s(int64_t i, int64_t j) {
     return i > j ? 1 : (i < j ? -1 : 0);
 }
@@ -1220,103 +3964,136 @@ stPinchThreadSet *stPinchThreadSet_getRandomGraph() {
     return threadSet;
 }
 
-static void stPinchThread_filterPinchPositiveStrandP(stPinchSegment **segment1, stPinchSegment **segment2, int64_t start1, int64_t start2, int64_t *offset) {
-    int64_t i = stPinchSegment_getStart(*segment1) + stPinchSegment_getLength(*segment1) - start1;
-    int64_t j = stPinchSegment_getStart(*segment2) + stPinchSegment_getLength(*segment2) - start2;
-    if(i == j) {
-        *offset = i;
-        *segment1 = stPinchSegment_get3Prime(*segment1);
-        *segment2 = stPinchSegment_get3Prime(*segment2);
-    }
-    else if (i < j) {
-        *offset = i;
-        *segment1 = stPinchSegment_get3Prime(*segment1);
-    } else {
-        *offset = j;
-        *segment2 = stPinchSegment_get3Prime(*segment2);
-    }
+/*
+ * Filtered pinching walks the pairs of aligned segments of the alignment, each pair covering a run of columns in which
+ * neither thread has a segment boundary, and pinches those the filter accepts. The pairs are gathered in batches and
+ * the filter called once per batch. Each batch is walked with thread cursors, so pinching a pair never restarts
+ * a search of the segment indices.
+ */
+#define ST_PINCH_FILTER_BATCH_SIZE 64
+
+typedef struct _stPinchFilterBatch {
+    stPinchSegment *segments1[ST_PINCH_FILTER_BATCH_SIZE];
+    stPinchSegment *segments2[ST_PINCH_FILTER_BATCH_SIZE];
+    bool filtered[ST_PINCH_FILTER_BATCH_SIZE];
+    void *keys[2 * ST_PINCH_FILTER_BATCH_SIZE]; //The blocks of the segments, or the segments if they have no block
+    int64_t ends[ST_PINCH_FILTER_BATCH_SIZE]; //The offsets at which the pairs end
+    void *pinchedKeys[2 * ST_PINCH_FILTER_BATCH_SIZE];
+} stPinchFilterBatch;
+
+static inline void *stPinchSegment_getFilterKey(stPinchSegment *segment) {
+    stPinchBlock *block = stPinchSegment_getBlock(segment);
+    return block != NULL ? (void *) block : (void *) segment;
 }
 
-static void stPinchThread_filterPinchPositiveStrand(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2,
-        int64_t length, bool(*filterFn)(stPinchSegment *, stPinchSegment *)) {
-    stPinchSegment *segment1 = stPinchThread_getSegment(thread1, start1);
-    stPinchSegment *segment2 = stPinchThread_getSegment(thread2, start2);
-    int64_t offset = 0;
-    while (offset < length) {
+/*
+ * Gathers the pairs of segments from the given offset until the end of the alignment or the batch is full, returning
+ * the number gathered.
+ */
+static int64_t stPinchFilterBatch_gather(stPinchFilterBatch *batch, stPinchSegment *segment1, stPinchSegment *segment2,
+        int64_t start1, int64_t start2, int64_t length, bool strand2, int64_t offset) {
+    int64_t pairNumber = 0;
+    while (offset < length && pairNumber < ST_PINCH_FILTER_BATCH_SIZE) {
         assert(segment1 != NULL);
         assert(segment2 != NULL);
-        if (filterFn(segment1, segment2)) {
-            stPinchThread_filterPinchPositiveStrandP(&segment1, &segment2, start1, start2, &offset);
-        } else {
-            int64_t start = offset;
-            stPinchSegment *s1 = segment1;
-            stPinchThread_filterPinchPositiveStrandP(&segment1, &segment2, start1, start2, &offset);
-            assert(offset - start > 0);
-            if(offset > length) {
-                stPinchThread_pinchPositive2(s1, thread2, start1 + start, start2 + start, length - start);
-                break;
-            }
-            else {
-                stPinchThread_pinchPositive2(s1, thread2, start1 + start, start2 + start, offset - start);
-            }
-            segment1 = stPinchThread_getSegment(thread1, start1 + offset);
-            segment2 = stPinchThread_getSegment(thread2, start2 + offset);
+        batch->segments1[pairNumber] = segment1;
+        batch->segments2[pairNumber] = segment2;
+        batch->keys[2 * pairNumber] = stPinchSegment_getFilterKey(segment1);
+        batch->keys[2 * pairNumber + 1] = stPinchSegment_getFilterKey(segment2);
+        int64_t i = stPinchSegment_getStart(segment1) + stPinchSegment_getLength(segment1) - start1;
+        int64_t j = strand2 ? stPinchSegment_getStart(segment2) + stPinchSegment_getLength(segment2) - start2 :
+                start2 + length - stPinchSegment_getStart(segment2);
+        offset = i < j ? i : j;
+        batch->ends[pairNumber++] = offset < length ? offset : length;
+        if (i == offset) {
+            segment1 = stPinchSegment_get3Prime(segment1);
+        }
+        if (j == offset) {
+            segment2 = strand2 ? stPinchSegment_get3Prime(segment2) : stPinchSegment_get5Prime(segment2);
         }
     }
+    return pairNumber;
 }
 
-static void stPinchThread_filterPinchNegativeStrandP(stPinchSegment **segment1, stPinchSegment **segment2, int64_t start1, int64_t end2, int64_t *offset) {
-    int64_t i = stPinchSegment_getStart(*segment1) + stPinchSegment_getLength(*segment1) - start1;
-    int64_t j = end2 - stPinchSegment_getStart(*segment2);
-    if(i == j) {
-        *offset = i;
-        *segment1 = stPinchSegment_get3Prime(*segment1);
-        *segment2 = stPinchSegment_get5Prime(*segment2);
-    }
-    else if (i < j) {
-        *offset = i;
-        *segment1 = stPinchSegment_get3Prime(*segment1);
-    } else {
-        *offset = j;
-        *segment2 = stPinchSegment_get5Prime(*segment2);
+/*
+ * Pinching a pair changes only the blocks of its segments, or its segments if they have no block, and the segments
+ * of those blocks, so a later pair none of whose keys are those of an earlier pinched pair in the batch is unchanged.
+ */
+static bool stPinchFilterBatch_isUnchanged(stPinchFilterBatch *batch, int64_t pairIndex, int64_t pinchedKeyNumber) {
+    void *key1 = batch->keys[2 * pairIndex], *key2 = batch->keys[2 * pairIndex + 1];
+    for (int64_t i = 0; i < pinchedKeyNumber; i++) {
+        if (batch->pinchedKeys[i] == key1 || batch->pinchedKeys[i] == key2) {
+            return 0;
+        }
     }
+    return 1;
 }
 
-static void stPinchThread_filterPinchNegativeStrand(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2,
-        int64_t length, bool(*filterFn)(stPinchSegment *, stPinchSegment *)) {
-    stPinchSegment *segment1 = stPinchThread_getSegment(thread1, start1);
-    stPinchSegment *segment2 = stPinchThread_getSegment(thread2, start2 + length - 1);
+void stPinchThread_filterPinch2(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2,
+        int64_t length, bool strand2,
+        void (*filterFn)(stPinchSegment **segments1, stPinchSegment **segments2, bool *filtered, int64_t pairNumber, void *extraArg),
+        void *extraArg) {
+    assert(length >= 0);
+    assert(stPinchThread_getStart(thread1) <= start1);
+    assert(stPinchThread_getStart(thread1) + stPinchThread_getLength(thread1) >= start1 + length);
+    assert(stPinchThread_getStart(thread2) <= start2);
+    assert(stPinchThread_getStart(thread2) + stPinchThread_getLength(thread2) >= start2 + length);
+    if (length == 0) {
+        return;
+    }
+    stPinchFilterBatch batch; //A few kilobytes, so kept on the stack rather than allocated per call
+    stPinchThreadCursor cursor1 = { thread1, NULL }, cursor2 = { thread2, NULL };
     int64_t offset = 0;
-    while  (offset < length) {
-        assert(segment1 != NULL);
-        assert(segment2 != NULL);
-        if (filterFn(segment1, segment2)) {
-            stPinchThread_filterPinchNegativeStrandP(&segment1, &segment2, start1, start2 + length, &offset);
-        } else {
-            int64_t start = offset;
-            stPinchSegment *s1 = segment1;
-            stPinchThread_filterPinchNegativeStrandP(&segment1, &segment2, start1, start2 + length, &offset);
-            assert(offset - start > 0);
-            if (offset > length) {
-                stPinchThread_pinchNegative2(s1, thread2, start1 + start, start2, length - start);
-                break;
+    while (offset < length) {
+        //The pairs are gathered from the segments holding the columns at the offset
+        stPinchSegment *segment1 = stPinchThreadCursor_getSegment(&cursor1, start1 + offset);
+        stPinchSegment *segment2 = stPinchThreadCursor_getSegment(&cursor2, strand2 ? start2 + offset : start2 + length - 1 - offset);
+        int64_t pairNumber = stPinchFilterBatch_gather(&batch, segment1, segment2, start1, start2, length, strand2, offset);
+        filterFn(batch.segments1, batch.segments2, batch.filtered, pairNumber, extraArg);
+        int64_t pinchedKeyNumber = 0;
+        for (int64_t i = 0; i < pairNumber; i++) {
+            if (pinchedKeyNumber > 0 && !stPinchFilterBatch_isUnchanged(&batch, i, pinchedKeyNumber)) {
+                break; //The filter must see the pair as changed by the pinches before it, so gather again from it
             }
-            else {
-                stPinchThread_pinchNegative2(s1, thread2, start1 + start, start2 + length - offset, offset - start);
+            //Pinching splits the segments of a pair only into parts that keep their starts, so the cursors remain valid
+            cursor1.segment = batch.segments1[i];
+            cursor2.segment = batch.segments2[i];
+            if (!batch.filtered[i]) {
+                int64_t pairLength = batch.ends[i] - offset;
+                segment1 = stPinchThread_pinchP(batch.segments1[i], start1 + offset);
+                //As in stPinchThread_pinch, the second segment is found after the first has been split, which may split it
+                if (strand2) {
+                    segment2 = stPinchThread_pinchP(stPinchThreadCursor_getSegment(&cursor2, start2 + offset), start2 + offset);
+                    stPinchThread_pinchPositiveP(segment1, segment2, start1 + offset, start2 + offset, pairLength);
+                } else {
+                    int64_t end2 = start2 + length - 1 - offset;
+                    segment2 = stPinchThreadCursor_getSegment(&cursor2, end2);
+                    stPinchSegment_split(segment2, end2);
+                    stPinchThread_pinchNegativeP(segment1, segment2, start1 + offset, end2 - pairLength + 1, pairLength);
+                }
+                batch.pinchedKeys[pinchedKeyNumber++] = batch.keys[2 * i];
+                batch.pinchedKeys[pinchedKeyNumber++] = batch.keys[2 * i + 1];
             }
-            segment1 = stPinchThread_getSegment(thread1, start1 + offset);
-            segment2 = stPinchThread_getSegment(thread2, start2 + length - 1 - offset);
+            offset = batch.ends[i];
         }
     }
 }
 
+typedef struct _stPinchFilterFn {
+    bool (*filterFn)(stPinchSegment *, stPinchSegment *);
+} stPinchFilterFn;
+
+static void stPinchThread_filterPinchP(stPinchSegment **segments1, stPinchSegment **segments2, bool *filtered, int64_t pairNumber,
+        void *extraArg) {
+    bool (*filterFn)(stPinchSegment *, stPinchSegment *) = ((stPinchFilterFn *) extraArg)->filterFn;
+    for (int64_t i = 0; i < pairNumber; i++) {
+        filtered[i] = filterFn(segments1[i], segments2[i]);
+    }
+}
+
 void stPinchThread_filterPinch(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2,
         int64_t length, bool strand2, bool(*filterFn)(stPinchSegment *, stPinchSegment *)) {
-    if(strand2) {
-        stPinchThread_filterPinchPositiveStrand(thread1, thread2, start1, start2, length, filterFn);
-    }
-    else {
-        stPinchThread_filterPinchNegativeStrand(thread1, thread2, start1, start2, length, filterFn);
-    }
+    stPinchFilterFn filterFn2 = { filterFn };
+    stPinchThread_filterPinch2(thread1, thread2, start1, start2, length, strand2, stPinchThread_filterPinchP, &filterFn2);
 }
 
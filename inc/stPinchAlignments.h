@@ -0,0 +1,71 @@
+/*
+ * stPinchAlignments.h
+ *
+ *  Streaming ingestion of alignments into pinch graphs.
+ *
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef ST_PINCH_ALIGNMENTS_H_
+#define ST_PINCH_ALIGNMENTS_H_
+
+#include "sonLib.h"
+#include "stPinchGraphs.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * Counters describing the work done by a streaming read, accumulated across calls.
+ */
+typedef struct _stPinchAlignmentCounters {
+    int64_t bytesRead;
+    int64_t alignmentNumber; //Alignment records read, for binary files the number of pinch records
+    int64_t pinchNumber; //Non-empty pinches applied
+    int64_t alignedBases; //Total length of the pinches applied
+    int64_t chunkNumber; //Number of batches of pinches applied
+} stPinchAlignmentCounters;
+
+/*
+ * Reads the PAF alignments in the file and applies their gapless aligned runs to the thread set as pinches,
+ * buffering at most chunkSize pinches at a time, so that memory is bounded independently of the size of the file.
+ * The query and target names must be the (integer) names of threads in the thread set, and coordinates are offsets
+ * from the start of the threads. Each alignment must have a cg (CIGAR) or cs (difference string) tag. If parallel is
+ * true each chunk is applied with stPinchThreadSet_pinchBatchParallel, else with stPinchThreadSet_pinchBatch;
+ * in either case the graph is the same as applying the pinches one by one in file order. If counters is not NULL
+ * the counts of the work done are added to it. Malformed input is a fatal error.
+ */
+void stPinchThreadSet_pinchPAF(stPinchThreadSet *threadSet, FILE *fileHandle, int64_t chunkSize, bool parallel,
+        stPinchAlignmentCounters *counters);
+
+/*
+ * As stPinchThreadSet_pinchPAF, but reads a file of pinches in the binary pinch format,
+ * as written by stPinch_writeBinaryHeader and stPinch_writeBinary.
+ */
+void stPinchThreadSet_pinchBinary(stPinchThreadSet *threadSet, FILE *fileHandle, int64_t chunkSize, bool parallel,
+        stPinchAlignmentCounters *counters);
+
+/*
+ * The binary pinch format is a header followed by fixed size records, one per pinch, each holding
+ * name1, name2, start1, start2 and length as 64 bit little endian integers followed by a strand byte.
+ */
+void stPinch_writeBinaryHeader(FILE *fileHandle);
+
+void stPinch_writeBinary(FILE *fileHandle, stPinch *pinches, int64_t pinchNumber);
+
+/*
+ * Adds a thread for each record of the sequence length file, with stPinchThreadSet_addThreads. Each record is a line
+ * of tab separated fields, the first the (integer) name of the sequence and the second its length, as in a .fai
+ * index, whose further fields are ignored. The threads start at coordinate 0. Malformed input, or a name already
+ * in the thread set or repeated in the file, is a fatal error.
+ */
+void stPinchThreadSet_addThreadsFromFile(stPinchThreadSet *threadSet, FILE *fileHandle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ST_PINCH_ALIGNMENTS_H_ */
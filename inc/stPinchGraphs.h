@@ -14,6 +14,25 @@
 extern "C"{
 #endif
 
+/*
+ * Concurrency: the functions that query a pinch graph without modifying it are reentrant, so any number of threads
+ * may call them concurrently on the same thread set, provided that no thread is modifying the graph at the same time. The queries are the getters of threads, segments, blocks and ends,
+ * the thread, segment and block iterators (each caller using its own iterator), stPinchThreadSet_getThread,
+ * stPinchThreadSet_getSegment, stPinchThread_getSegment, stPinchEnd_boundaryIsTrivial,
+ * stPinchEnd_getConnectedPinchEnds(2), stPinchEnd_visitConnectedPinchEnds, stPinchEnd_getNumberOfConnectedPinchEnds,
+ * stPinchEnd_hasSelfLoopWithRespectToOtherBlock, stPinchEnd_getSubSequenceLengthsConnectingEnds,
+ * stPinchThreadSet_getTotalBlockNumber, stPinchThreadSet_getBlockIdBound, stPinchThreadSet_getAdjacencyComponents(2),
+ * stPinchThreadSet_getAdjacencyComponentsParallel, stPinchThreadSet_getThreadComponents,
+ * stPinchThreadSet_getLabelIntervals, stPinchIntervals_getInterval, stPinchThreadSet_getLabelIntervalIndex(Parallel),
+ * stPinchIntervalIndex_getInterval, stPinchIntervalIndex_getIntervals, stPinchThreadSet_getThreadComponentNumber,
+ * stPinchThreadSet_getThreadComponentLabel, stPinchThreadSet_threadsAreInSameComponent and
+ * stPinchThreadSet_getAdjacencyComponentLabel. The first of these queries after a modification may bring state derived
+ * from the graph up to date (the thread components, tracked adjacency component labels and block segment indices),
+ * which it does holding a lock of the thread set, so the queries remain safe to call concurrently. Everything else
+ * (adding threads, splitting, pinching, joining boundaries, constructing, pinching or destructing blocks and
+ * destructing the thread set) must have exclusive access to the thread set.
+ */
+
 //Datastructures
 
 typedef struct _stPinchThreadSet stPinchThreadSet;
@@ -32,12 +51,12 @@ typedef struct _stPinchThreadSetSegmentIt {
     stPinchSegment *segment;
 } stPinchThreadSetSegmentIt;
 
+typedef struct _stPinchBlock stPinchBlock;
+
 typedef struct _stPinchThreadSetBlockIt {
-    stPinchThreadSetSegmentIt segmentIt;
+    stPinchBlock *block;
 } stPinchThreadSetBlockIt;
 
-typedef struct _stPinchBlock stPinchBlock;
-
 typedef struct _stPinchBlockIt {
     stPinchSegment *segment;
 } stPinchBlockIt;
@@ -63,16 +82,40 @@ typedef struct _stPinchInterval {
     void *label;
 } stPinchInterval;
 
+typedef struct _stPinchIntervalIndex stPinchIntervalIndex;
+
 //Thread set
 
+/*
+ * Constructs an empty thread set. The segments of all the thread sets of a process are numbered together, and a
+ * process can hold at most about 3.4 billion segments at once; beyond that the library aborts with "Too many pinch
+ * graph segments".
+ */
 stPinchThreadSet *stPinchThreadSet_construct(void);
 
 void stPinchThreadSet_destruct(stPinchThreadSet *threadSet);
 
 stPinchThread *stPinchThreadSet_addThread(stPinchThreadSet *threadSet, int64_t name, int64_t start, int64_t length);
 
+/*
+ * Adds threadNumber threads, the ith with the ith of the names, starts and lengths, as stPinchThreadSet_addThread
+ * would one by one. The threads and their initial segments are allocated contiguously, and the table of threads by
+ * name, if needed, is sized once for all of them.
+ */
+void stPinchThreadSet_addThreads(stPinchThreadSet *threadSet, const int64_t *names, const int64_t *starts, const int64_t *lengths,
+        int64_t threadNumber);
+
+/*
+ * Returns the thread with the given name, or NULL if there is none. While the names of the threads are consecutive
+ * in the order the threads were added, the lookup is direct, else it is through a table hashed by name.
+ */
 stPinchThread *stPinchThreadSet_getThread(stPinchThreadSet *threadSet, int64_t name);
 
+/*
+ * Returns the thread with the given index, the number of threads added to the thread set before it.
+ */
+stPinchThread *stPinchThreadSet_getThreadByIndex(stPinchThreadSet *threadSet, int64_t index);
+
 stPinchSegment *stPinchThreadSet_getSegment(stPinchThreadSet *threadSet, int64_t name, int64_t coordinate);
 
 int64_t stPinchThreadSet_getSize(stPinchThreadSet *threadSet);
@@ -81,18 +124,152 @@ stPinchThreadSetIt stPinchThreadSet_getIt(stPinchThreadSet *threadSet);
 
 stPinchThread *stPinchThreadSetIt_getNext(stPinchThreadSetIt *);
 
+/*
+ * Joins every trivial boundary and every pair of adjacent unaligned segments. Of the two blocks either side of a
+ * trivial boundary, the one earlier in the registry (see stPinchThreadSet_getBlockIt) is kept.
+ */
 void stPinchThreadSet_joinTrivialBoundaries(stPinchThreadSet *threadSet);
 
+/*
+ * As stPinchThreadSet_joinTrivialBoundaries, but the threads are divided into groups joined by blocks, and the
+ * boundaries of the groups are joined concurrently. The resulting graph is identical to that of
+ * stPinchThreadSet_joinTrivialBoundaries. Requires compilation with OpenMP, otherwise the boundaries are joined serially.
+ */
+void stPinchThreadSet_joinTrivialBoundariesParallel(stPinchThreadSet *threadSet);
+
+/*
+ * Switches on or off the recording of where the graph changes between joins of trivial boundaries. While it is on,
+ * stPinchThreadSet_joinTrivialBoundaries and stPinchThreadSet_joinTrivialBoundariesParallel examine only the
+ * segments and blocks changed since the last join, rather than the whole graph; the first join after switching it
+ * on is a full join. The resulting graph is identical to that of a full join: joining the trivial boundaries of a
+ * run of blocks always keeps the block of the run earliest in the registry, with its orientation.
+ */
+void stPinchThreadSet_setTrivialBoundaryTracking(stPinchThreadSet *threadSet, bool track);
+
+/*
+ * Moves the segments into fresh storage, with the segments of each thread contiguous and in 5' to 3' order, so that
+ * walks along threads are sequential in memory, and releases the space of destroyed segments. The graph is unchanged,
+ * but any pointers to segments held by the caller are invalidated.
+ */
+void stPinchThreadSet_compactSegments(stPinchThreadSet *threadSet);
+
+/*
+ * Trims blockEndTrim columns from each end of every block of the thread set, as stPinchBlock_trim does, leaving the
+ * trimmed columns unaligned. Blocks no longer than twice blockEndTrim are destructed. Unlike stPinchBlock_trim, each
+ * block trimmed is kept, moved onto the middles of its segments, so that it keeps its id, its place in the registry
+ * and the order and orientations of its segments.
+ */
+void stPinchThreadSet_trimAllBlocks(stPinchThreadSet *threadSet, int64_t blockEndTrim);
+
+/*
+ * As stPinchThreadSet_trimAllBlocks, but the segments of different threads are split concurrently, and then the
+ * blocks are moved onto the trimmed segments concurrently. The resulting graph is identical to that of
+ * stPinchThreadSet_trimAllBlocks, down to the ids of the blocks and their order in the registry. Requires compilation
+ * with OpenMP, otherwise the blocks are trimmed serially.
+ */
+void stPinchThreadSet_trimAllBlocksParallel(stPinchThreadSet *threadSet, int64_t blockEndTrim);
+
+/*
+ * Transactions. While a transaction is open every change to the graph is logged, so that rollback restores the graph
+ * as it was when the transaction began, in time proportional to the number of changes made. Segments and blocks
+ * destroyed during the transaction are not released until commit, and those created during it are released by
+ * rollback. Only one transaction may be open at a time. While one is open stPinchThreadSet_pinchBatchParallel,
+ * stPinchThreadSet_joinTrivialBoundariesParallel and stPinchThreadSet_trimAllBlocksParallel run serially and
+ * stPinchThreadSet_compactSegments may not be called.
+ */
+void stPinchThreadSet_beginTransaction(stPinchThreadSet *threadSet);
+
+void stPinchThreadSet_commitTransaction(stPinchThreadSet *threadSet);
+
+void stPinchThreadSet_rollbackTransaction(stPinchThreadSet *threadSet);
+
+/*
+ * Writes the graph to a binary file, and reads such a file back, mapping it into memory. The loaded graph is
+ * identical to the one saved, including the order of the segments in each block.
+ */
+void stPinchThreadSet_saveSnapshot(stPinchThreadSet *threadSet, const char *fileName);
+
+stPinchThreadSet *stPinchThreadSet_loadSnapshot(const char *fileName);
+
 stPinchSegment *stPinchThreadSet_getSegment(stPinchThreadSet *threadSet, int64_t name, int64_t coordinate);
 
+/*
+ * Returns the number of blocks in the thread set, in constant time.
+ */
 int64_t stPinchThreadSet_getTotalBlockNumber(stPinchThreadSet *threadSet);
 
+/*
+ * Returns a bound on the ids of the blocks in the thread set, see stPinchBlock_getId, so that arrays of this length
+ * (or twice it, for pinch ends) can map blocks (or ends) to values.
+ */
+int64_t stPinchThreadSet_getBlockIdBound(stPinchThreadSet *threadSet);
+
 stList *stPinchThreadSet_getAdjacencyComponents(stPinchThreadSet *threadSet);
 
 stList *stPinchThreadSet_getAdjacencyComponents2(stPinchThreadSet *threadSet, stHash **edgeEndsToAdjacencyComponents);
 
+/*
+ * As stPinchThreadSet_getAdjacencyComponents2, but computed in parallel with OpenMP, by scanning the threads
+ * concurrently and joining the ends of consecutive aligned segments in a concurrent union-find. The result does not
+ * depend on the number of threads: the components are ordered by their first ends, and the ends within them ordered,
+ * as the blocks are by stPinchThreadSet_getBlockIt, the 0 end of a block before its 1 end.
+ */
+stList *stPinchThreadSet_getAdjacencyComponentsParallel(stPinchThreadSet *threadSet, stHash **endsToAdjacencyComponents);
+
+/*
+ * Turns tracking of adjacency components on or off. While tracked, the thread set records where pinching, splitting
+ * and joining change the blocks, and the next adjacency component query relabels only the components around those
+ * changes, so that stPinchThreadSet_getAdjacencyComponents(2) need not search the whole graph. The components are the
+ * same as when not tracked, but they are ordered by their first ends, and the ends within them ordered, as the blocks
+ * are by stPinchThreadSet_getBlockIt, the 0 end of a block before its 1 end.
+ */
+void stPinchThreadSet_setAdjacencyComponentTracking(stPinchThreadSet *threadSet, bool track);
+
+/*
+ * Returns a label for the adjacency component of the end, equal for two ends if and only if they are in the same
+ * component. Requires that adjacency components are tracked. Labels may change when the graph is changed.
+ */
+int64_t stPinchThreadSet_getAdjacencyComponentLabel(stPinchThreadSet *threadSet, stPinchEnd *end);
+
+/*
+ * Thread components, the sets of threads joined by blocks. They are maintained as blocks gain segments, so the
+ * queries take time logarithmic in the number of threads at worst, except that after a segment has left a block,
+ * whether by removal, trimming or destruction of its block, the first query rebuilds them in time linear in the size
+ * of the graph.
+ */
 stSortedSet *stPinchThreadSet_getThreadComponents(stPinchThreadSet *threadSet);
 
+int64_t stPinchThreadSet_getThreadComponentNumber(stPinchThreadSet *threadSet);
+
+/*
+ * Returns the name of a thread in the component of the thread, the same for two threads if and only if they are
+ * in the same component. Labels may change when the graph is changed.
+ */
+int64_t stPinchThreadSet_getThreadComponentLabel(stPinchThreadSet *threadSet, stPinchThread *thread);
+
+bool stPinchThreadSet_threadsAreInSameComponent(stPinchThreadSet *threadSet, stPinchThread *thread1, stPinchThread *thread2);
+
+/*
+ * Applies the pinches in the array, in order, giving exactly the graph that calling stPinchThread_pinch on each in
+ * turn would. Thread and segment lookups are shared between successive pinches, so batches in which successive
+ * pinches involve the same threads at nearby coordinates (e.g. the gapless blocks of an alignment) are fastest.
+ */
+void stPinchThreadSet_pinchBatch(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber);
+
+/*
+ * As stPinchThreadSet_pinchBatch, but name1 and name2 of each pinch are the indices of its threads
+ * (see stPinchThread_getIndex) rather than their names, so that no thread need be looked up by name.
+ */
+void stPinchThreadSet_pinchBatchByIndex(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber);
+
+/*
+ * As stPinchThreadSet_pinchBatch, but the pinches are divided into groups that share no threads, directly or via
+ * existing blocks, and the groups are pinched concurrently. The resulting graph is identical to that of
+ * stPinchThreadSet_pinchBatch, down to the ids of the blocks and their order in the registry, see
+ * stPinchThreadSet_getBlockIt. Requires compilation with OpenMP, otherwise the pinches are applied serially.
+ */
+void stPinchThreadSet_pinchBatchParallel(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber);
+
 stPinchThreadSet *stPinchThreadSet_getRandomEmptyGraph(void);
 
 stPinch stPinchThreadSet_getRandomPinch(stPinchThreadSet *threadSet);
@@ -105,6 +282,12 @@ stPinchThreadSetSegmentIt stPinchThreadSet_getSegmentIt(stPinchThreadSet *thread
 
 stPinchSegment *stPinchThreadSetSegmentIt_getNext(stPinchThreadSetSegmentIt *segmentIt);
 
+/*
+ * Iterates over the blocks of the thread set, which keeps a registry of them, so that the cost is proportional to the
+ * number of blocks rather than of segments. Blocks are returned in the order they were constructed, those constructed
+ * by stPinchThreadSet_pinchBatchParallel in the order stPinchThreadSet_pinchBatch would have constructed them. During
+ * the iteration only the block last returned may be removed from the thread set.
+ */
 stPinchThreadSetBlockIt stPinchThreadSet_getBlockIt(stPinchThreadSet *threadSet);
 
 stPinchBlock *stPinchThreadSetBlockIt_getNext(stPinchThreadSetBlockIt *blockIt);
@@ -113,6 +296,8 @@ stPinchBlock *stPinchThreadSetBlockIt_getNext(stPinchThreadSetBlockIt *blockIt);
 
 int64_t stPinchThread_getName(stPinchThread *stPinchThread);
 
+int64_t stPinchThread_getIndex(stPinchThread *thread);
+
 int64_t stPinchThread_getStart(stPinchThread *stPinchThread);
 
 int64_t stPinchThread_getLength(stPinchThread *stPinchThread);
@@ -132,6 +317,18 @@ void stPinchThread_pinch(stPinchThread *thread1, stPinchThread *thread2, int64_t
 void stPinchThread_filterPinch(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2,
         int64_t length, bool strand2, bool(*filterFn)(stPinchSegment *, stPinchSegment *));
 
+/*
+ * As stPinchThread_filterPinch, but the filter is called on a batch of consecutive pairs of aligned segments at once,
+ * so that it can evaluate them together. For each of the pairNumber pairs it sets filtered[i] to true if the columns
+ * covered by segments1[i] and segments2[i] should not be pinched. The filter must depend only on the segments of the
+ * pairs and their blocks. Pairs changed by the pinching of earlier pairs of a batch are passed to the filter again,
+ * so the result is the same as filtering and pinching the pairs one by one.
+ */
+void stPinchThread_filterPinch2(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2,
+        int64_t length, bool strand2,
+        void (*filterFn)(stPinchSegment **segments1, stPinchSegment **segments2, bool *filtered, int64_t pairNumber, void *extraArg),
+        void *extraArg);
+
 //Segments
 
 int64_t stPinchSegment_getStart(stPinchSegment *segment);
@@ -154,6 +351,11 @@ void stPinchSegment_split(stPinchSegment *segment, int64_t leftSideOfSplitPoint)
 
 void stPinchSegment_putSegmentFirstInBlock(stPinchSegment *segment);
 
+/*
+ * Removes the segment from its block, if it has one, destroying the block if it has no other segments.
+ */
+void stPinchSegment_removeFromBlock(stPinchSegment *segment);
+
 //Blocks
 
 stPinchBlock *stPinchBlock_construct3(stPinchSegment *segment, bool orientation);
@@ -178,6 +380,12 @@ stPinchSegment *stPinchBlock_getFirst(stPinchBlock *block);
 
 uint64_t stPinchBlock_getDegree(stPinchBlock *block);
 
+/*
+ * Returns the id of the block, fixed for its lifetime and unique among the blocks of its thread set. Ids are dense:
+ * the id of a destructed block is reused for a later one, and all are less than stPinchThreadSet_getBlockIdBound.
+ */
+int64_t stPinchBlock_getId(stPinchBlock *block);
+
 void stPinchBlock_trim(stPinchBlock *block, int64_t blockEndTrim);
 
 //Block ends
@@ -194,6 +402,11 @@ stPinchBlock *stPinchEnd_getBlock(stPinchEnd *end);
 
 bool stPinchEnd_getOrientation(stPinchEnd *end);
 
+/*
+ * Returns 2 * the id of the end's block + its orientation, a dense id for the end.
+ */
+int64_t stPinchEnd_getId(stPinchEnd *end);
+
 int stPinchEnd_equalsFn(const void *, const void *);
 
 uint64_t stPinchEnd_hashFn(const void *);
@@ -208,12 +421,36 @@ void stPinchEnd_joinTrivialBoundary(stPinchEnd end);
 
 stSet *stPinchEnd_getConnectedPinchEnds(stPinchEnd *end);
 
+/*
+ * Calls visitFn once for each distinct end connected to the end, with an end valid only for the call. The ends are
+ * deduplicated in a table on the stack, so no memory is allocated unless the block has more than 32 segments.
+ */
+void stPinchEnd_visitConnectedPinchEnds(stPinchEnd *end, void (*visitFn)(stPinchEnd *, void *), void *extraArg);
+
+/*
+ * Fills in the ends connected to the end, up to maxEndNumber of them, and returns their number, which if greater than
+ * maxEndNumber means the array was too small. The number is at most the degree of the end's block.
+ */
+int64_t stPinchEnd_getConnectedPinchEnds2(stPinchEnd *end, stPinchEnd *ends, int64_t maxEndNumber);
+
+/*
+ * Counts the connected ends, without allocating memory, as stPinchEnd_visitConnectedPinchEnds.
+ */
 int64_t stPinchEnd_getNumberOfConnectedPinchEnds(stPinchEnd *end);
 
 bool stPinchEnd_hasSelfLoopWithRespectToOtherBlock(stPinchEnd *end, stPinchBlock *otherBlock);
 
 stList *stPinchEnd_getSubSequenceLengthsConnectingEnds(stPinchEnd *end, stPinchEnd *otherEnd);
 
+/*
+ * Switches on or off the keeping of block segment indices, each the segments of a block sorted by thread and start.
+ * While it is on, stPinchEnd_hasSelfLoopWithRespectToOtherBlock and stPinchEnd_getSubSequenceLengthsConnectingEnds
+ * merge the indices of the blocks, building an index when a block is first queried or its segments have changed,
+ * rather than copying and sorting the blocks' segments on every call. Indices are built holding a lock of the thread
+ * set, so these queries remain safe to call concurrently.
+ */
+void stPinchThreadSet_setBlockSegmentIndexing(stPinchThreadSet *threadSet, bool index);
+
 //Pinch structure
 
 void stPinch_fillOut(stPinch *pinch, int64_t name1, int64_t name2, int64_t start1, int64_t start2, int64_t length, bool strand);
@@ -248,6 +485,35 @@ stSortedSet *stPinchThreadSet_getLabelIntervals(stPinchThreadSet *threadSet, stH
 
 stPinchInterval *stPinchIntervals_getInterval(stSortedSet *pinchIntervals, int64_t name, int64_t position);
 
+/*
+ * A flat index of the label intervals, as returned by stPinchThreadSet_getLabelIntervals, holding the intervals of
+ * each thread in one sorted array, so that a lookup is a binary search of contiguous starts.
+ */
+stPinchIntervalIndex *stPinchThreadSet_getLabelIntervalIndex(stPinchThreadSet *threadSet, stHash *pinchEndsToLabels);
+
+/*
+ * As stPinchThreadSet_getLabelIntervalIndex, but the intervals of the threads are made in parallel with OpenMP. The
+ * index is identical.
+ */
+stPinchIntervalIndex *stPinchThreadSet_getLabelIntervalIndexParallel(stPinchThreadSet *threadSet, stHash *pinchEndsToLabels);
+
+void stPinchIntervalIndex_destruct(stPinchIntervalIndex *index);
+
+int64_t stPinchIntervalIndex_getSize(stPinchIntervalIndex *index);
+
+/*
+ * Returns the interval containing the position, or NULL if there is none. The interval is owned by the index.
+ */
+stPinchInterval *stPinchIntervalIndex_getInterval(stPinchIntervalIndex *index, int64_t name, int64_t position);
+
+/*
+ * Sets intervals[i] to the interval containing positions[i] of the named thread, or NULL if there is none, for
+ * each of the positions, which must be sorted in increasing order. The positions are resolved in one scan of the
+ * thread's intervals, skipping ahead by exponential search, so a batch costs less than a lookup per position.
+ */
+void stPinchIntervalIndex_getIntervals(stPinchIntervalIndex *index, int64_t name, const int64_t *positions, int64_t positionNumber,
+        stPinchInterval **intervals);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,5 +7,9 @@ libPath=${sonLibPath}
 
 include  ${sonLibRootPath}/include.mk
 
+#Compiler flags enabling OpenMP, used by the parallel pinch graph functions. Set to empty to build without it,
+#in which case those functions run serially.
+openmpFlags ?= -fopenmp
+
 basicLibs = ${sonLibPath}/sonLib.a ${sonLibPath}/cuTest.a ${dblibs}
 basicLibsDependencies = ${sonLibPath}/sonLib.a ${sonLibPath}/cuTest.a 
@@ -9,11 +9,13 @@
 
 CuSuite* stCactusGraphsTestSuite(void);
 CuSuite* stPinchGraphsTestSuite(void);
+CuSuite* stPinchAlignmentsTestSuite(void);
 
 int stPinchesAndCactiRunAllTests(void) {
     CuString *output = CuStringNew();
     CuSuite* suite = CuSuiteNew();
     CuSuiteAddSuite(suite, stPinchGraphsTestSuite());
+    CuSuiteAddSuite(suite, stPinchAlignmentsTestSuite());
     CuSuiteAddSuite(suite, stCactusGraphsTestSuite());
 
     CuSuiteRun(suite);
@@ -0,0 +1,223 @@
+/*
+ * stPinchAlignmentsTest.c
+ *
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "stPinchGraphs.h"
+#include "stPinchAlignments.h"
+#include "stPinchTestCommon.h"
+
+static void pinchAll(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber) {
+    for (int64_t i = 0; i < pinchNumber; i++) {
+        stPinch *pinch = &pinches[i];
+        stPinchThread_pinch(stPinchThreadSet_getThread(threadSet, pinch->name1), stPinchThreadSet_getThread(threadSet, pinch->name2),
+                pinch->start1, pinch->start2, pinch->length, pinch->strand);
+    }
+}
+
+static FILE *getTempFile(const char *string) {
+    FILE *fileHandle = tmpfile();
+    fputs(string, fileHandle);
+    rewind(fileHandle);
+    return fileHandle;
+}
+
+static void testStPinchThreadSet_addThreadsFromFile(CuTest *testCase) {
+    stPinchThreadSet *threadSet = stPinchThreadSet_construct();
+    stPinchThreadSet_addThread(threadSet, 1, 0, 5);
+    FILE *fileHandle = getTempFile("7\t100\t6\t60\t61\n\n3\t20\n-2\t1\t130\t60\t61\n");
+    stPinchThreadSet_addThreadsFromFile(threadSet, fileHandle);
+    fclose(fileHandle);
+    CuAssertIntEquals(testCase, 4, stPinchThreadSet_getSize(threadSet));
+    int64_t names[] = { 1, 7, 3, -2 }, lengths[] = { 5, 100, 20, 1 };
+    for (int64_t i = 0; i < 4; i++) {
+        stPinchThread *thread = stPinchThreadSet_getThreadByIndex(threadSet, i);
+        CuAssertPtrEquals(testCase, thread, stPinchThreadSet_getThread(threadSet, names[i]));
+        CuAssertIntEquals(testCase, 0, stPinchThread_getStart(thread));
+        CuAssertIntEquals(testCase, lengths[i], stPinchThread_getLength(thread));
+    }
+    stPinchThreadSet_destruct(threadSet);
+}
+
+static void testStPinchThreadSet_pinchPAF(CuTest *testCase) {
+    const char *pafs[] = {
+            "1\t100\t10\t30\t+\t2\t100\t20\t41\t18\t21\t60\tcg:Z:5M1I4=2D10M\n"
+            "1\t100\t50\t60\t-\t2\t100\t70\t81\t10\t11\t60\tcg:Z:4M1D6M\n",
+            "1\t100\t10\t30\t+\t2\t100\t20\t41\t18\t21\t60\ttp:A:P\tcs:Z::5+a:4-gg:3*ac:6\n"
+            "\n"
+            "1\t100\t50\t60\t-\t2\t100\t70\t81\t10\t11\t60\tcs:Z::4-t:6\n" };
+    //Thread 1 starts at 5, so its coordinates are offset from those in the files
+    stPinch pinches[] = { stPinch_constructStatic(1, 2, 15, 20, 5, 1), stPinch_constructStatic(1, 2, 21, 25, 4, 1),
+            stPinch_constructStatic(1, 2, 25, 31, 10, 1), stPinch_constructStatic(1, 2, 61, 70, 4, 0),
+            stPinch_constructStatic(1, 2, 55, 75, 6, 0) };
+    for (int64_t i = 0; i < 2; i++) {
+        stPinchThreadSet *threadSet = stPinchThreadSet_construct();
+        stPinchThreadSet_addThread(threadSet, 1, 5, 100);
+        stPinchThreadSet_addThread(threadSet, 2, 0, 100);
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        pinchAll(threadSet, pinches, 5);
+        FILE *fileHandle = getTempFile(pafs[i]);
+        stPinchAlignmentCounters counters;
+        memset(&counters, 0, sizeof(stPinchAlignmentCounters));
+        stPinchThreadSet_pinchPAF(threadSet2, fileHandle, 2, 0, &counters);
+        fclose(fileHandle);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        CuAssertIntEquals(testCase, 2, counters.alignmentNumber);
+        CuAssertIntEquals(testCase, 5, counters.pinchNumber);
+        CuAssertIntEquals(testCase, 29, counters.alignedBases);
+        CuAssertIntEquals(testCase, 3, counters.chunkNumber);
+        CuAssertIntEquals(testCase, strlen(pafs[i]), counters.bytesRead);
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+/*
+ * Appends a run of aligned columns to the cg or cs string, split at random into pieces.
+ */
+static void appendRun(stList *strings, int64_t length, bool cs) {
+    while (length > 0) {
+        int64_t i = st_randomInt(1, length + 1);
+        if (cs) {
+            stList_append(strings, i == 1 && st_random() > 0.5 ? stString_copy("*ac") : stString_print(":%" PRIi64, i));
+        } else {
+            stList_append(strings, stString_print("%" PRIi64 "%c", i, "M=X"[st_randomInt(0, 3)]));
+        }
+        length -= i;
+    }
+}
+
+static void appendGap(stList *strings, int64_t length, bool query, bool cs) {
+    if (cs) {
+        char *bases = st_malloc(length + 1);
+        memset(bases, 'g', length);
+        bases[length] = '\0';
+        stList_append(strings, stString_print("%c%s", query ? '+' : '-', bases));
+        free(bases);
+    } else {
+        stList_append(strings, stString_print("%" PRIi64 "%c", length, query ? 'I' : 'D'));
+    }
+}
+
+/*
+ * Makes a random PAF record between two threads of the graph, appending the pinches it implies, or returns NULL
+ * if the random alignment does not fit in the threads.
+ */
+static char *getRandomPAFRecord(stPinchThreadSet *threadSet, stList *pinches) {
+    stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet);
+    stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, pinch.name1);
+    stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, pinch.name2);
+    bool cs = st_random() > 0.5;
+    stList *strings = stList_construct3(0, free);
+    int64_t runNumber = st_randomInt(1, 5), queryLength = 0, targetLength = 0;
+    stList *runs = stList_construct3(0, free);
+    for (int64_t i = 0; i < runNumber; i++) {
+        if (i > 0) {
+            int64_t j = st_randomInt(1, 5);
+            bool query = st_random() > 0.5;
+            appendGap(strings, j, query, cs);
+            queryLength += query ? j : 0;
+            targetLength += query ? 0 : j;
+        }
+        int64_t length = st_randomInt(1, 10);
+        appendRun(strings, length, cs);
+        stList_append(runs, stPinch_construct(0, 0, queryLength, targetLength, length, 0));
+        queryLength += length;
+        targetLength += length;
+    }
+    char *record = NULL;
+    if (queryLength <= stPinchThread_getLength(thread1) && targetLength <= stPinchThread_getLength(thread2)) {
+        int64_t queryStart = st_randomInt(0, stPinchThread_getLength(thread1) - queryLength + 1);
+        int64_t targetStart = st_randomInt(0, stPinchThread_getLength(thread2) - targetLength + 1);
+        for (int64_t i = 0; i < stList_length(runs); i++) {
+            stPinch *run = stList_get(runs, i);
+            int64_t start1 = stPinchThread_getStart(thread1) + (pinch.strand ? queryStart + run->start1 : queryStart + queryLength - run->start1 - run->length);
+            stList_append(pinches, stPinch_construct(pinch.name1, pinch.name2, start1,
+                    stPinchThread_getStart(thread2) + targetStart + run->start2, run->length, pinch.strand));
+        }
+        char *alignment = stString_join2("", strings);
+        record = stString_print("%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%c\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t0\t0\t255\t%s:Z:%s\n",
+                pinch.name1, stPinchThread_getLength(thread1), queryStart, queryStart + queryLength, pinch.strand ? '+' : '-',
+                pinch.name2, stPinchThread_getLength(thread2), targetStart, targetStart + targetLength, cs ? "cs" : "cg", alignment);
+        free(alignment);
+    }
+    stList_destruct(runs);
+    stList_destruct(strings);
+    return record;
+}
+
+static void testStPinchThreadSet_pinchPAF_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random PAF pinch test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        stList *pinches = stList_construct3(0, (void(*)(void *)) stPinch_destruct);
+        FILE *fileHandle = tmpfile();
+        int64_t alignmentNumber = st_randomInt(0, 50);
+        for (int64_t i = 0; i < alignmentNumber; i++) {
+            char *record = getRandomPAFRecord(threadSet, pinches);
+            fputs(record != NULL ? record : "\n", fileHandle);
+            free(record);
+        }
+        rewind(fileHandle);
+        for (int64_t i = 0; i < stList_length(pinches); i++) {
+            pinchAll(threadSet, stList_get(pinches, i), 1);
+        }
+        stPinchAlignmentCounters counters;
+        memset(&counters, 0, sizeof(stPinchAlignmentCounters));
+        stPinchThreadSet_pinchPAF(threadSet2, fileHandle, st_randomInt(1, 10), st_random() > 0.5, &counters);
+        fclose(fileHandle);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        CuAssertIntEquals(testCase, stList_length(pinches), counters.pinchNumber);
+        stList_destruct(pinches);
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+static void testStPinchThreadSet_pinchBinary_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random binary pinch test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        int64_t pinchNumber = st_randomInt(0, 100);
+        stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+        }
+        FILE *fileHandle = tmpfile();
+        stPinch_writeBinaryHeader(fileHandle);
+        stPinch_writeBinary(fileHandle, pinches, pinchNumber);
+        rewind(fileHandle);
+        pinchAll(threadSet, pinches, pinchNumber);
+        stPinchAlignmentCounters counters;
+        memset(&counters, 0, sizeof(stPinchAlignmentCounters));
+        stPinchThreadSet_pinchBinary(threadSet2, fileHandle, st_randomInt(1, 10), st_random() > 0.5, &counters);
+        fclose(fileHandle);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        CuAssertIntEquals(testCase, pinchNumber, counters.alignmentNumber);
+        int64_t alignedBases = 0;
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            alignedBases += pinches[i].length;
+        }
+        CuAssertIntEquals(testCase, alignedBases, counters.alignedBases);
+        free(pinches);
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+CuSuite* stPinchAlignmentsTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_addThreadsFromFile);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_pinchPAF);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_pinchPAF_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_pinchBinary_randomTests);
+
+    return suite;
+}
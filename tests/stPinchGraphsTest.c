@@ -12,6 +12,7 @@
 #include "CuTest.h"
 #include "sonLib.h"
 #include "stPinchGraphs.h"
+#include "stPinchTestCommon.h"
 
 static stPinchThreadSet *threadSet = NULL;
 static int64_t name1 = 0, start1 = 1, length1 = INT64_MAX - 1;
@@ -162,6 +163,47 @@ static void testStPinchThreadAndSegment(CuTest *testCase) {
     teardown();
 }
 
+static void checkSegmentLookups(CuTest *testCase, stPinchThread *thread) {
+    CuAssertPtrEquals(testCase, NULL, stPinchThread_getSegment(thread, stPinchThread_getStart(thread) - 1));
+    CuAssertPtrEquals(testCase, NULL,
+            stPinchThread_getSegment(thread, stPinchThread_getStart(thread) + stPinchThread_getLength(thread)));
+    stPinchSegment *segment = stPinchThread_getFirst(thread), *pSegment = NULL;
+    while (segment != NULL) {
+        CuAssertPtrEquals(testCase, segment, stPinchThread_getSegment(thread, stPinchSegment_getStart(segment)));
+        CuAssertPtrEquals(testCase, segment,
+                stPinchThread_getSegment(thread, stPinchSegment_getStart(segment) + stPinchSegment_getLength(segment) - 1));
+        pSegment = segment;
+        segment = stPinchSegment_get3Prime(segment);
+    }
+    CuAssertPtrEquals(testCase, pSegment, stPinchThread_getLast(thread));
+}
+
+static void testStPinchThread_getSegment_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 10; test++) {
+        st_logInfo("Starting random segment lookup test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_construct();
+        int64_t start = st_randomInt(0, 100), length = st_randomInt(1, 100000);
+        stPinchThread *thread = stPinchThreadSet_addThread(threadSet, 1, start, length);
+        //Split in many places, enough to exercise the splitting of the index
+        int64_t splitNumber = st_randomInt(0, 10000);
+        for (int64_t i = 0; i < splitNumber; i++) {
+            stPinchThread_split(thread, st_randomInt(start, start + length));
+        }
+        checkSegmentLookups(testCase, thread);
+        //Now join a random subset of the segments back together, exercising the removal of segments
+        stPinchSegment *segment = stPinchThread_getFirst(thread);
+        while (segment != NULL) {
+            if (st_random() > 0.5) {
+                stPinchBlock_construct2(segment);
+            }
+            segment = stPinchSegment_get3Prime(segment);
+        }
+        stPinchThread_joinTrivialBoundaries(thread);
+        checkSegmentLookups(testCase, thread);
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
 static void testStPinchBlock_NoSplits(CuTest *testCase) {
     setup();
     static int64_t name3 = 5, start3 = 0, length3 = 20;
@@ -629,6 +671,604 @@ static void testStPinchThread_pinch_randomTests(CuTest *testCase) {
     }
 }
 
+stPinchThreadSet *copyEmptyGraph(stPinchThreadSet *threadSet) {
+    stPinchThreadSet *threadSet2 = stPinchThreadSet_construct();
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        stPinchThreadSet_addThread(threadSet2, stPinchThread_getName(thread), stPinchThread_getStart(thread),
+                stPinchThread_getLength(thread));
+    }
+    return threadSet2;
+}
+
+void checkSegmentsAreIdentical(CuTest *testCase, stPinchSegment *segment1, stPinchSegment *segment2) {
+    CuAssertIntEquals(testCase, stPinchSegment_getName(segment1), stPinchSegment_getName(segment2));
+    CuAssertIntEquals(testCase, stPinchSegment_getStart(segment1), stPinchSegment_getStart(segment2));
+    CuAssertIntEquals(testCase, stPinchSegment_getLength(segment1), stPinchSegment_getLength(segment2));
+}
+
+void checkThreadSetsAreIdentical(CuTest *testCase, stPinchThreadSet *threadSet1, stPinchThreadSet *threadSet2) {
+    CuAssertIntEquals(testCase, stPinchThreadSet_getSize(threadSet1), stPinchThreadSet_getSize(threadSet2));
+    stPinchThreadSetSegmentIt segmentIt1 = stPinchThreadSet_getSegmentIt(threadSet1);
+    stPinchThreadSetSegmentIt segmentIt2 = stPinchThreadSet_getSegmentIt(threadSet2);
+    stPinchSegment *segment1, *segment2;
+    while ((segment1 = stPinchThreadSetSegmentIt_getNext(&segmentIt1)) != NULL) {
+        segment2 = stPinchThreadSetSegmentIt_getNext(&segmentIt2);
+        CuAssertTrue(testCase, segment2 != NULL);
+        checkSegmentsAreIdentical(testCase, segment1, segment2);
+        stPinchBlock *block1 = stPinchSegment_getBlock(segment1), *block2 = stPinchSegment_getBlock(segment2);
+        CuAssertIntEquals(testCase, block1 == NULL, block2 == NULL);
+        if (block1 != NULL) {
+            CuAssertIntEquals(testCase, stPinchBlock_getDegree(block1), stPinchBlock_getDegree(block2));
+            stPinchBlockIt blockIt1 = stPinchBlock_getSegmentIterator(block1);
+            stPinchBlockIt blockIt2 = stPinchBlock_getSegmentIterator(block2);
+            while ((segment1 = stPinchBlockIt_getNext(&blockIt1)) != NULL) {
+                segment2 = stPinchBlockIt_getNext(&blockIt2);
+                checkSegmentsAreIdentical(testCase, segment1, segment2);
+                CuAssertIntEquals(testCase, stPinchSegment_getBlockOrientation(segment1), stPinchSegment_getBlockOrientation(segment2));
+            }
+        }
+    }
+    CuAssertPtrEquals(testCase, NULL, stPinchThreadSetSegmentIt_getNext(&segmentIt2));
+}
+
+/*
+ * Checks the two graphs, already checked to be identical, have the same blocks in the same order in their registries,
+ * with the same ids.
+ */
+static void checkBlockRegistriesAreIdentical(CuTest *testCase, stPinchThreadSet *threadSet1, stPinchThreadSet *threadSet2) {
+    CuAssertIntEquals(testCase, stPinchThreadSet_getBlockIdBound(threadSet1), stPinchThreadSet_getBlockIdBound(threadSet2));
+    stPinchThreadSetBlockIt blockIt1 = stPinchThreadSet_getBlockIt(threadSet1);
+    stPinchThreadSetBlockIt blockIt2 = stPinchThreadSet_getBlockIt(threadSet2);
+    stPinchBlock *block1, *block2;
+    while ((block1 = stPinchThreadSetBlockIt_getNext(&blockIt1)) != NULL) {
+        block2 = stPinchThreadSetBlockIt_getNext(&blockIt2);
+        CuAssertTrue(testCase, block2 != NULL);
+        checkSegmentsAreIdentical(testCase, stPinchBlock_getFirst(block1), stPinchBlock_getFirst(block2));
+        CuAssertIntEquals(testCase, stPinchBlock_getId(block1), stPinchBlock_getId(block2));
+    }
+    CuAssertPtrEquals(testCase, NULL, stPinchThreadSetBlockIt_getNext(&blockIt2));
+}
+
+static void testStPinchThreadSet_pinchBatch_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random batch pinch test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        int64_t pinchNumber = st_randomInt(0, 100);
+        stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            if (i > 0 && st_random() > 0.5) { //Make runs of adjacent pinches, like the gapless blocks of an alignment
+                stPinch *pPinch = &pinches[i - 1];
+                stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, pPinch->name1);
+                stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, pPinch->name2);
+                int64_t start1 = pPinch->start1 + pPinch->length;
+                int64_t start2 = pPinch->strand ? pPinch->start2 + pPinch->length : pPinch->start2;
+                int64_t length1 = stPinchThread_getStart(thread1) + stPinchThread_getLength(thread1) - start1;
+                int64_t length2 = pPinch->strand ? stPinchThread_getStart(thread2) + stPinchThread_getLength(thread2) - start2 :
+                        start2 - stPinchThread_getStart(thread2);
+                int64_t length = st_randomInt(0, (length1 < length2 ? length1 : length2) + 1);
+                pinches[i] = stPinch_constructStatic(pPinch->name1, pPinch->name2, start1,
+                        pPinch->strand ? start2 : start2 - length, length, pPinch->strand);
+            } else {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+        }
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            stPinch *pinch = &pinches[i];
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet, pinch->name1), stPinchThreadSet_getThread(threadSet, pinch->name2),
+                    pinch->start1, pinch->start2, pinch->length, pinch->strand);
+        }
+        stPinchThreadSet_pinchBatch(threadSet2, pinches, pinchNumber);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        //Now by the indices of the threads
+        stPinchThreadSet *threadSet3 = copyEmptyGraph(threadSet);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            pinches[i].name1 = stPinchThread_getIndex(stPinchThreadSet_getThread(threadSet3, pinches[i].name1));
+            pinches[i].name2 = stPinchThread_getIndex(stPinchThreadSet_getThread(threadSet3, pinches[i].name2));
+        }
+        stPinchThreadSet_pinchBatchByIndex(threadSet3, pinches, pinchNumber);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet3);
+        free(pinches);
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+        stPinchThreadSet_destruct(threadSet3);
+    }
+}
+
+static void checkThreadLookups(CuTest *testCase, stPinchThreadSet *threadSet, stList *names) {
+    CuAssertIntEquals(testCase, stList_length(names), stPinchThreadSet_getSize(threadSet));
+    for (int64_t i = 0; i < stList_length(names); i++) {
+        int64_t name = stIntTuple_get(stList_get(names, i), 0);
+        stPinchThread *thread = stPinchThreadSet_getThread(threadSet, name);
+        CuAssertTrue(testCase, thread != NULL);
+        CuAssertIntEquals(testCase, name, stPinchThread_getName(thread));
+        CuAssertIntEquals(testCase, i, stPinchThread_getIndex(thread));
+        CuAssertPtrEquals(testCase, thread, stPinchThreadSet_getThreadByIndex(threadSet, i));
+    }
+    for (int64_t i = 0; i < 100; i++) { //Names not in the thread set are not found
+        int64_t name = st_randomInt(-1000, 1000);
+        bool present = 0;
+        for (int64_t j = 0; j < stList_length(names); j++) {
+            present = present || stIntTuple_get(stList_get(names, j), 0) == name;
+        }
+        CuAssertIntEquals(testCase, present, stPinchThreadSet_getThread(threadSet, name) != NULL);
+    }
+}
+
+static void testStPinchThreadSet_getThread_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random thread lookup test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_construct();
+        stList *names = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+        int64_t name = st_randomInt(-1000, 1000);
+        double denseness = st_random(); //The chance that the next name follows the last
+        for (int64_t round = 0; round < 5; round++) {
+            bool rollback = st_random() > 0.5;
+            if (rollback) {
+                stPinchThreadSet_beginTransaction(threadSet);
+            }
+            int64_t threadNumber = st_randomInt(0, 100), firstIndex = stList_length(names);
+            bool bulk = st_random() > 0.5; //Add the threads together, with stPinchThreadSet_addThreads
+            for (int64_t i = 0; i < threadNumber; i++) {
+                name = st_random() < denseness ? name + 1 : st_randomInt(-1000, 1000);
+                bool present = stPinchThreadSet_getThread(threadSet, name) != NULL;
+                for (int64_t j = firstIndex; j < stList_length(names) && bulk && !present; j++) {
+                    present = stIntTuple_get(stList_get(names, j), 0) == name;
+                }
+                if (!present) {
+                    if (!bulk) {
+                        stPinchThreadSet_addThread(threadSet, name, 0, 10);
+                    }
+                    stList_append(names, stIntTuple_construct1(name));
+                }
+            }
+            if (bulk) {
+                int64_t addedNumber = stList_length(names) - firstIndex;
+                int64_t *addedNames = st_malloc(sizeof(int64_t) * (addedNumber + 1));
+                int64_t *starts = st_malloc(sizeof(int64_t) * (addedNumber + 1));
+                int64_t *lengths = st_malloc(sizeof(int64_t) * (addedNumber + 1));
+                for (int64_t i = 0; i < addedNumber; i++) {
+                    addedNames[i] = stIntTuple_get(stList_get(names, firstIndex + i), 0);
+                    starts[i] = 0;
+                    lengths[i] = 10;
+                }
+                stPinchThreadSet_addThreads(threadSet, addedNames, starts, lengths, addedNumber);
+                free(addedNames);
+                free(starts);
+                free(lengths);
+            }
+            checkThreadLookups(testCase, threadSet, names);
+            if (rollback) {
+                stPinchThreadSet_rollbackTransaction(threadSet);
+                while (stList_length(names) > stPinchThreadSet_getSize(threadSet)) {
+                    stIntTuple_destruct(stList_pop(names));
+                }
+                checkThreadLookups(testCase, threadSet, names);
+            }
+        }
+        stList_destruct(names);
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
+static stPinch getRandomPinchWithinPairsOfThreads(stPinchThreadSet *threadSet) {
+    //Mostly pinches between threads paired by name, so that the pinches form several independent groups
+    while (1) {
+        stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet);
+        if ((pinch.name1 ^ 1) == pinch.name2 || pinch.name1 == pinch.name2 || st_random() > 0.95) {
+            return pinch;
+        }
+    }
+}
+
+static void testStPinchThreadSet_pinchBatchParallel_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random parallel batch pinch test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        //Make some blocks to begin with, as they link threads too
+        int64_t pinchNumber = st_randomInt(0, 20);
+        stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            pinches[i] = getRandomPinchWithinPairsOfThreads(threadSet);
+        }
+        stPinchThreadSet_pinchBatch(threadSet, pinches, pinchNumber);
+        stPinchThreadSet_pinchBatch(threadSet2, pinches, pinchNumber);
+        free(pinches);
+        pinchNumber = st_randomInt(0, 100);
+        pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            pinches[i] = getRandomPinchWithinPairsOfThreads(threadSet);
+        }
+        stPinchThreadSet_pinchBatch(threadSet, pinches, pinchNumber);
+        stPinchThreadSet_pinchBatchParallel(threadSet2, pinches, pinchNumber);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        checkBlockRegistriesAreIdentical(testCase, threadSet, threadSet2);
+        //Check the second graph is still sound to modify, and reuses the ids of freed blocks as the first does
+        stPinchThreadSet_joinTrivialBoundaries(threadSet);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet2);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+        }
+        stPinchThreadSet_pinchBatch(threadSet, pinches, pinchNumber);
+        stPinchThreadSet_pinchBatch(threadSet2, pinches, pinchNumber);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        checkBlockRegistriesAreIdentical(testCase, threadSet, threadSet2);
+        free(pinches);
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+static void testStPinchThreadSet_compactSegments_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random compact segments test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        for (int64_t round = 0; round < 2; round++) {
+            int64_t pinchNumber = st_randomInt(0, 100);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            stPinchThreadSet_pinchBatch(threadSet, pinches, pinchNumber);
+            stPinchThreadSet_pinchBatch(threadSet2, pinches, pinchNumber);
+            free(pinches);
+            if (st_random() > 0.5) {
+                stPinchThreadSet_joinTrivialBoundaries(threadSet);
+                stPinchThreadSet_joinTrivialBoundaries(threadSet2);
+            }
+            //Compacting must not change the graph, and the compacted graph must remain sound to modify
+            stPinchThreadSet_compactSegments(threadSet2);
+            checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        }
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+static stList *getBlockSegments(stPinchBlock *block) {
+    stList *segments = stList_construct();
+    stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(block);
+    stPinchSegment *segment;
+    while ((segment = stPinchBlockIt_getNext(&blockIt)) != NULL) {
+        stList_append(segments, segment);
+    }
+    return segments;
+}
+
+static void testStPinchSegment_putSegmentFirstInBlockAndRemoveFromBlock_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random block reordering test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
+        stList *segments = stList_construct();
+        stPinchThreadSetSegmentIt segmentIt = stPinchThreadSet_getSegmentIt(threadSet);
+        stPinchSegment *segment;
+        while ((segment = stPinchThreadSetSegmentIt_getNext(&segmentIt)) != NULL) {
+            stList_append(segments, segment);
+        }
+        for (int64_t i = 0; i < 100 && stList_length(segments) > 0; i++) {
+            segment = stList_get(segments, st_randomInt(0, stList_length(segments)));
+            stPinchBlock *block = stPinchSegment_getBlock(segment);
+            if (block == NULL) {
+                continue;
+            }
+            //Work out the order of the block's segments we expect after the change
+            stList *blockSegments = getBlockSegments(block);
+            int64_t degree = stList_length(blockSegments);
+            CuAssertIntEquals(testCase, degree, stPinchBlock_getDegree(block));
+            stList_removeItem(blockSegments, segment);
+            if (st_random() > 0.5) {
+                stPinchSegment_putSegmentFirstInBlock(segment);
+                stList_insert(blockSegments, 0, segment);
+            } else {
+                stPinchSegment_removeFromBlock(segment);
+                CuAssertPtrEquals(testCase, NULL, stPinchSegment_getBlock(segment));
+                if (degree == 1) {
+                    stList_destruct(blockSegments);
+                    continue;
+                }
+            }
+            stList *blockSegments2 = getBlockSegments(block);
+            CuAssertIntEquals(testCase, stList_length(blockSegments), stList_length(blockSegments2));
+            CuAssertIntEquals(testCase, stList_length(blockSegments), stPinchBlock_getDegree(block));
+            for (int64_t j = 0; j < stList_length(blockSegments); j++) {
+                CuAssertPtrEquals(testCase, stList_get(blockSegments, j), stList_get(blockSegments2, j));
+                CuAssertPtrEquals(testCase, block, stPinchSegment_getBlock(stList_get(blockSegments, j)));
+            }
+            stList_destruct(blockSegments);
+            stList_destruct(blockSegments2);
+            if (st_random() > 0.9) { //Check the links stay sound through splits of the block
+                stPinchSegment_split(segment, stPinchSegment_getStart(segment) + st_randomInt(0, stPinchSegment_getLength(segment)));
+                stList_destruct(segments);
+                segments = stList_construct();
+                segmentIt = stPinchThreadSet_getSegmentIt(threadSet);
+                while ((segment = stPinchThreadSetSegmentIt_getNext(&segmentIt)) != NULL) {
+                    stList_append(segments, segment);
+                }
+            }
+        }
+        stList_destruct(segments);
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
+/*
+ * Applies a random mix of the operations that modify a graph, given by the pinches. The pinches' strand and length
+ * select the operation, so that applying the same pinches to identical graphs gives identical graphs.
+ */
+static void applyRandomOperations(stPinchThreadSet *threadSet, stPinch *pinches, int64_t pinchNumber, int64_t *newThreadName) {
+    for (int64_t i = 0; i < pinchNumber; i++) {
+        stPinch *pinch = &pinches[i];
+        stPinchSegment *segment = stPinchThreadSet_getSegment(threadSet, pinch->name1, pinch->start1);
+        switch ((pinch->start2 + pinch->length) % 8) {
+        case 0:
+            stPinchThreadSet_joinTrivialBoundaries(threadSet);
+            break;
+        case 1:
+            stPinchSegment_putSegmentFirstInBlock(segment);
+            break;
+        case 2:
+            stPinchSegment_removeFromBlock(segment);
+            break;
+        case 3:
+            stPinchSegment_split(segment, pinch->start1);
+            break;
+        case 4:
+            if (stPinchSegment_getBlock(segment) != NULL) {
+                stPinchBlock_trim(stPinchSegment_getBlock(segment), pinch->length % 3);
+            }
+            break;
+        case 5:
+            stPinchThreadSet_addThread(threadSet, (*newThreadName)++, pinch->start2, pinch->length + 1);
+            break;
+        default:
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet, pinch->name1), stPinchThreadSet_getThread(threadSet, pinch->name2),
+                    pinch->start1, pinch->start2, pinch->length, pinch->strand);
+        }
+    }
+}
+
+static void testStPinchThreadSet_transactions_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random transaction test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        int64_t newThreadName = 1000, newThreadName2 = 1000;
+        for (int64_t round = 0; round < 5; round++) {
+            int64_t pinchNumber = st_randomInt(0, 50);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            stPinchThreadSet_beginTransaction(threadSet2);
+            if (st_random() > 0.5) { //Apply and commit, which must match applying without a transaction
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+                applyRandomOperations(threadSet2, pinches, pinchNumber, &newThreadName2);
+                stPinchThreadSet_commitTransaction(threadSet2);
+            } else { //Apply and roll back, which must leave the graph as it was
+                applyRandomOperations(threadSet2, pinches, pinchNumber, &newThreadName2);
+                newThreadName2 = newThreadName;
+                stPinchThreadSet_rollbackTransaction(threadSet2);
+            }
+            checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+            free(pinches);
+        }
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+/*
+ * Checks the adjacency components of two identical graphs partition their ends in the same way.
+ */
+static void checkAdjacencyComponentsAreEquivalent(CuTest *testCase, stPinchThreadSet *threadSet1, stPinchThreadSet *threadSet2) {
+    stHash *endsToAdjacencyComponents1, *endsToAdjacencyComponents2;
+    stList *adjacencyComponents1 = stPinchThreadSet_getAdjacencyComponents2(threadSet1, &endsToAdjacencyComponents1);
+    stList *adjacencyComponents2 = stPinchThreadSet_getAdjacencyComponents2(threadSet2, &endsToAdjacencyComponents2);
+    CuAssertIntEquals(testCase, stList_length(adjacencyComponents1), stList_length(adjacencyComponents2));
+    CuAssertIntEquals(testCase, stPinchThreadSet_getTotalBlockNumber(threadSet1), stPinchThreadSet_getTotalBlockNumber(threadSet2));
+    stHash *componentMap = stHash_construct();
+    stPinchThreadSetBlockIt blockIt1 = stPinchThreadSet_getBlockIt(threadSet1);
+    stPinchBlock *block1;
+    while ((block1 = stPinchThreadSetBlockIt_getNext(&blockIt1)) != NULL) {
+        //Find the corresponding block by the position of its first segment
+        stPinchSegment *segment1 = stPinchBlock_getFirst(block1);
+        stPinchSegment *segment2 = stPinchThreadSet_getSegment(threadSet2, stPinchSegment_getName(segment1),
+                stPinchSegment_getStart(segment1));
+        stPinchBlock *block2 = stPinchSegment_getBlock(segment2);
+        CuAssertTrue(testCase, block2 != NULL);
+        bool flip = stPinchSegment_getBlockOrientation(segment1) != stPinchSegment_getBlockOrientation(segment2);
+        for (int64_t orientation = 0; orientation < 2; orientation++) {
+            stPinchEnd end1 = stPinchEnd_constructStatic(block1, orientation);
+            stPinchEnd end2 = stPinchEnd_constructStatic(block2, orientation ^ flip);
+            stList *adjacencyComponent1 = stHash_search(endsToAdjacencyComponents1, &end1);
+            stList *adjacencyComponent2 = stHash_search(endsToAdjacencyComponents2, &end2);
+            CuAssertTrue(testCase, adjacencyComponent1 != NULL && adjacencyComponent2 != NULL);
+            CuAssertIntEquals(testCase, stList_length(adjacencyComponent1), stList_length(adjacencyComponent2));
+            stList *mappedAdjacencyComponent = stHash_search(componentMap, adjacencyComponent1);
+            if (mappedAdjacencyComponent == NULL) {
+                stHash_insert(componentMap, adjacencyComponent1, adjacencyComponent2);
+            } else {
+                CuAssertPtrEquals(testCase, mappedAdjacencyComponent, adjacencyComponent2);
+            }
+        }
+    }
+    stHash_destruct(componentMap);
+    stHash_destruct(endsToAdjacencyComponents1);
+    stHash_destruct(endsToAdjacencyComponents2);
+    stList_destruct(adjacencyComponents1);
+    stList_destruct(adjacencyComponents2);
+}
+
+static void testStPinchThreadSet_adjacencyComponentTracking_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random adjacency component tracking test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        stPinchThreadSet_setAdjacencyComponentTracking(threadSet2, 1);
+        int64_t newThreadName = 1000, newThreadName2 = 1000;
+        for (int64_t round = 0; round < 5; round++) {
+            int64_t pinchNumber = st_randomInt(0, 30);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            if (st_random() > 0.8) {
+                stPinchThreadSet_pinchBatchParallel(threadSet, pinches, pinchNumber);
+                stPinchThreadSet_pinchBatchParallel(threadSet2, pinches, pinchNumber);
+            } else {
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+                applyRandomOperations(threadSet2, pinches, pinchNumber, &newThreadName2);
+            }
+            checkAdjacencyComponentsAreEquivalent(testCase, threadSet, threadSet2);
+            free(pinches);
+        }
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+/*
+ * Checks the block ids are unique and less than the bound, returning a list of them in block iterator order.
+ */
+static stList *checkBlockIds(CuTest *testCase, stPinchThreadSet *threadSet) {
+    stList *blockIds = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+    int64_t blockIdBound = stPinchThreadSet_getBlockIdBound(threadSet);
+    bool *seen = st_calloc(blockIdBound + 1, sizeof(bool));
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        int64_t blockId = stPinchBlock_getId(block);
+        CuAssertTrue(testCase, blockId >= 0 && blockId < blockIdBound);
+        CuAssertTrue(testCase, !seen[blockId]);
+        seen[blockId] = 1;
+        for (int64_t orientation = 0; orientation < 2; orientation++) {
+            stPinchEnd end = stPinchEnd_constructStatic(block, orientation);
+            CuAssertIntEquals(testCase, 2 * blockId + orientation, stPinchEnd_getId(&end));
+        }
+        stList_append(blockIds, stIntTuple_construct1(blockId));
+    }
+    free(seen);
+    return blockIds;
+}
+
+static void testStPinchBlock_getId_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random block id test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        int64_t newThreadName = 1000;
+        for (int64_t round = 0; round < 5; round++) {
+            int64_t pinchNumber = st_randomInt(0, 50);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            stList *blockIds = checkBlockIds(testCase, threadSet);
+            double r = st_random();
+            if (r > 0.7) {
+                stPinchThreadSet_pinchBatchParallel(threadSet, pinches, pinchNumber);
+            } else if (r > 0.4) { //Rolling back must restore the ids
+                stPinchThreadSet_beginTransaction(threadSet);
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+                stPinchThreadSet_rollbackTransaction(threadSet);
+                stList *blockIds2 = checkBlockIds(testCase, threadSet);
+                CuAssertIntEquals(testCase, stList_length(blockIds), stList_length(blockIds2));
+                for (int64_t i = 0; i < stList_length(blockIds); i++) {
+                    CuAssertTrue(testCase, stIntTuple_equalsFn(stList_get(blockIds, i), stList_get(blockIds2, i)));
+                }
+                stList_destruct(blockIds2);
+            } else {
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+            }
+            stList_destruct(checkBlockIds(testCase, threadSet));
+            stList_destruct(blockIds);
+            free(pinches);
+        }
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
+/*
+ * Checks the block iterator returns each block found by scanning the segments exactly once.
+ */
+static void checkBlockRegistry(CuTest *testCase, stPinchThreadSet *threadSet) {
+    stHash *blocks = stHash_construct();
+    stPinchThreadSetSegmentIt segmentIt = stPinchThreadSet_getSegmentIt(threadSet);
+    stPinchSegment *segment;
+    while ((segment = stPinchThreadSetSegmentIt_getNext(&segmentIt)) != NULL) {
+        stPinchBlock *block = stPinchSegment_getBlock(segment);
+        if (block != NULL && stPinchBlock_getFirst(block) == segment) {
+            stHash_insert(blocks, block, block);
+        }
+    }
+    CuAssertIntEquals(testCase, stHash_size(blocks), stPinchThreadSet_getTotalBlockNumber(threadSet));
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        CuAssertPtrEquals(testCase, block, stHash_remove(blocks, block));
+    }
+    CuAssertIntEquals(testCase, 0, stHash_size(blocks));
+    stHash_destruct(blocks);
+}
+
+static void testStPinchThreadSet_blockRegistry_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random block registry test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        int64_t newThreadName = 1000;
+        for (int64_t round = 0; round < 5; round++) {
+            int64_t pinchNumber = st_randomInt(0, 50);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            double r = st_random();
+            if (r > 0.7) {
+                stPinchThreadSet_pinchBatchParallel(threadSet, pinches, pinchNumber);
+            } else if (r > 0.4) {
+                stPinchThreadSet_beginTransaction(threadSet);
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+                checkBlockRegistry(testCase, threadSet);
+                stPinchThreadSet_rollbackTransaction(threadSet);
+            } else {
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+            }
+            checkBlockRegistry(testCase, threadSet);
+            stPinchThreadSet_joinTrivialBoundaries(threadSet);
+            checkBlockRegistry(testCase, threadSet);
+            free(pinches);
+        }
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
+static void testStPinchThreadSet_snapshot_randomTests(CuTest *testCase) {
+    const char *fileName = "stPinchGraphsTest.snapshot";
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random snapshot test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
+        if (st_random() > 0.5) {
+            stPinchThreadSet_joinTrivialBoundaries(threadSet);
+        }
+        stPinchThreadSet_saveSnapshot(threadSet, fileName);
+        stPinchThreadSet *threadSet2 = stPinchThreadSet_loadSnapshot(fileName);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        //The loaded graph must be sound to modify
+        stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet);
+        stPinchThreadSet_pinchBatch(threadSet, &pinch, 1);
+        stPinchThreadSet_pinchBatch(threadSet2, &pinch, 1);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet2);
+        checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+    remove(fileName);
+}
+
 static bool checkIntersection(stSortedSet *names1, stSortedSet *names2) {
     stSortedSet *n12 = stSortedSet_getIntersection(names1, names2);
     bool b = stSortedSet_size(n12) > 0;
@@ -673,7 +1313,16 @@ static bool canMerge(stSortedSet *column1, stSortedSet *column2) {
     return !checkIntersection(getNames2(column1), getNames2(column2));
 }
 
-static void testStPinchThread_filterPinch_randomTests(CuTest *testCase) {
+static void testStPinchThread_filterPinch2_randomTests_filterFn(stPinchSegment **segments1, stPinchSegment **segments2,
+        bool *filtered, int64_t pairNumber, void *extraArg) {
+    *(int64_t *) extraArg += pairNumber;
+    for (int64_t i = 0; i < pairNumber; i++) {
+        filtered[i] = testStPinchThread_filterPinch_randomTests_filterFn(segments1[i], segments2[i]);
+    }
+}
+
+static void filterPinchRandomTests(CuTest *testCase, bool batched) {
+    int64_t pairNumber = 0;
     for (int64_t test = 0; test < 100; test++) {
         st_logInfo("Starting random pinch test %" PRIi64 "\n", test);
         stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
@@ -683,9 +1332,15 @@ static void testStPinchThread_filterPinch_randomTests(CuTest *testCase) {
         double threshold = st_random();
         while (st_random() > threshold) {
             stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet);
-            stPinchThread_filterPinch(stPinchThreadSet_getThread(threadSet, pinch.name1),
-                    stPinchThreadSet_getThread(threadSet, pinch.name2), pinch.start1, pinch.start2, pinch.length,
-                    pinch.strand, testStPinchThread_filterPinch_randomTests_filterFn);
+            if (batched) {
+                stPinchThread_filterPinch2(stPinchThreadSet_getThread(threadSet, pinch.name1),
+                        stPinchThreadSet_getThread(threadSet, pinch.name2), pinch.start1, pinch.start2, pinch.length,
+                        pinch.strand, testStPinchThread_filterPinch2_randomTests_filterFn, &pairNumber);
+            } else {
+                stPinchThread_filterPinch(stPinchThreadSet_getThread(threadSet, pinch.name1),
+                        stPinchThreadSet_getThread(threadSet, pinch.name2), pinch.start1, pinch.start2, pinch.length,
+                        pinch.strand, testStPinchThread_filterPinch_randomTests_filterFn);
+            }
             //now do all the pushing together of the equivalence classes
             for (int64_t i = 0; i < pinch.length; i++) {
                 stSortedSet *column1 = getColumn(columns, pinch.name1, pinch.start1 + i, 1);
@@ -702,6 +1357,15 @@ static void testStPinchThread_filterPinch_randomTests(CuTest *testCase) {
         }
         checkPinchSetsAreEquivalentAndCleanup(testCase, threadSet, columns);
     }
+    CuAssertTrue(testCase, !batched || pairNumber > 0);
+}
+
+static void testStPinchThread_filterPinch_randomTests(CuTest *testCase) {
+    filterPinchRandomTests(testCase, 0);
+}
+
+static void testStPinchThread_filterPinch2_randomTests(CuTest *testCase) {
+    filterPinchRandomTests(testCase, 1);
 }
 
 static void testStPinchThreadSet_joinTrivialBoundaries_randomTests(CuTest *testCase) {
@@ -733,6 +1397,130 @@ static void testStPinchThreadSet_joinTrivialBoundaries_randomTests(CuTest *testC
     }
 }
 
+static void testStPinchThreadSet_joinTrivialBoundariesParallel_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random parallel trivial boundaries test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        stPinchThreadSet_setAdjacencyComponentTracking(threadSet2, 1);
+        for (int64_t round = 0; round < 3; round++) {
+            int64_t pinchNumber = st_randomInt(0, 50);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            stPinchThreadSet_pinchBatch(threadSet, pinches, pinchNumber);
+            stPinchThreadSet_pinchBatch(threadSet2, pinches, pinchNumber);
+            if (round == 1) { //Check the adjacency components are tracked through the join
+                checkAdjacencyComponentsAreEquivalent(testCase, threadSet, threadSet2);
+            }
+            stPinchThreadSet_joinTrivialBoundaries(threadSet);
+            stPinchThreadSet_joinTrivialBoundariesParallel(threadSet2);
+            checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+            checkBlockRegistriesAreIdentical(testCase, threadSet, threadSet2);
+            checkBlockRegistry(testCase, threadSet2);
+            checkAdjacencyComponentsAreEquivalent(testCase, threadSet, threadSet2);
+            free(pinches);
+        }
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+/*
+ * Checks the two graphs have the same segments and the same blocks, allowing the blocks to differ in orientation and
+ * in the order of their segments.
+ */
+static void checkThreadSetsAreEquivalent(CuTest *testCase, stPinchThreadSet *threadSet1, stPinchThreadSet *threadSet2) {
+    CuAssertIntEquals(testCase, stPinchThreadSet_getTotalBlockNumber(threadSet1), stPinchThreadSet_getTotalBlockNumber(threadSet2));
+    stHash *blockMap = stHash_construct();
+    stHash *blockFlips = stHash_construct();
+    stPinchThreadSetSegmentIt segmentIt1 = stPinchThreadSet_getSegmentIt(threadSet1);
+    stPinchThreadSetSegmentIt segmentIt2 = stPinchThreadSet_getSegmentIt(threadSet2);
+    stPinchSegment *segment1, *segment2;
+    while ((segment1 = stPinchThreadSetSegmentIt_getNext(&segmentIt1)) != NULL) {
+        segment2 = stPinchThreadSetSegmentIt_getNext(&segmentIt2);
+        CuAssertTrue(testCase, segment2 != NULL);
+        checkSegmentsAreIdentical(testCase, segment1, segment2);
+        stPinchBlock *block1 = stPinchSegment_getBlock(segment1), *block2 = stPinchSegment_getBlock(segment2);
+        CuAssertIntEquals(testCase, block1 == NULL, block2 == NULL);
+        if (block1 != NULL) {
+            CuAssertIntEquals(testCase, stPinchBlock_getDegree(block1), stPinchBlock_getDegree(block2));
+            void *flip = (void *) (intptr_t) (1 + (stPinchSegment_getBlockOrientation(segment1) ^ stPinchSegment_getBlockOrientation(segment2)));
+            stPinchBlock *mappedBlock = stHash_search(blockMap, block1);
+            if (mappedBlock == NULL) {
+                stHash_insert(blockMap, block1, block2);
+                stHash_insert(blockFlips, block1, flip);
+            } else {
+                CuAssertPtrEquals(testCase, mappedBlock, block2);
+                CuAssertPtrEquals(testCase, stHash_search(blockFlips, block1), flip);
+            }
+        }
+    }
+    CuAssertPtrEquals(testCase, NULL, stPinchThreadSetSegmentIt_getNext(&segmentIt2));
+    stHash_destruct(blockMap);
+    stHash_destruct(blockFlips);
+}
+
+/*
+ * Checks no boundary is trivial and no two unaligned segments are adjacent.
+ */
+static void checkNoTrivialBoundaries(CuTest *testCase, stPinchThreadSet *threadSet) {
+    stPinchThreadSetSegmentIt segmentIt = stPinchThreadSet_getSegmentIt(threadSet);
+    stPinchSegment *segment;
+    while ((segment = stPinchThreadSetSegmentIt_getNext(&segmentIt)) != NULL) {
+        stPinchBlock *block = stPinchSegment_getBlock(segment);
+        if (block == NULL) {
+            stPinchSegment *nSegment = stPinchSegment_get3Prime(segment);
+            CuAssertTrue(testCase, nSegment == NULL || stPinchSegment_getBlock(nSegment) != NULL);
+        } else {
+            CuAssertTrue(testCase, !stPinchEnd_boundaryIsTrivial(stPinchEnd_constructStatic(block, 0)));
+            CuAssertTrue(testCase, !stPinchEnd_boundaryIsTrivial(stPinchEnd_constructStatic(block, 1)));
+        }
+    }
+}
+
+static void testStPinchThreadSet_joinTrivialBoundariesIncremental_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random incremental trivial boundaries test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        stPinchThreadSet_setTrivialBoundaryTracking(threadSet2, 1);
+        int64_t newThreadName = 1000, newThreadName2 = 1000;
+        for (int64_t round = 0; round < 5; round++) {
+            int64_t pinchNumber = st_randomInt(0, 30);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            double r = st_random();
+            if (r > 0.8) {
+                stPinchThreadSet_pinchBatchParallel(threadSet, pinches, pinchNumber);
+                stPinchThreadSet_pinchBatchParallel(threadSet2, pinches, pinchNumber);
+            } else if (r > 0.6) { //Changes rolled back must leave nothing to join
+                stPinchThreadSet_beginTransaction(threadSet2);
+                stPinchThreadSet_pinchBatch(threadSet2, pinches, pinchNumber);
+                stPinchThreadSet_rollbackTransaction(threadSet2);
+            } else {
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+                applyRandomOperations(threadSet2, pinches, pinchNumber, &newThreadName2);
+            }
+            stPinchThreadSet_joinTrivialBoundaries(threadSet);
+            if (st_random() > 0.5) {
+                stPinchThreadSet_joinTrivialBoundariesParallel(threadSet2);
+            } else {
+                stPinchThreadSet_joinTrivialBoundaries(threadSet2);
+            }
+            checkNoTrivialBoundaries(testCase, threadSet2);
+            checkThreadSetsAreIdentical(testCase, threadSet, threadSet2);
+            checkBlockRegistry(testCase, threadSet2);
+            free(pinches);
+        }
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
 static void testStPinchThreadSet_getAdjacencyComponents(CuTest *testCase) {
     //return;
     setup();
@@ -773,6 +1561,56 @@ static void testStPinchThreadSet_getAdjacencyComponents_randomTests(CuTest *test
     }
 }
 
+static void testStPinchThreadSet_getAdjacencyComponentsParallel_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random parallel adjacency component test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
+        stHash *endsToAdjacencyComponents, *endsToAdjacencyComponents2, *endsToAdjacencyComponents3;
+        stList *adjacencyComponents = stPinchThreadSet_getAdjacencyComponentsParallel(threadSet, &endsToAdjacencyComponents);
+        stList *adjacencyComponents2 = stPinchThreadSet_getAdjacencyComponents2(threadSet, &endsToAdjacencyComponents2);
+        //Check the partition of the ends is the same as that found serially
+        CuAssertIntEquals(testCase, stList_length(adjacencyComponents2), stList_length(adjacencyComponents));
+        CuAssertIntEquals(testCase, stHash_size(endsToAdjacencyComponents2), stHash_size(endsToAdjacencyComponents));
+        stHash *componentMap = stHash_construct();
+        for (int64_t i = 0; i < stList_length(adjacencyComponents); i++) {
+            stList *adjacencyComponent = stList_get(adjacencyComponents, i);
+            for (int64_t j = 0; j < stList_length(adjacencyComponent); j++) {
+                stPinchEnd *end = stList_get(adjacencyComponent, j);
+                CuAssertPtrEquals(testCase, adjacencyComponent, stHash_search(endsToAdjacencyComponents, end));
+                stList *adjacencyComponent2 = stHash_search(endsToAdjacencyComponents2, end);
+                CuAssertTrue(testCase, adjacencyComponent2 != NULL);
+                CuAssertIntEquals(testCase, stList_length(adjacencyComponent), stList_length(adjacencyComponent2));
+                stList *mappedAdjacencyComponent = stHash_search(componentMap, adjacencyComponent);
+                if (mappedAdjacencyComponent == NULL) {
+                    stHash_insert(componentMap, adjacencyComponent, adjacencyComponent2);
+                } else {
+                    CuAssertPtrEquals(testCase, mappedAdjacencyComponent, adjacencyComponent2);
+                }
+            }
+        }
+        //Check the order is deterministic, being that of the tracked components
+        stPinchThreadSet_setAdjacencyComponentTracking(threadSet, 1);
+        stList *adjacencyComponents3 = stPinchThreadSet_getAdjacencyComponents2(threadSet, &endsToAdjacencyComponents3);
+        CuAssertIntEquals(testCase, stList_length(adjacencyComponents3), stList_length(adjacencyComponents));
+        for (int64_t i = 0; i < stList_length(adjacencyComponents); i++) {
+            stList *adjacencyComponent = stList_get(adjacencyComponents, i);
+            stList *adjacencyComponent3 = stList_get(adjacencyComponents3, i);
+            CuAssertIntEquals(testCase, stList_length(adjacencyComponent3), stList_length(adjacencyComponent));
+            for (int64_t j = 0; j < stList_length(adjacencyComponent); j++) {
+                CuAssertTrue(testCase, stPinchEnd_equalsFn(stList_get(adjacencyComponent, j), stList_get(adjacencyComponent3, j)));
+            }
+        }
+        stPinchThreadSet_destruct(threadSet);
+        stHash_destruct(componentMap);
+        stHash_destruct(endsToAdjacencyComponents);
+        stHash_destruct(endsToAdjacencyComponents2);
+        stHash_destruct(endsToAdjacencyComponents3);
+        stList_destruct(adjacencyComponents);
+        stList_destruct(adjacencyComponents2);
+        stList_destruct(adjacencyComponents3);
+    }
+}
+
 static bool hasSelfLoopWithRespectToOtherBlock(stPinchEnd *end1, stPinchBlock *block2) {
     stPinchBlockIt sIt = stPinchBlock_getSegmentIterator(stPinchEnd_getBlock(end1));
     stPinchSegment *segment;
@@ -808,6 +1646,67 @@ static stList *getListOfBlocks(stPinchThreadSet *threadSet) {
     return blocks;
 }
 
+/*
+ * Counts the distinct ends reached by walking from each segment of the end's block to the next aligned segment.
+ */
+static int64_t getNumberOfConnectedPinchEnds(stPinchEnd *end) {
+    stSet *ends = stSet_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, (void (*)(void *)) stPinchEnd_destruct);
+    stPinchBlockIt blockIt = stPinchBlock_getSegmentIterator(end->block);
+    stPinchSegment *segment;
+    while ((segment = stPinchBlockIt_getNext(&blockIt)) != NULL) {
+        bool _5PrimeTraversal = stPinchEnd_traverse5Prime(end->orientation, segment);
+        do {
+            segment = _5PrimeTraversal ? stPinchSegment_get5Prime(segment) : stPinchSegment_get3Prime(segment);
+        } while (segment != NULL && stPinchSegment_getBlock(segment) == NULL);
+        if (segment != NULL) {
+            stPinchEnd end2 = stPinchEnd_constructStatic(stPinchSegment_getBlock(segment), stPinchEnd_endOrientation(_5PrimeTraversal, segment));
+            if (stSet_search(ends, &end2) == NULL) {
+                stSet_insert(ends, stPinchEnd_construct(end2.block, end2.orientation));
+            }
+        }
+    }
+    int64_t endNumber = stSet_size(ends);
+    stSet_destruct(ends);
+    return endNumber;
+}
+
+static void countConnectedPinchEnd(stPinchEnd *end, void *count) {
+    (*(int64_t *) count)++;
+}
+
+static void testStPinchEnd_getConnectedPinchEnds_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random connected pinch ends test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
+        stList *blocks = getListOfBlocks(threadSet);
+        for (int64_t i = 0; i < 2 * stList_length(blocks); i++) {
+            stPinchEnd end = stPinchEnd_constructStatic(stList_get(blocks, i / 2), i % 2);
+            stSet *connectedEnds = stPinchEnd_getConnectedPinchEnds(&end);
+            CuAssertIntEquals(testCase, getNumberOfConnectedPinchEnds(&end), stSet_size(connectedEnds));
+            int64_t endNumber = stPinchBlock_getDegree(end.block);
+            stPinchEnd *ends = st_malloc(sizeof(stPinchEnd) * endNumber);
+            //Check the ends put in the buffer are distinct and those in the set
+            CuAssertIntEquals(testCase, stSet_size(connectedEnds), stPinchEnd_getConnectedPinchEnds2(&end, ends, endNumber));
+            for (int64_t j = 0; j < stSet_size(connectedEnds); j++) {
+                CuAssertTrue(testCase, stSet_search(connectedEnds, &ends[j]) != NULL);
+                for (int64_t k = 0; k < j; k++) {
+                    CuAssertTrue(testCase, !stPinchEnd_equalsFn(&ends[j], &ends[k]));
+                }
+            }
+            //Check a buffer that is too small still gives the number
+            CuAssertIntEquals(testCase, stSet_size(connectedEnds), stPinchEnd_getConnectedPinchEnds2(&end, ends, 1));
+            CuAssertIntEquals(testCase, stSet_size(connectedEnds), stPinchEnd_getNumberOfConnectedPinchEnds(&end));
+            int64_t count = 0;
+            stPinchEnd_visitConnectedPinchEnds(&end, countConnectedPinchEnd, &count);
+            CuAssertIntEquals(testCase, stSet_size(connectedEnds), count);
+            free(ends);
+            stSet_destruct(connectedEnds);
+        }
+        stList_destruct(blocks);
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
 static void testStPinchEnd_hasSelfLoopWithRespectToOtherBlock_randomTests(CuTest *testCase) {
     for (int64_t test = 0; test < 10000; test++) {
         st_logInfo("Starting random has self loop with respect to other end test %" PRIi64 "\n", test);
@@ -886,6 +1785,63 @@ static void testStPinchEnd_getSubSequenceLengthsConnectingEnds_randomTests(CuTes
     }
 }
 
+static void testStPinchThreadSet_blockSegmentIndexing_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random block segment indexing test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet_setBlockSegmentIndexing(threadSet, 1);
+        int64_t newThreadName = 1000;
+        for (int64_t round = 0; round < 5; round++) {
+            int64_t pinchNumber = st_randomInt(0, 30);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            double r = st_random();
+            if (r > 0.8) {
+                stPinchThreadSet_pinchBatchParallel(threadSet, pinches, pinchNumber);
+            } else if (r > 0.6) { //Indices built within the transaction must not survive its rollback
+                int64_t oldNewThreadName = newThreadName;
+                stPinchThreadSet_beginTransaction(threadSet);
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+                stList *blocks = getListOfBlocks(threadSet);
+                for (int64_t i = 0; i < stList_length(blocks); i++) {
+                    stPinchEnd end = stPinchEnd_constructStatic(stList_get(blocks, i), 0);
+                    stList_destruct(stPinchEnd_getSubSequenceLengthsConnectingEnds(&end, &end));
+                }
+                stList_destruct(blocks);
+                newThreadName = oldNewThreadName;
+                stPinchThreadSet_rollbackTransaction(threadSet);
+            } else {
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+            }
+            if (st_random() > 0.8) {
+                stPinchThreadSet_compactSegments(threadSet);
+            }
+            //Check the queries agree with the naive versions, querying each block more than once
+            stList *blocks = getListOfBlocks(threadSet);
+            for (int64_t i = 0; i < 2 * stList_length(blocks); i++) {
+                stPinchEnd end1 = stPinchEnd_constructStatic(stList_get(blocks, i % stList_length(blocks)), st_random() > 0.5);
+                stPinchEnd end2 = stPinchEnd_constructStatic(st_randomChoice(blocks), st_random() > 0.5);
+                CuAssertIntEquals(testCase, hasSelfLoopWithRespectToOtherBlock(&end1, end2.block),
+                        stPinchEnd_hasSelfLoopWithRespectToOtherBlock(&end1, end2.block));
+                stList *lengths1 = getSubSequenceLengthsConnectingEnds(&end1, &end2);
+                stList *lengths2 = stPinchEnd_getSubSequenceLengthsConnectingEnds(&end1, &end2);
+                stSortedSet *lengths1Set = stList_getSortedSet(lengths1, (int (*)(const void *, const void *))stIntTuple_cmpFn);
+                stSortedSet *lengths2Set = stList_getSortedSet(lengths2, (int (*)(const void *, const void *))stIntTuple_cmpFn);
+                CuAssertTrue(testCase, stSortedSet_equals(lengths1Set, lengths2Set));
+                stSortedSet_destruct(lengths1Set);
+                stSortedSet_destruct(lengths2Set);
+                stList_destruct(lengths1);
+                stList_destruct(lengths2);
+            }
+            stList_destruct(blocks);
+            free(pinches);
+        }
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
 static void testStPinchThreadSet_getThreadComponents(CuTest *testCase) {
     for (int64_t test = 0; test < 100; test++) {
         st_logInfo("Starting random thread component test %" PRIi64 "\n", test);
@@ -924,6 +1880,86 @@ static void testStPinchThreadSet_getThreadComponents(CuTest *testCase) {
     }
 }
 
+/*
+ * Checks the maintained thread components against those computed from scratch from the blocks.
+ */
+static void checkThreadComponents(CuTest *testCase, stPinchThreadSet *threadSet) {
+    stUnionFind *components = stUnionFind_construct();
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        stUnionFind_add(components, thread);
+    }
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        stPinchBlockIt segmentIt = stPinchBlock_getSegmentIterator(block);
+        stPinchThread *firstThread = stPinchSegment_getThread(stPinchBlockIt_getNext(&segmentIt));
+        stPinchSegment *segment;
+        while ((segment = stPinchBlockIt_getNext(&segmentIt)) != NULL) {
+            stUnionFind_union(components, firstThread, stPinchSegment_getThread(segment));
+        }
+    }
+    int64_t componentNumber = 0;
+    stUnionFindIt *componentsIt = stUnionFind_getIterator(components);
+    while (stUnionFindIt_getNext(componentsIt) != NULL) {
+        componentNumber++;
+    }
+    stUnionFind_destructIterator(componentsIt);
+    CuAssertIntEquals(testCase, componentNumber, stPinchThreadSet_getThreadComponentNumber(threadSet));
+    stSortedSet *threadComponents = stPinchThreadSet_getThreadComponents(threadSet);
+    CuAssertIntEquals(testCase, componentNumber, stSortedSet_size(threadComponents));
+    stSortedSet_destruct(threadComponents);
+    stList *threads = stList_construct();
+    threadIt = stPinchThreadSet_getIt(threadSet);
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        stList_append(threads, thread);
+    }
+    for (int64_t i = 0; i < 20; i++) {
+        stPinchThread *thread1 = stList_get(threads, st_randomInt(0, stList_length(threads)));
+        stPinchThread *thread2 = stList_get(threads, st_randomInt(0, stList_length(threads)));
+        bool sameComponent = stUnionFind_find(components, thread1) == stUnionFind_find(components, thread2);
+        CuAssertIntEquals(testCase, sameComponent, stPinchThreadSet_threadsAreInSameComponent(threadSet, thread1, thread2));
+        CuAssertIntEquals(testCase, sameComponent, stPinchThreadSet_getThreadComponentLabel(threadSet, thread1)
+                == stPinchThreadSet_getThreadComponentLabel(threadSet, thread2));
+    }
+    stList_destruct(threads);
+    stUnionFind_destruct(components);
+}
+
+static void testStPinchThreadSet_threadComponentTracking_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random thread component tracking test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        int64_t newThreadName = 1000;
+        for (int64_t round = 0; round < 5; round++) {
+            int64_t pinchNumber = st_randomInt(0, 30);
+            stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+            for (int64_t i = 0; i < pinchNumber; i++) {
+                pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+            }
+            double r = st_random();
+            if (r > 0.8) {
+                stPinchThreadSet_pinchBatchParallel(threadSet, pinches, pinchNumber);
+            } else if (r > 0.6) { //Rollback must restore the components
+                int64_t oldNewThreadName = newThreadName;
+                stPinchThreadSet_beginTransaction(threadSet);
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+                checkThreadComponents(testCase, threadSet);
+                newThreadName = oldNewThreadName;
+                stPinchThreadSet_rollbackTransaction(threadSet);
+            } else if (r > 0.3) {
+                stPinchThreadSet_pinchBatch(threadSet, pinches, pinchNumber);
+            } else {
+                applyRandomOperations(threadSet, pinches, pinchNumber, &newThreadName);
+            }
+            checkThreadComponents(testCase, threadSet);
+            free(pinches);
+        }
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
 static void testStPinchThreadSet_trimAlignments_randomTests(CuTest *testCase) {
     //return;
     for (int64_t test = 0; test < 100; test++) {
@@ -941,6 +1977,145 @@ static void testStPinchThreadSet_trimAlignments_randomTests(CuTest *testCase) {
     }
 }
 
+static void testStPinchThreadSet_trimAllBlocks_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random trim all blocks test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet);
+        stPinchThreadSet *threadSet3 = copyEmptyGraph(threadSet);
+        stPinchThreadSet_setTrivialBoundaryTracking(threadSet2, st_random() > 0.5);
+        stPinchThreadSet_setTrivialBoundaryTracking(threadSet3, st_random() > 0.5);
+        int64_t pinchNumber = st_randomInt(0, 50);
+        stPinch *pinches = st_malloc(sizeof(stPinch) * (pinchNumber + 1));
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            pinches[i] = stPinchThreadSet_getRandomPinch(threadSet);
+        }
+        stPinchThreadSet_pinchBatch(threadSet, pinches, pinchNumber);
+        stPinchThreadSet_pinchBatch(threadSet2, pinches, pinchNumber);
+        stPinchThreadSet_pinchBatch(threadSet3, pinches, pinchNumber);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet2);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet3);
+        //Trim each of the blocks there are, one by one
+        int64_t trim = st_randomInt(0, 10);
+        stList *blocks = getListOfBlocks(threadSet);
+        for (int64_t i = 0; i < stList_length(blocks); i++) {
+            stPinchBlock_trim(stList_get(blocks, i), trim);
+        }
+        stList_destruct(blocks);
+        //The blocks long enough to be trimmed are kept, in registry order
+        stList *keptBlocks = stList_construct();
+        stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet2);
+        stPinchBlock *block;
+        while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+            if (trim <= 0 || stPinchBlock_getLength(block) > 2 * trim) {
+                stList_append(keptBlocks, block);
+            }
+        }
+        stPinchThreadSet_trimAllBlocks(threadSet2, trim);
+        stPinchThreadSet_trimAllBlocksParallel(threadSet3, trim);
+        checkThreadSetsAreEquivalent(testCase, threadSet, threadSet2);
+        checkThreadSetsAreIdentical(testCase, threadSet2, threadSet3);
+        checkBlockRegistriesAreIdentical(testCase, threadSet2, threadSet3);
+        blockIt = stPinchThreadSet_getBlockIt(threadSet2);
+        for (int64_t i = 0; i < stList_length(keptBlocks); i++) {
+            CuAssertPtrEquals(testCase, stList_get(keptBlocks, i), stPinchThreadSetBlockIt_getNext(&blockIt));
+        }
+        CuAssertPtrEquals(testCase, NULL, stPinchThreadSetBlockIt_getNext(&blockIt));
+        stList_destruct(keptBlocks);
+        checkBlockRegistry(testCase, threadSet2);
+        checkThreadComponents(testCase, threadSet2);
+        checkThreadComponents(testCase, threadSet3);
+        //The changes recorded by trimming must allow the trivial boundaries it makes to be joined
+        stPinchThreadSet_joinTrivialBoundaries(threadSet);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet2);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet3);
+        checkNoTrivialBoundaries(testCase, threadSet2);
+        checkNoTrivialBoundaries(testCase, threadSet3);
+        checkThreadSetsAreEquivalent(testCase, threadSet, threadSet2);
+        checkThreadSetsAreIdentical(testCase, threadSet2, threadSet3);
+        free(pinches);
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+        stPinchThreadSet_destruct(threadSet3);
+    }
+}
+
+static void testStPinchThreadSet_concurrentReads(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random concurrent reads test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
+        //Collect the queries and their answers serially
+        stList *segments = stList_construct();
+        stPinchThreadSetSegmentIt segmentIt = stPinchThreadSet_getSegmentIt(threadSet);
+        stPinchSegment *segment;
+        while ((segment = stPinchThreadSetSegmentIt_getNext(&segmentIt)) != NULL) {
+            stList_append(segments, segment);
+        }
+        stList *blocks = getListOfBlocks(threadSet);
+        int64_t *connectedEnds = st_malloc(sizeof(int64_t) * (2 * stList_length(blocks) + 1));
+        for (int64_t i = 0; i < stList_length(blocks); i++) {
+            for (int64_t j = 0; j < 2; j++) {
+                stPinchEnd end = stPinchEnd_constructStatic(stList_get(blocks, i), j);
+                connectedEnds[2 * i + j] = stPinchEnd_getNumberOfConnectedPinchEnds(&end);
+            }
+        }
+        //Now repeat the queries concurrently, checking they get the same answers
+        int64_t failures = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:failures)
+#endif
+        for (int64_t i = 0; i < stList_length(segments); i++) {
+            stPinchSegment *segment = stList_get(segments, i);
+            for (int64_t j = 0; j < stPinchSegment_getLength(segment); j++) {
+                failures += stPinchThreadSet_getSegment(threadSet, stPinchSegment_getName(segment),
+                        stPinchSegment_getStart(segment) + j) != segment;
+            }
+            failures += stPinchThreadSet_getThread(threadSet, stPinchSegment_getName(segment)) != stPinchSegment_getThread(segment);
+        }
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:failures)
+#endif
+        for (int64_t i = 0; i < 2 * stList_length(blocks); i++) {
+            stPinchEnd end = stPinchEnd_constructStatic(stList_get(blocks, i / 2), i % 2);
+            failures += stPinchEnd_getNumberOfConnectedPinchEnds(&end) != connectedEnds[i];
+        }
+        CuAssertIntEquals(testCase, 0, failures);
+        //The first queries after a modification bring derived state up to date, which must also be safe concurrently
+        stPinchThreadSet_setAdjacencyComponentTracking(threadSet, 1);
+        stPinchThreadSet_setBlockSegmentIndexing(threadSet, st_random() > 0.5);
+        if (stList_length(blocks) > 0) {
+            stPinchBlock_destruct(stList_pop(blocks)); //May split a thread component
+        }
+        int64_t endNumber = 2 * stList_length(blocks);
+        int64_t *answers = st_malloc(sizeof(int64_t) * (3 * endNumber + 1));
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (int64_t i = 0; i < endNumber; i++) {
+            stPinchBlock *block = stList_get(blocks, i / 2);
+            stPinchEnd end = stPinchEnd_constructStatic(block, i % 2);
+            answers[3 * i] = stPinchThreadSet_getAdjacencyComponentLabel(threadSet, &end);
+            answers[3 * i + 1] = stPinchThreadSet_getThreadComponentLabel(threadSet, stPinchSegment_getThread(stPinchBlock_getFirst(block)));
+            answers[3 * i + 2] = stPinchEnd_hasSelfLoopWithRespectToOtherBlock(&end, stList_get(blocks, (i / 2 + 1) % stList_length(blocks)));
+        }
+        for (int64_t i = 0; i < endNumber; i++) {
+            stPinchBlock *block = stList_get(blocks, i / 2);
+            stPinchEnd end = stPinchEnd_constructStatic(block, i % 2);
+            CuAssertIntEquals(testCase, stPinchThreadSet_getAdjacencyComponentLabel(threadSet, &end), answers[3 * i]);
+            CuAssertIntEquals(testCase, stPinchThreadSet_getThreadComponentLabel(threadSet,
+                    stPinchSegment_getThread(stPinchBlock_getFirst(block))), answers[3 * i + 1]);
+            CuAssertIntEquals(testCase, stPinchEnd_hasSelfLoopWithRespectToOtherBlock(&end,
+                    stList_get(blocks, (i / 2 + 1) % stList_length(blocks))), answers[3 * i + 2]);
+        }
+        free(answers);
+        free(connectedEnds);
+        stList_destruct(segments);
+        stList_destruct(blocks);
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
 static void testStPinchInterval(CuTest *testCase) {
     setup();
     stPinchInterval *interval = stPinchInterval_construct(name1, start1, length1, testCase);
@@ -1067,23 +2242,106 @@ static void testStPinchThreadSet_getLabelIntervals_randomTests(CuTest *testCase)
     }
 }
 
+static void testStPinchIntervalIndex_randomTests(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting random label interval index test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
+        stHash *pinchEndsToAdjacencyComponents;
+        stList *adjacencyComponents = stPinchThreadSet_getAdjacencyComponents2(threadSet,
+                &pinchEndsToAdjacencyComponents);
+        stSortedSet *intervals = stPinchThreadSet_getLabelIntervals(threadSet, pinchEndsToAdjacencyComponents);
+        stPinchIntervalIndex *index = stPinchThreadSet_getLabelIntervalIndex(threadSet, pinchEndsToAdjacencyComponents);
+        CuAssertIntEquals(testCase, stSortedSet_size(intervals), stPinchIntervalIndex_getSize(index));
+        //Check single and batched lookups of every position, and some either side of each thread, agree with the sorted set
+        stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+        stPinchThread *thread;
+        while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+            int64_t name = stPinchThread_getName(thread);
+            int64_t positionNumber = 0;
+            int64_t *positions = st_malloc(sizeof(int64_t) * (stPinchThread_getLength(thread) + 4));
+            for (int64_t position = stPinchThread_getStart(thread) - 2;
+                    position < stPinchThread_getStart(thread) + stPinchThread_getLength(thread) + 2; position++) {
+                if (st_random() > 0.5) {
+                    positions[positionNumber++] = position;
+                }
+                stPinchInterval *interval = stPinchIntervals_getInterval(intervals, name, position);
+                stPinchInterval *interval2 = stPinchIntervalIndex_getInterval(index, name, position);
+                CuAssertIntEquals(testCase, interval == NULL, interval2 == NULL);
+                if (interval != NULL) {
+                    CuAssertIntEquals(testCase, 0, stPinchInterval_compareFunction(interval, interval2));
+                    CuAssertPtrEquals(testCase, stPinchInterval_getLabel(interval), stPinchInterval_getLabel(interval2));
+                }
+            }
+            stPinchInterval **intervals2 = st_malloc(sizeof(stPinchInterval *) * (positionNumber + 1));
+            stPinchIntervalIndex_getIntervals(index, name, positions, positionNumber, intervals2);
+            for (int64_t i = 0; i < positionNumber; i++) {
+                CuAssertPtrEquals(testCase, stPinchIntervalIndex_getInterval(index, name, positions[i]), intervals2[i]);
+            }
+            free(intervals2);
+            free(positions);
+        }
+        CuAssertPtrEquals(testCase, NULL, stPinchIntervalIndex_getInterval(index, -1, 0));
+        //Check the index made in parallel is identical
+        stPinchIntervalIndex *index2 = stPinchThreadSet_getLabelIntervalIndexParallel(threadSet, pinchEndsToAdjacencyComponents);
+        CuAssertIntEquals(testCase, stPinchIntervalIndex_getSize(index), stPinchIntervalIndex_getSize(index2));
+        stSortedSetIterator *intervalIt = stSortedSet_getIterator(intervals);
+        stPinchInterval *interval;
+        while ((interval = stSortedSet_getNext(intervalIt)) != NULL) {
+            stPinchInterval *interval2 = stPinchIntervalIndex_getInterval(index2, stPinchInterval_getName(interval),
+                    stPinchInterval_getStart(interval));
+            CuAssertTrue(testCase, interval2 != NULL);
+            CuAssertIntEquals(testCase, 0, stPinchInterval_compareFunction(interval, interval2));
+            CuAssertPtrEquals(testCase, stPinchInterval_getLabel(interval), stPinchInterval_getLabel(interval2));
+        }
+        stSortedSet_destructIterator(intervalIt);
+        stPinchIntervalIndex_destruct(index2);
+        //Cleanup
+        stPinchIntervalIndex_destruct(index);
+        stSortedSet_destruct(intervals);
+        stHash_destruct(pinchEndsToAdjacencyComponents);
+        stList_destruct(adjacencyComponents);
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
 CuSuite* stPinchGraphsTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testStPinchThreadSet);
     SUITE_ADD_TEST(suite, testStPinchThreadAndSegment);
+    SUITE_ADD_TEST(suite, testStPinchThread_getSegment_randomTests);
     SUITE_ADD_TEST(suite, testStPinchBlock_NoSplits);
     SUITE_ADD_TEST(suite, testStPinchBlock_Splits);
+    SUITE_ADD_TEST(suite, testStPinchSegment_putSegmentFirstInBlockAndRemoveFromBlock_randomTests);
     SUITE_ADD_TEST(suite, testStPinchThread_pinch);
     SUITE_ADD_TEST(suite, testStPinchThread_pinch_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_pinchBatch_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_getThread_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_pinchBatchParallel_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_compactSegments_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_transactions_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_snapshot_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_adjacencyComponentTracking_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchBlock_getId_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_blockRegistry_randomTests);
     SUITE_ADD_TEST(suite, testStPinchThread_filterPinch_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThread_filterPinch2_randomTests);
     SUITE_ADD_TEST(suite, testStPinchThreadSet_getAdjacencyComponents);
     SUITE_ADD_TEST(suite, testStPinchThreadSet_getAdjacencyComponents_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_getAdjacencyComponentsParallel_randomTests);
     SUITE_ADD_TEST(suite, testStPinchThreadSet_joinTrivialBoundaries_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_joinTrivialBoundariesParallel_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_joinTrivialBoundariesIncremental_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_blockSegmentIndexing_randomTests);
     SUITE_ADD_TEST(suite, testStPinchThreadSet_getThreadComponents);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_threadComponentTracking_randomTests);
     SUITE_ADD_TEST(suite, testStPinchThreadSet_trimAlignments_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_trimAllBlocks_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchThreadSet_concurrentReads);
     SUITE_ADD_TEST(suite, testStPinchInterval);
     SUITE_ADD_TEST(suite, testStPinchThreadSet_getLabelIntervals);
     SUITE_ADD_TEST(suite, testStPinchThreadSet_getLabelIntervals_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchIntervalIndex_randomTests);
+    SUITE_ADD_TEST(suite, testStPinchEnd_getConnectedPinchEnds_randomTests);
     SUITE_ADD_TEST(suite, testStPinchEnd_hasSelfLoopWithRespectToOtherBlock_randomTests);
     SUITE_ADD_TEST(suite, testStPinchEnd_getSubSequenceLengthsConnectingEnds_randomTests);
 
@@ -0,0 +1,27 @@
+/*
+ * stPinchTestCommon.h
+ *
+ * Helpers shared by the pinch graph and pinch alignment tests, defined in stPinchGraphsTest.c.
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef ST_PINCH_TEST_COMMON_H_
+#define ST_PINCH_TEST_COMMON_H_
+
+#include "CuTest.h"
+#include "stPinchGraphs.h"
+
+/*
+ * Returns a new graph with the threads of the given graph and no blocks.
+ */
+stPinchThreadSet *copyEmptyGraph(stPinchThreadSet *threadSet);
+
+void checkSegmentsAreIdentical(CuTest *testCase, stPinchSegment *segment1, stPinchSegment *segment2);
+
+/*
+ * Checks the two graphs have the same segments and the same blocks, with the segments of each block in the same order and orientation.
+ */
+void checkThreadSetsAreIdentical(CuTest *testCase, stPinchThreadSet *threadSet1, stPinchThreadSet *threadSet2);
+
+#endif /* ST_PINCH_TEST_COMMON_H_ */